@@ -0,0 +1,90 @@
+#include "arena.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct ArenaBlock {
+    ArenaBlock* prev;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+#define ARENA_ALIGN 8
+
+void arena_init(Arena* arena) {
+    arena->block = NULL;
+    arena->spare = NULL;
+}
+
+static void drop_block(Arena* arena) {
+    ArenaBlock* block = arena->block;
+    arena->block = block->prev;
+    // Keep the larger of the two so a big word is not reallocated every time
+    if (arena->spare && arena->spare->size >= block->size) {
+        free(block);
+        return;
+    }
+    free(arena->spare);
+    arena->spare = block;
+}
+
+void arena_free(Arena* arena) {
+    while (arena->block) {
+        ArenaBlock* prev = arena->block->prev;
+        free(arena->block);
+        arena->block = prev;
+    }
+    free(arena->spare);
+    arena->spare = NULL;
+}
+
+static void new_block(Arena* arena, size_t size) {
+    ArenaBlock* block = arena->spare;
+    if (block && block->size >= size) {
+        arena->spare = NULL;
+    }
+    else {
+        if (size < ARENA_BLOCK_SIZE) size = ARENA_BLOCK_SIZE;
+        block = xmalloc(sizeof(ArenaBlock) + size);
+        block->size = size;
+    }
+    block->used = 0;
+    block->prev = arena->block;
+    arena->block = block;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    ArenaBlock* block = arena->block;
+    size_t start = block ? (block->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1) : 0;
+    if (!block || start + size > block->size) {
+        new_block(arena, size);
+        block = arena->block;
+        start = 0;
+    }
+    block->used = start + size;
+    return block->data + start;
+}
+
+char* arena_strndup(Arena* arena, const char* s, size_t len) {
+    char* copy = arena_alloc(arena, len + 1);
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+void arena_pop_to(Arena* arena, const void* ptr) {
+    const char* p = ptr;
+    while (arena->block) {
+        ArenaBlock* block = arena->block;
+        if (p >= block->data && p < block->data + block->size) {
+            block->used = (size_t)(p - block->data);
+            return;
+        }
+        drop_block(arena);
+    }
+}
+
+void arena_reset(Arena* arena) {
+    while (arena->block) drop_block(arena);
+}
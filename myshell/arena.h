@@ -0,0 +1,30 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump-pointer allocator for short-lived data such as expanded words.
+// Allocations are freed in bulk: arena_pop_to drops one allocation and
+// everything made after it, arena_reset drops everything.
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+    ArenaBlock* block;          // newest block, allocations come from here
+    ArenaBlock* spare;          // last block given back, reused before malloc
+} Arena;
+
+#define ARENA_BLOCK_SIZE 16384
+
+void arena_init(Arena* arena);
+void arena_free(Arena* arena);
+void* arena_alloc(Arena* arena, size_t size);
+char* arena_strndup(Arena* arena, const char* s, size_t len);
+
+// ptr must come from the arena; it and every later allocation are freed
+void arena_pop_to(Arena* arena, const void* ptr);
+
+// Free everything, keeping one block for the next user
+void arena_reset(Arena* arena);
+
+#endif
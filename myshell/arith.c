@@ -0,0 +1,457 @@
+#include "arith.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// Binding powers, lowest first, following the C/bash precedence table
+enum {
+    BP_NONE,
+    BP_COMMA,
+    BP_ASSIGN,
+    BP_COND,
+    BP_OR,
+    BP_AND,
+    BP_BOR,
+    BP_BXOR,
+    BP_BAND,
+    BP_EQUALITY,
+    BP_RELATIONAL,
+    BP_SHIFT,
+    BP_ADDITIVE,
+    BP_MULTIPLICATIVE,
+    BP_POWER,
+    BP_UNARY
+};
+
+// Parentheses and unary operators nest by recursion, so absurdly deep
+// nesting is an error rather than a stack overflow, as in other shells
+#define MAX_ARITH_DEPTH 1024
+
+typedef struct {
+    const char* p;
+    const char* error;
+    int depth;
+} ArithParser;
+
+typedef struct {
+    const char* text;
+    ArithOp op;
+    int bp;
+} BinaryOp;
+
+// Longest operators first so "<<" is not read as "<"
+static const BinaryOp binary_ops[] = {
+    { "**", AOP_POW, BP_POWER },
+    { "<<", AOP_SHL, BP_SHIFT },
+    { ">>", AOP_SHR, BP_SHIFT },
+    { "<=", AOP_LE, BP_RELATIONAL },
+    { ">=", AOP_GE, BP_RELATIONAL },
+    { "==", AOP_EQ, BP_EQUALITY },
+    { "!=", AOP_NE, BP_EQUALITY },
+    { "*", AOP_MUL, BP_MULTIPLICATIVE },
+    { "/", AOP_DIV, BP_MULTIPLICATIVE },
+    { "%", AOP_MOD, BP_MULTIPLICATIVE },
+    { "+", AOP_ADD, BP_ADDITIVE },
+    { "-", AOP_SUB, BP_ADDITIVE },
+    { "<", AOP_LT, BP_RELATIONAL },
+    { ">", AOP_GT, BP_RELATIONAL },
+    { "&", AOP_BAND, BP_BAND },
+    { "^", AOP_BXOR, BP_BXOR },
+    { "|", AOP_BOR, BP_BOR },
+};
+
+// Compound assignment operators, again longest first
+static const BinaryOp assign_ops[] = {
+    { "<<=", AOP_SHL, 0 },
+    { ">>=", AOP_SHR, 0 },
+    { "+=", AOP_ADD, 0 },
+    { "-=", AOP_SUB, 0 },
+    { "*=", AOP_MUL, 0 },
+    { "/=", AOP_DIV, 0 },
+    { "%=", AOP_MOD, 0 },
+    { "&=", AOP_BAND, 0 },
+    { "^=", AOP_BXOR, 0 },
+    { "|=", AOP_BOR, 0 },
+    { "=", AOP_NONE, 0 },
+};
+
+static ArithNode* new_node(ArithKind kind) {
+    ArithNode* node = xcalloc(1, sizeof(ArithNode));
+    node->kind = kind;
+    return node;
+}
+
+void arith_free(ArithNode* node) {
+    if (!node) return;
+    arith_free(node->a);
+    arith_free(node->b);
+    arith_free(node->c);
+    free(node->name);
+    free(node);
+}
+
+int arith_apply(ArithOp op, int64_t a, int64_t b, int64_t* result) {
+    // Wrap around on overflow instead of invoking undefined behaviour
+    uint64_t ua = (uint64_t)a;
+    uint64_t ub = (uint64_t)b;
+    switch (op) {
+    case AOP_ADD: *result = (int64_t)(ua + ub); return 1;
+    case AOP_SUB: *result = (int64_t)(ua - ub); return 1;
+    case AOP_MUL: *result = (int64_t)(ua * ub); return 1;
+    case AOP_DIV:
+    case AOP_MOD:
+        if (b == 0) return 0;
+        if (b == -1) *result = op == AOP_DIV ? (int64_t)(0 - ua) : 0;
+        else *result = op == AOP_DIV ? a / b : a % b;
+        return 1;
+    case AOP_POW: {
+        if (b < 0) return 0;
+        // Square and multiply: one step per bit of the exponent
+        uint64_t value = 1;
+        while (ub) {
+            if (ub & 1) value *= ua;
+            ua *= ua;
+            ub >>= 1;
+        }
+        *result = (int64_t)value;
+        return 1;
+    }
+    case AOP_SHL: *result = (int64_t)(ua << (ub & 63)); return 1;
+    case AOP_SHR: *result = a >> (ub & 63); return 1;
+    case AOP_LT: *result = a < b; return 1;
+    case AOP_LE: *result = a <= b; return 1;
+    case AOP_GT: *result = a > b; return 1;
+    case AOP_GE: *result = a >= b; return 1;
+    case AOP_EQ: *result = a == b; return 1;
+    case AOP_NE: *result = a != b; return 1;
+    case AOP_BAND: *result = a & b; return 1;
+    case AOP_BXOR: *result = a ^ b; return 1;
+    case AOP_BOR: *result = a | b; return 1;
+    default: return 0;
+    }
+}
+
+static void skip_space(ArithParser* ap) {
+    while (isspace((unsigned char)*ap->p)) ap->p++;
+}
+
+static int accept(ArithParser* ap, const char* text) {
+    skip_space(ap);
+    size_t len = strlen(text);
+    if (strncmp(ap->p, text, len) != 0) return 0;
+    ap->p += len;
+    return 1;
+}
+
+static ArithNode* fail(ArithParser* ap, const char* message, ArithNode* node) {
+    if (!ap->error) ap->error = message;
+    arith_free(node);
+    return NULL;
+}
+
+static int digit_value(int ch, int base) {
+    if (isdigit(ch)) return ch - '0';
+    if (ch >= 'a' && ch <= 'z') return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'Z') return ch - 'A' + (base > 36 ? 36 : 10);
+    if (ch == '@') return 62;
+    if (ch == '_') return 63;
+    return 99;
+}
+
+// 42, 0x2a, 052 or base#digits
+static ArithNode* parse_number(ArithParser* ap) {
+    const char* start = ap->p;
+    char* end;
+    int64_t value = (int64_t)strtoull(start, &end, 0);
+    ap->p = end;
+
+    if (*ap->p == '#') {
+        int64_t base = strtoll(start, NULL, 10);
+        if (base < 2 || base > 64) return fail(ap, "invalid arithmetic base", NULL);
+        ap->p++;
+        value = 0;
+        const char* digits = ap->p;
+        while (isalnum((unsigned char)*ap->p) || *ap->p == '@' || *ap->p == '_') {
+            int digit = digit_value((unsigned char)*ap->p, (int)base);
+            if (digit >= base) return fail(ap, "value too great for base", NULL);
+            value = (int64_t)((uint64_t)value * (uint64_t)base + (uint64_t)digit);
+            ap->p++;
+        }
+        if (ap->p == digits) return fail(ap, "invalid number", NULL);
+    }
+    if (isalnum((unsigned char)*ap->p) || *ap->p == '_') return fail(ap, "invalid number", NULL);
+
+    ArithNode* node = new_node(ARITH_NUM);
+    node->value = value;
+    return node;
+}
+
+// name, $name, ${name}, $1, $?, $#, $$
+static char* parse_name(ArithParser* ap) {
+    const char* p = ap->p;
+    int braced = 0;
+    if (*p == '$') {
+        p++;
+        if (*p == '{') {
+            braced = 1;
+            p++;
+        }
+    }
+
+    const char* start = p;
+    if (*p == '_' || isalpha((unsigned char)*p)) {
+        while (*p == '_' || isalnum((unsigned char)*p)) p++;
+    }
+    else if (start != ap->p && (isdigit((unsigned char)*p) || strchr("?#$", *p))) {
+        p++;
+        if (braced) while (isdigit((unsigned char)*p)) p++;
+    }
+    if (p == start) return NULL;
+    if (braced && *p++ != '}') return NULL;
+
+    char* name = xstrndup(start, (braced ? p - 1 : p) - start);
+    ap->p = p;
+    return name;
+}
+
+static ArithNode* parse_expr(ArithParser* ap, int min_bp);
+
+static ArithNode* parse_prefix(ArithParser* ap) {
+    skip_space(ap);
+    const char* p = ap->p;
+
+    if (*p == '(') {
+        ap->p++;
+        ArithNode* inner = parse_expr(ap, BP_COMMA);
+        if (!inner) return NULL;
+        if (!accept(ap, ")")) return fail(ap, "missing `)'", inner);
+        return inner;
+    }
+
+    if ((p[0] == '+' && p[1] == '+') || (p[0] == '-' && p[1] == '-')) {
+        int inc = p[0] == '+';
+        ap->p += 2;
+        skip_space(ap);
+        char* name = parse_name(ap);
+        if (!name) return fail(ap, "syntax error: operand expected", NULL);
+        ArithNode* node = new_node(ARITH_INCDEC);
+        node->op = inc ? AOP_ADD : AOP_SUB;
+        node->prefix = 1;
+        node->name = name;
+        return node;
+    }
+
+    ArithOp unary = AOP_NONE;
+    if (*p == '-') unary = AOP_NEG;
+    else if (*p == '+') unary = AOP_PLUS;
+    else if (*p == '~') unary = AOP_BNOT;
+    else if (*p == '!') unary = AOP_LNOT;
+    if (unary != AOP_NONE) {
+        ap->p++;
+        ArithNode* operand = parse_expr(ap, BP_UNARY);
+        if (!operand) return NULL;
+        ArithNode* node = new_node(ARITH_UNARY);
+        node->op = unary;
+        node->a = operand;
+        return node;
+    }
+
+    if (isdigit((unsigned char)*p)) return parse_number(ap);
+
+    char* name = parse_name(ap);
+    if (!name) return fail(ap, "syntax error: operand expected", NULL);
+
+    // Assignment and postfix forms need the name itself, not its value
+    skip_space(ap);
+    if ((ap->p[0] == '+' && ap->p[1] == '+') || (ap->p[0] == '-' && ap->p[1] == '-')) {
+        ArithNode* node = new_node(ARITH_INCDEC);
+        node->op = ap->p[0] == '+' ? AOP_ADD : AOP_SUB;
+        node->name = name;
+        ap->p += 2;
+        return node;
+    }
+    for (size_t i = 0; i < sizeof(assign_ops) / sizeof(assign_ops[0]); i++) {
+        size_t len = strlen(assign_ops[i].text);
+        // "==" is a comparison, not an assignment
+        if (strncmp(ap->p, assign_ops[i].text, len) != 0 || (len == 1 && ap->p[1] == '=')) continue;
+        ap->p += len;
+        ArithNode* value = parse_expr(ap, BP_ASSIGN);
+        if (!value) {
+            free(name);
+            return NULL;
+        }
+        ArithNode* node = new_node(ARITH_ASSIGN);
+        node->op = assign_ops[i].op;
+        node->name = name;
+        node->a = value;
+        return node;
+    }
+
+    ArithNode* node = new_node(ARITH_VAR);
+    node->name = name;
+    return node;
+}
+
+static ArithNode* parse_operators(ArithParser* ap, int min_bp) {
+    ArithNode* left = parse_prefix(ap);
+    if (!left) return NULL;
+
+    for (;;) {
+        skip_space(ap);
+        const char* p = ap->p;
+        if (!*p || *p == ')' || *p == ':') return left;
+
+        if (*p == ',' || *p == '?' || (p[0] == '&' && p[1] == '&') || (p[0] == '|' && p[1] == '|')) {
+            ArithKind kind = *p == ',' ? ARITH_COMMA : *p == '?' ? ARITH_COND :
+                *p == '&' ? ARITH_AND : ARITH_OR;
+            int bp = kind == ARITH_COMMA ? BP_COMMA : kind == ARITH_COND ? BP_COND :
+                kind == ARITH_AND ? BP_AND : BP_OR;
+            if (bp < min_bp) return left;
+            ap->p += kind == ARITH_COMMA || kind == ARITH_COND ? 1 : 2;
+
+            ArithNode* node = new_node(kind);
+            node->a = left;
+            if (kind == ARITH_COND) {
+                // Right-associative: a ? b : c ? d : e
+                node->b = parse_expr(ap, BP_COMMA);
+                if (!node->b) return fail(ap, NULL, node);
+                if (!accept(ap, ":")) return fail(ap, "`:' expected for conditional expression", node);
+                node->c = parse_expr(ap, BP_COND);
+            }
+            else {
+                node->b = parse_expr(ap, bp + 1);
+            }
+            if (!node->b || (kind == ARITH_COND && !node->c)) return fail(ap, NULL, node);
+            left = node;
+            continue;
+        }
+
+        const BinaryOp* op = NULL;
+        for (size_t i = 0; i < sizeof(binary_ops) / sizeof(binary_ops[0]); i++) {
+            size_t len = strlen(binary_ops[i].text);
+            if (strncmp(p, binary_ops[i].text, len) == 0) {
+                op = &binary_ops[i];
+                break;
+            }
+        }
+        if (!op) return fail(ap, "syntax error in expression", left);
+        if (op->bp < min_bp) return left;
+        ap->p += strlen(op->text);
+
+        // ** groups to the right; everything else to the left
+        ArithNode* right = parse_expr(ap, op->op == AOP_POW ? op->bp : op->bp + 1);
+        if (!right) return fail(ap, NULL, left);
+        ArithNode* node = new_node(ARITH_BINARY);
+        node->op = op->op;
+        node->a = left;
+        node->b = right;
+        left = node;
+    }
+}
+
+static ArithNode* parse_expr(ArithParser* ap, int min_bp) {
+    if (ap->depth == MAX_ARITH_DEPTH) return fail(ap, "expression recursion level exceeded", NULL);
+    ap->depth++;
+    ArithNode* node = parse_operators(ap, min_bp);
+    ap->depth--;
+    return node;
+}
+
+static int is_const(const ArithNode* node) {
+    return node && node->kind == ARITH_NUM;
+}
+
+// Replace node with a constant, freeing its children
+static ArithNode* make_const(ArithNode* node, int64_t value) {
+    arith_free(node->a);
+    arith_free(node->b);
+    arith_free(node->c);
+    free(node->name);
+    memset(node, 0, sizeof(ArithNode));
+    node->value = value;
+    return node;
+}
+
+// Evaluate every subexpression that involves no variables. Division by a
+// literal zero is left alone so it fails at run time, like any other.
+static ArithNode* fold(ArithNode* node) {
+    if (!node) return NULL;
+    node->a = fold(node->a);
+    node->b = fold(node->b);
+    node->c = fold(node->c);
+
+    int64_t value;
+    switch (node->kind) {
+    case ARITH_UNARY:
+        if (!is_const(node->a)) break;
+        value = node->a->value;
+        if (node->op == AOP_NEG) value = (int64_t)(0 - (uint64_t)value);
+        else if (node->op == AOP_BNOT) value = ~value;
+        else if (node->op == AOP_LNOT) value = !value;
+        return make_const(node, value);
+    case ARITH_BINARY:
+        if (is_const(node->a) && is_const(node->b) &&
+            arith_apply(node->op, node->a->value, node->b->value, &value)) {
+            return make_const(node, value);
+        }
+        break;
+    case ARITH_AND:
+    case ARITH_OR:
+        if (is_const(node->a) && is_const(node->b)) {
+            if (node->kind == ARITH_AND) value = node->a->value && node->b->value;
+            else value = node->a->value || node->b->value;
+            return make_const(node, value);
+        }
+        break;
+    case ARITH_COND:
+        if (is_const(node->a)) {
+            // Keep only the branch that will run
+            ArithNode* chosen = node->a->value ? node->b : node->c;
+            if (node->a->value) node->b = NULL;
+            else node->c = NULL;
+            arith_free(node->a);
+            arith_free(node->b);
+            arith_free(node->c);
+            free(node);
+            return chosen;
+        }
+        break;
+    case ARITH_COMMA:
+        if (is_const(node->a)) {
+            ArithNode* right = node->b;
+            node->b = NULL;
+            arith_free(node);
+            return right;
+        }
+        break;
+    default:
+        break;
+    }
+    return node;
+}
+
+ArithNode* arith_parse(const char* text, const char** error) {
+    ArithParser ap;
+    ap.p = text;
+    ap.error = NULL;
+    ap.depth = 0;
+
+    skip_space(&ap);
+    if (!*ap.p) {
+        // An empty expression is 0
+        ArithNode* node = new_node(ARITH_NUM);
+        return node;
+    }
+
+    ArithNode* node = parse_expr(&ap, BP_COMMA);
+    if (node) {
+        skip_space(&ap);
+        if (*ap.p) node = fail(&ap, "syntax error in expression", node);
+    }
+    if (!node) {
+        *error = ap.error ? ap.error : "syntax error in expression";
+        return NULL;
+    }
+    return fold(node);
+}
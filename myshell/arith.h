@@ -0,0 +1,51 @@
+#ifndef ARITH_H
+#define ARITH_H
+
+#include <stdint.h>
+
+// $(( )) expressions are parsed once into a small tree, folded, and then
+// compiled to VM instructions that read variable slots directly.
+
+typedef enum {
+    ARITH_NUM,          // value
+    ARITH_VAR,          // name
+    ARITH_UNARY,        // op a
+    ARITH_BINARY,       // a op b
+    ARITH_AND,          // a && b
+    ARITH_OR,           // a || b
+    ARITH_COND,         // a ? b : c
+    ARITH_COMMA,        // a , b
+    ARITH_ASSIGN,       // name = a, or name op= a when op is set
+    ARITH_INCDEC        // ++name, --name, name++, name--
+} ArithKind;
+
+typedef enum {
+    AOP_NONE,
+    AOP_ADD, AOP_SUB, AOP_MUL, AOP_DIV, AOP_MOD, AOP_POW,
+    AOP_SHL, AOP_SHR,
+    AOP_LT, AOP_LE, AOP_GT, AOP_GE, AOP_EQ, AOP_NE,
+    AOP_BAND, AOP_BXOR, AOP_BOR,
+    AOP_NEG, AOP_PLUS, AOP_BNOT, AOP_LNOT
+} ArithOp;
+
+typedef struct ArithNode {
+    ArithKind kind;
+    ArithOp op;
+    int64_t value;
+    char* name;
+    int prefix;                 // ARITH_INCDEC: ++x rather than x++
+    struct ArithNode* a;
+    struct ArithNode* b;
+    struct ArithNode* c;
+} ArithNode;
+
+// Parse and constant-fold an expression. Returns NULL with *error set to a
+// static message when the text is not a valid expression.
+ArithNode* arith_parse(const char* text, const char** error);
+void arith_free(ArithNode* node);
+
+// Apply a binary operator with the shell's wrap-around semantics. Returns 0
+// for division by zero or a negative exponent.
+int arith_apply(ArithOp op, int64_t a, int64_t b, int64_t* result);
+
+#endif
@@ -0,0 +1,116 @@
+#include "ast.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+Node* node_new(NodeType type, int line) {
+    Node* node = xcalloc(1, sizeof(Node));
+    node->type = type;
+    node->line = line;
+    return node;
+}
+
+void word_free(Word* word) {
+    while (word) {
+        Word* next_word = word->next;
+        WordPart* part = word->parts;
+        while (part) {
+            WordPart* next_part = part->next;
+            free(part->text);
+            free(part);
+            part = next_part;
+        }
+        free(word);
+        word = next_word;
+    }
+}
+
+static void redir_free(Redir* redir) {
+    while (redir) {
+        Redir* next = redir->next;
+        word_free(redir->target);
+        free(redir);
+        redir = next;
+    }
+}
+
+// Frees a node together with the rest of its list
+void node_free(Node* node) {
+    while (node) {
+        Node* next = node->next;
+        redir_free(node->redirs);
+
+        switch (node->type) {
+        case NODE_SIMPLE: {
+            Assign* assign = node->u.simple.assigns;
+            while (assign) {
+                Assign* next_assign = assign->next;
+                free(assign->name);
+                word_free(assign->value);
+                free(assign);
+                assign = next_assign;
+            }
+            word_free(node->u.simple.words);
+            break;
+        }
+        case NODE_PIPELINE:
+            node_free(node->u.pipeline.stages);
+            break;
+        case NODE_AND:
+        case NODE_OR:
+            node_free(node->u.binary.left);
+            node_free(node->u.binary.right);
+            break;
+        case NODE_IF:
+            node_free(node->u.if_stmt.cond);
+            node_free(node->u.if_stmt.then_body);
+            node_free(node->u.if_stmt.else_body);
+            break;
+        case NODE_FOR:
+            free(node->u.for_loop.var);
+            word_free(node->u.for_loop.words);
+            node_free(node->u.for_loop.body);
+            break;
+        case NODE_WHILE:
+            node_free(node->u.while_loop.cond);
+            node_free(node->u.while_loop.body);
+            break;
+        case NODE_GROUP:
+            node_free(node->u.group.body);
+            break;
+        case NODE_FUNCTION:
+            free(node->u.function.name);
+            node_free(node->u.function.body);
+            break;
+        case NODE_BACKGROUND:
+            node_free(node->u.background.body);
+            break;
+        case NODE_CASE: {
+            word_free(node->u.case_stmt.subject);
+            CaseArm* arm = node->u.case_stmt.arms;
+            while (arm) {
+                CaseArm* next_arm = arm->next;
+                word_free(arm->patterns);
+                node_free(arm->body);
+                free(arm);
+                arm = next_arm;
+            }
+            break;
+        }
+        }
+
+        free(node);
+        node = next;
+    }
+}
+
+const char* word_literal(const Word* word) {
+    if (!word || !word->parts || word->parts->next) return NULL;
+    if (word->parts->type != PART_LITERAL || word->parts->quoted) return NULL;
+    return word->parts->text;
+}
+
+int word_is(const Word* word, const char* text) {
+    const char* literal = word_literal(word);
+    return literal && strcmp(literal, text) == 0;
+}
@@ -0,0 +1,99 @@
+#ifndef AST_H
+#define AST_H
+
+// Syntax tree produced by the parser and consumed by the compiler.
+// Each command is parsed once, compiled to bytecode and freed; the VM
+// runs the bytecode, so loop bodies never re-read the source or the tree.
+
+typedef enum {
+    PART_LITERAL,   // plain text
+    PART_VAR,       // $name, ${name}, $?, $#, ...
+    PART_ARITH,     // $(( expression ))
+    PART_COMMAND    // $( command ) or `command`
+} PartType;
+
+typedef struct WordPart {
+    PartType type;
+    int quoted;                 // came from inside '...' or "..."
+    char* text;                 // literal text, variable name, expression or command source
+    struct WordPart* next;
+} WordPart;
+
+typedef struct Word {
+    WordPart* parts;
+    struct Word* next;
+} Word;
+
+typedef enum {
+    REDIR_IN,       // <
+    REDIR_OUT,      // >
+    REDIR_APPEND,   // >>
+    REDIR_DUP_IN,   // <&
+    REDIR_DUP_OUT,  // >&
+    REDIR_HERESTRING, // <<<
+    REDIR_HEREDOC   // << and <<-; the target is the body
+} RedirType;
+
+typedef struct Redir {
+    RedirType type;
+    int fd;
+    Word* target;
+    struct Redir* next;
+} Redir;
+
+typedef struct Assign {
+    char* name;
+    Word* value;
+    struct Assign* next;
+} Assign;
+
+struct Node;
+
+typedef struct CaseArm {
+    Word* patterns;             // alternatives separated by '|'
+    struct Node* body;
+    struct CaseArm* next;
+} CaseArm;
+
+typedef enum {
+    NODE_SIMPLE,
+    NODE_PIPELINE,
+    NODE_AND,
+    NODE_OR,
+    NODE_IF,
+    NODE_FOR,
+    NODE_WHILE,
+    NODE_CASE,
+    NODE_GROUP,         // { list; }
+    NODE_FUNCTION,      // name() compound-command
+    NODE_BACKGROUND     // command &
+} NodeType;
+
+typedef struct Node {
+    NodeType type;
+    int line;
+    Redir* redirs;              // redirections applied to the whole command
+    struct Node* next;          // next command of a list or next pipeline stage
+    union {
+        struct { Assign* assigns; Word* words; } simple;
+        struct { struct Node* stages; int negate; } pipeline;
+        struct { struct Node* left; struct Node* right; } binary;
+        struct { struct Node* cond; struct Node* then_body; struct Node* else_body; } if_stmt;
+        struct { char* var; Word* words; struct Node* body; } for_loop;
+        struct { struct Node* cond; struct Node* body; int until; } while_loop;
+        struct { Word* subject; CaseArm* arms; } case_stmt;
+        struct { struct Node* body; } group;
+        struct { char* name; struct Node* body; } function;
+        struct { struct Node* body; } background;
+    } u;
+} Node;
+
+Node* node_new(NodeType type, int line);
+void node_free(Node* node);
+void word_free(Word* word);
+
+// Returns the text of a word made of a single unquoted literal, or NULL
+const char* word_literal(const Word* word);
+int word_is(const Word* word, const char* text);
+
+#endif
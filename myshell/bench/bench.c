@@ -0,0 +1,170 @@
+// Microbenchmarks for the interpreter's hot paths.
+// Build and run with `make bench`; results are printed as JSON on stdout.
+// An optional argument runs only the benchmarks whose name contains it.
+#define _POSIX_C_SOURCE 200809L
+#include "parser.h"
+#include "compile.h"
+#include "vm.h"
+#include "env.h"
+#include "executor.h"
+#include "util.h"
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define MAX_CHUNKS 16
+
+typedef struct {
+    const char* name;
+    const char* script;
+    long iterations;
+} ScriptBench;
+
+static const ScriptBench script_benches[] = {
+    { "var_expand", "x=\"$a-$b-$c\"", 200000 },
+    { "var_split", "set -- $words", 100000 },
+    { "arith", "x=$(( (i * 3 + 7) % 11 ))", 200000 },
+    { "arith_counter", "i=$((i + 1))", 500000 },
+    { "condition_int", "[ $i -lt 100 ]", 200000 },
+    { "condition_string", "[ \"$a\" = alpha ]", 200000 },
+    { "builtin_echo", "echo hello world", 100000 },
+    { "builtin_dynamic", "$cmd hello world", 100000 },
+    { "spawn_external", "sleep 0", 300 },
+    { "pipeline", "echo a | cat", 300 },
+    { "redirect", "echo a > /dev/null", 20000 },
+    { "loop_script", "n=0\nwhile [ $n -lt 500 ]; do n=$((n + 1)); done", 200 },
+    { "for_script", "for w in a b c d e f g h i j; do x=$w; done", 20000 },
+    { "case_script", NULL, 100000 },
+    { "function_call", "add() { local x=$1; n=$((n + x)); }\nadd 1", 200000 },
+    { "subst_builtin", "x=$(echo $a-$b)", 200000 },
+    { "subst_function", "get() { echo \"$1\"; }\nx=$(get $c)", 200000 },
+    { "subst_external", "x=$(echo hi | cat)", 300 },
+    { "subst_spawn", "x=$(sleep 0)", 300 },
+};
+
+typedef struct {
+    const char* name;
+    long iterations;
+    double ns_per_op;
+    double allocs_per_op;
+} Result;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// Parse and compile a script held in memory; returns the number of chunks
+static int compile_script(const char* text, Chunk** chunks) {
+    Source src;
+    source_string(&src, text, strlen(text));
+
+    Parser parser;
+    parser_init(&parser, &src);
+    int count = 0;
+    Node* node;
+    while (count < MAX_CHUNKS && (node = parser_next(&parser)) != NULL) {
+        chunks[count++] = compile_command(node);
+        node_free(node);
+    }
+    parser_free(&parser);
+    return count;
+}
+
+// A case statement with 50 literal arms, matched against the last one
+static char* case_script(void) {
+    StrBuf sb;
+    sb_init(&sb);
+    sb_append(&sb, "case $field in\n");
+    for (int i = 0; i < 50; i++) {
+        char arm[64];
+        sprintf(arm, "    value%d) x=%d ;;\n", i, i);
+        sb_append(&sb, arm);
+    }
+    sb_append(&sb, "    *) x=none ;;\nesac");
+    return sb_release(&sb);
+}
+
+static Result run_script(const ScriptBench* bench) {
+    char* owned = bench->script ? NULL : case_script();
+    Chunk* chunks[MAX_CHUNKS];
+    int count = compile_script(owned ? owned : bench->script, chunks);
+
+    size_t allocs = alloc_count();
+    double start = now_ns();
+    for (long i = 0; i < bench->iterations; i++) {
+        for (int j = 0; j < count; j++) vm_run(chunks[j]);
+    }
+    double elapsed = now_ns() - start;
+    allocs = alloc_count() - allocs;
+
+    for (int j = 0; j < count; j++) chunk_free(chunks[j]);
+    free(owned);
+
+    Result result = { bench->name, bench->iterations, elapsed / bench->iterations,
+        (double)allocs / bench->iterations };
+    return result;
+}
+
+static Result run_builtin_lookup(void) {
+    static const char* const names[] = { "echo", "cd", "export", "[", "grep", "sed" };
+    const long iterations = 1000000;
+    volatile int sink = 0;
+
+    double start = now_ns();
+    for (long i = 0; i < iterations; i++) sink += builtin_lookup(names[i % 6]);
+    double elapsed = now_ns() - start;
+
+    Result result = { "builtin_lookup", iterations, elapsed / iterations, 0 };
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    const char* filter = argc > 1 ? argv[1] : NULL;
+
+    import_environment();
+    init_special_vars();
+    set_var("a", "alpha");
+    set_var("b", "beta");
+    set_var("c", "gamma");
+    set_var("i", "42");
+    set_var("cmd", "echo");
+    set_var("words", "one two three four five");
+    set_var("field", "value49");
+
+    // Commands under test write to /dev/null; the report goes to the real stdout
+    fflush(stdout);
+    int report_fd = dup(1);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, 1);
+    close(null_fd);
+
+    size_t nbenches = sizeof(script_benches) / sizeof(script_benches[0]);
+    Result* results = xmalloc((nbenches + 1) * sizeof(Result));
+    int nresults = 0;
+
+    if (!filter || strstr("builtin_lookup", filter)) results[nresults++] = run_builtin_lookup();
+    for (size_t i = 0; i < nbenches; i++) {
+        if (filter && !strstr(script_benches[i].name, filter)) continue;
+        results[nresults++] = run_script(&script_benches[i]);
+    }
+
+    out_flush();
+    dup2(report_fd, 1);
+    close(report_fd);
+
+    printf("{\n  \"benchmarks\": [\n");
+    for (int i = 0; i < nresults; i++) {
+        printf("    {\"name\": \"%s\", \"iterations\": %ld, \"ns_per_op\": %.1f, \"allocs_per_op\": %.2f}%s\n",
+            results[i].name, results[i].iterations, results[i].ns_per_op,
+            results[i].allocs_per_op, i + 1 < nresults ? "," : "");
+    }
+    printf("  ]\n}\n");
+    free(results);
+    return 0;
+}
@@ -0,0 +1,483 @@
+#define _POSIX_C_SOURCE 200809L
+#include "builtins.h"
+#include "util.h"
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#define R_OK 4
+#define W_OK 2
+#define X_OK 0
+#define access _access
+#else
+#include <unistd.h>
+#endif
+
+// test / [ evaluates its arguments as an expression:
+//   or  := and ( -o and )*
+//   and := not ( -a not )*
+//   not := ! not | primary
+//   primary := ( or ) | unary-op arg | arg binary-op arg | arg
+// A binary operator in second position wins, so "[ ! = x ]" compares strings.
+typedef struct {
+    char** argv;
+    int pos;
+    int end;
+    int error;
+} TestParser;
+
+static int test_error(TestParser* t, const char* message, const char* arg) {
+    if (!t->error) {
+        if (arg) fprintf(stderr, "myshell: test: %s: %s\n", arg, message);
+        else fprintf(stderr, "myshell: test: %s\n", message);
+    }
+    t->error = 1;
+    return 0;
+}
+
+static int is_unary_op(const char* op) {
+    return op[0] == '-' && op[1] && !op[2] && strchr("znefdrwxsLht", op[1]);
+}
+
+static int is_binary_op(const char* op) {
+    static const char* const ops[] = {
+        "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge"
+    };
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (strcmp(op, ops[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+// Integers may have surrounding blanks, as in other shells
+static long long test_integer(TestParser* t, const char* text) {
+    char* end;
+    errno = 0;
+    long long value = strtoll(text, &end, 10);
+    while (isspace((unsigned char)*end)) end++;
+    if (end == text || *end || errno == ERANGE) test_error(t, "integer expression expected", text);
+    return value;
+}
+
+static int test_unary(const char* op, const char* arg) {
+    struct stat st;
+    switch (op[1]) {
+    case 'z': return *arg == '\0';
+    case 'n': return *arg != '\0';
+    case 'e': return stat(arg, &st) == 0;
+    case 'f': return stat(arg, &st) == 0 && S_ISREG(st.st_mode);
+    case 'd': return stat(arg, &st) == 0 && S_ISDIR(st.st_mode);
+    case 's': return stat(arg, &st) == 0 && st.st_size > 0;
+    case 'r': return access(arg, R_OK) == 0;
+    case 'w': return access(arg, W_OK) == 0;
+    case 'x': return access(arg, X_OK) == 0;
+#ifdef _WIN32
+    case 't': return 0;
+    default: return 0;
+#else
+    case 't': return isatty(atoi(arg));
+    default: return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+#endif
+    }
+}
+
+static int test_binary(TestParser* t, const char* a, const char* op, const char* b) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) return strcmp(a, b) == 0;
+    if (strcmp(op, "!=") == 0) return strcmp(a, b) != 0;
+    if (strcmp(op, "<") == 0) return strcmp(a, b) < 0;
+    if (strcmp(op, ">") == 0) return strcmp(a, b) > 0;
+
+    long long x = test_integer(t, a);
+    long long y = test_integer(t, b);
+    if (strcmp(op, "-eq") == 0) return x == y;
+    if (strcmp(op, "-ne") == 0) return x != y;
+    if (strcmp(op, "-lt") == 0) return x < y;
+    if (strcmp(op, "-le") == 0) return x <= y;
+    if (strcmp(op, "-gt") == 0) return x > y;
+    return x >= y;
+}
+
+static int test_or(TestParser* t);
+
+static int test_primary(TestParser* t) {
+    int left = t->end - t->pos;
+    if (left <= 0) return test_error(t, "argument expected", NULL);
+    char** argv = t->argv + t->pos;
+
+    if (left >= 3 && is_binary_op(argv[1])) {
+        t->pos += 3;
+        return test_binary(t, argv[0], argv[1], argv[2]);
+    }
+    if (left >= 2 && strcmp(argv[0], "(") == 0) {
+        t->pos++;
+        int result = test_or(t);
+        if (t->pos >= t->end || strcmp(t->argv[t->pos], ")") != 0) {
+            return test_error(t, "`)' expected", NULL);
+        }
+        t->pos++;
+        return result;
+    }
+    if (left >= 2 && is_unary_op(argv[0])) {
+        t->pos += 2;
+        return test_unary(argv[0], argv[1]);
+    }
+    t->pos++;
+    return argv[0][0] != '\0';
+}
+
+static int test_not(TestParser* t) {
+    int left = t->end - t->pos;
+    if (left >= 2 && strcmp(t->argv[t->pos], "!") == 0 &&
+        !(left >= 3 && is_binary_op(t->argv[t->pos + 1]))) {
+        t->pos++;
+        return !test_not(t);
+    }
+    return test_primary(t);
+}
+
+static int test_and(TestParser* t) {
+    int result = test_not(t);
+    while (t->pos < t->end && strcmp(t->argv[t->pos], "-a") == 0) {
+        t->pos++;
+        int rhs = test_not(t);
+        result = result && rhs;
+    }
+    return result;
+}
+
+static int test_or(TestParser* t) {
+    int result = test_and(t);
+    while (t->pos < t->end && strcmp(t->argv[t->pos], "-o") == 0) {
+        t->pos++;
+        int rhs = test_and(t);
+        result = result || rhs;
+    }
+    return result;
+}
+
+// Status 0 for true, 1 for false and 2 for a malformed expression
+int test_command(int argc, char** argv) {
+    if (strcmp(argv[0], "[") == 0) {
+        if (strcmp(argv[argc - 1], "]") != 0) {
+            fprintf(stderr, "myshell: [: missing `]'\n");
+            return 2;
+        }
+        argc--;
+    }
+    if (argc == 1) return 1;
+
+    TestParser t = { argv, 1, argc, 0 };
+    int result = test_or(&t);
+    if (!t.error && t.pos < t.end) test_error(&t, "too many arguments", NULL);
+    if (t.error) return 2;
+    return result ? 0 : 1;
+}
+
+int true_command(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    return 0;
+}
+
+int false_command(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    return 1;
+}
+
+// Expand the backslash escape at s[0] == '\\' into out and return the
+// number of characters used. Octal escapes are \NNN in a format and \0NNN
+// in a %b argument; \c in a %b argument sets *stop to end all output.
+static size_t printf_escape(const char* s, int in_arg, StrBuf* out, int* stop) {
+    static const char escapes[] = "\\\\a\ab\bf\fn\nr\rt\tv\v\"\"''";
+    char c = s[1];
+    if (c == '\0') {
+        sb_appendc(out, '\\');
+        return 1;
+    }
+    for (const char* e = escapes; *e; e += 2) {
+        if (*e == c) {
+            sb_appendc(out, e[1]);
+            return 2;
+        }
+    }
+    if (c == 'c' && in_arg) {
+        *stop = 1;
+        return 2;
+    }
+
+    size_t i = 1;
+    int value = 0;
+    if (c == 'x' && isxdigit((unsigned char)s[2])) {
+        for (i = 2; i < 4 && isxdigit((unsigned char)s[i]); i++) {
+            int d = s[i];
+            value = value * 16 + (isdigit(d) ? d - '0' : tolower(d) - 'a' + 10);
+        }
+    }
+    else if (c >= '0' && c <= '7') {
+        size_t first = in_arg && c == '0' ? 2 : 1;
+        for (i = first; i < first + 3 && s[i] >= '0' && s[i] <= '7'; i++) {
+            value = value * 8 + (s[i] - '0');
+        }
+    }
+    else {
+        sb_appendc(out, '\\');
+        sb_appendc(out, c);
+        return 2;
+    }
+    sb_appendc(out, (char)value);
+    return i;
+}
+
+// Numeric arguments may be decimal, octal, hex, or 'c for a character code
+static long long printf_number(const char* arg, int* status) {
+    if (arg[0] == '\'' || arg[0] == '"') return (unsigned char)arg[1];
+    char* end;
+    errno = 0;
+    long long value = strtoll(arg, &end, 0);
+    if (end == arg || *end || errno == ERANGE) {
+        fprintf(stderr, "myshell: printf: %s: invalid number\n", arg);
+        *status = 1;
+    }
+    return value;
+}
+
+static double printf_float(const char* arg, int* status) {
+    if (arg[0] == '\'' || arg[0] == '"') return (unsigned char)arg[1];
+    char* end;
+    double value = strtod(arg, &end);
+    if (end == arg || *end) {
+        fprintf(stderr, "myshell: printf: %s: invalid number\n", arg);
+        *status = 1;
+    }
+    return value;
+}
+
+// printf FORMAT [ARG]... reuses the format until the arguments run out
+int printf_command(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "myshell: printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+
+    const char* format = argv[1];
+    int next = 2;
+    int status = 0;
+    int stop = 0;
+    StrBuf out;
+    StrBuf text;
+    sb_init(&out);
+    sb_init(&text);
+
+    do {
+        int start = next;
+        for (const char* f = format; *f && !stop;) {
+            if (*f == '\\') {
+                f += printf_escape(f, 0, &out, &stop);
+                continue;
+            }
+            if (*f != '%') {
+                sb_appendc(&out, *f++);
+                continue;
+            }
+            if (f[1] == '%') {
+                sb_appendc(&out, '%');
+                f += 2;
+                continue;
+            }
+
+            // Rebuild the conversion for snprintf, with '*' replaced by numbers
+            char spec[64];
+            size_t n = 0;
+            spec[n++] = *f++;
+            while (*f && strchr("-+ #0", *f) && n < 8) spec[n++] = *f++;
+            for (int part = 0; part < 2; part++) {
+                if (part == 1) {
+                    if (*f != '.') break;
+                    spec[n++] = *f++;
+                }
+                if (*f == '*') {
+                    long long value = next < argc ? printf_number(argv[next++], &status) : 0;
+                    n += snprintf(spec + n, 24, "%d", (int)value);
+                    f++;
+                }
+                else {
+                    while (isdigit((unsigned char)*f) && n < 40) spec[n++] = *f++;
+                }
+            }
+
+            char conv = *f;
+            if (conv == '\0' || !strchr("sbcdiouxXfFeEgGaA", conv)) {
+                fprintf(stderr, "myshell: printf: `%c': invalid format character\n", conv ? conv : '%');
+                status = 1;
+                stop = 1;
+                break;
+            }
+            f++;
+            const char* arg = next < argc ? argv[next++] : NULL;
+
+            char buffer[512];
+            if (conv == 's' || conv == 'b' || conv == 'c') {
+                sb_clear(&text);
+                if (conv == 'c') {
+                    if (arg && *arg) sb_appendc(&text, *arg);
+                }
+                else if (conv == 's') {
+                    sb_append(&text, arg ? arg : "");
+                }
+                else if (arg) {
+                    for (const char* a = arg; *a && !stop;) {
+                        if (*a == '\\') a += printf_escape(a, 1, &text, &stop);
+                        else sb_appendc(&text, *a++);
+                    }
+                }
+                spec[n++] = 's';
+                spec[n] = '\0';
+                int len = snprintf(NULL, 0, spec, text.data);
+                char* formatted = xmalloc((size_t)len + 1);
+                snprintf(formatted, (size_t)len + 1, spec, text.data);
+                sb_append_len(&out, formatted, (size_t)len);
+                free(formatted);
+                continue;
+            }
+
+            if (strchr("fFeEgGaA", conv)) {
+                double value = arg ? printf_float(arg, &status) : 0;
+                spec[n++] = conv;
+                spec[n] = '\0';
+                // A large precision or value can outgrow the buffer
+                int len = snprintf(NULL, 0, spec, value);
+                char* formatted = xmalloc((size_t)len + 1);
+                snprintf(formatted, (size_t)len + 1, spec, value);
+                sb_append_len(&out, formatted, (size_t)len);
+                free(formatted);
+                continue;
+            }
+
+            long long number = arg ? printf_number(arg, &status) : 0;
+            spec[n++] = 'l';
+            spec[n++] = 'l';
+            spec[n++] = conv;
+            spec[n] = '\0';
+            if (conv == 'd' || conv == 'i') snprintf(buffer, sizeof(buffer), spec, number);
+            else snprintf(buffer, sizeof(buffer), spec, (unsigned long long)number);
+            sb_append(&out, buffer);
+        }
+        // Without conversions the format is printed once
+        if (next == start) break;
+    } while (next < argc && !stop);
+
+    out_write(out.data, out.len);
+    sb_free(&out);
+    sb_free(&text);
+    return status;
+}
+
+// basename NAME [SUFFIX]
+int basename_command(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "myshell: basename: missing operand\n");
+        return 1;
+    }
+    const char* path = argv[1];
+    size_t end = strlen(path);
+    while (end > 1 && path[end - 1] == '/') end--;
+    size_t start = end;
+    while (start > 0 && path[start - 1] != '/') start--;
+    // A path of only slashes is "/"
+    if (start == end && end > 0) start = end - 1;
+
+    size_t len = end - start;
+    if (argc > 2) {
+        size_t suffix = strlen(argv[2]);
+        if (suffix < len && strncmp(path + end - suffix, argv[2], suffix) == 0) len -= suffix;
+    }
+    out_write(path + start, len);
+    out_char('\n');
+    return 0;
+}
+
+// dirname NAME...
+int dirname_command(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "myshell: dirname: missing operand\n");
+        return 1;
+    }
+    for (int i = 1; i < argc; i++) {
+        const char* path = argv[i];
+        size_t end = strlen(path);
+        while (end > 1 && path[end - 1] == '/') end--;
+        while (end > 0 && path[end - 1] != '/') end--;
+        while (end > 1 && path[end - 1] == '/') end--;
+        if (end == 0) out_char('.');
+        else out_write(path, end);
+        out_char('\n');
+    }
+    return 0;
+}
+
+// Numbers are printed with as many decimals as the most precise argument
+static int seq_number(const char* text, double* value, int* decimals) {
+    char* end;
+    *value = strtod(text, &end);
+    if (end == text || *end) {
+        fprintf(stderr, "myshell: seq: invalid floating point argument: '%s'\n", text);
+        return 0;
+    }
+    const char* dot = strchr(text, '.');
+    if (dot && !strpbrk(text, "eE")) {
+        int n = (int)strlen(dot + 1);
+        if (n > *decimals) *decimals = n;
+    }
+    return 1;
+}
+
+// seq [-s SEPARATOR] [FIRST [INCREMENT]] LAST
+int seq_command(int argc, char** argv) {
+    const char* separator = "\n";
+    int i = 1;
+    while (i < argc && argv[i][0] == '-' && argv[i][1] == 's') {
+        if (argv[i][2]) separator = argv[i++] + 2;
+        else if (i + 1 < argc) {
+            separator = argv[i + 1];
+            i += 2;
+        }
+        else break;
+    }
+    int nargs = argc - i;
+    if (nargs < 1 || nargs > 3) {
+        fprintf(stderr, "myshell: seq: usage: seq [-s separator] [first [increment]] last\n");
+        return 1;
+    }
+
+    double values[3] = { 1, 1, 0 };
+    int decimals = 0;
+    double* targets[3][3] = {
+        { &values[2] },
+        { &values[0], &values[2] },
+        { &values[0], &values[1], &values[2] },
+    };
+    for (int k = 0; k < nargs; k++) {
+        if (!seq_number(argv[i + k], targets[nargs - 1][k], &decimals)) return 1;
+    }
+    double first = values[0], step = values[1], last = values[2];
+    if (step == 0) {
+        fprintf(stderr, "myshell: seq: invalid Zero increment value: '0'\n");
+        return 1;
+    }
+
+    char buffer[64];
+    long n = 0;
+    for (double x = first; step > 0 ? x <= last : x >= last; x = first + step * ++n) {
+        if (n > 0) out_str(separator);
+        int len = snprintf(buffer, sizeof(buffer), "%.*f", decimals, x);
+        out_write(buffer, (size_t)len);
+    }
+    if (n > 0) out_char('\n');
+    return 0;
+}
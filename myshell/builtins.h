@@ -0,0 +1,15 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+// Small utilities that scripts call inside loops, run in the shell process
+// instead of spawning a program for every call.
+
+int test_command(int argc, char** argv);        // test and [
+int printf_command(int argc, char** argv);
+int true_command(int argc, char** argv);
+int false_command(int argc, char** argv);
+int basename_command(int argc, char** argv);
+int dirname_command(int argc, char** argv);
+int seq_command(int argc, char** argv);
+
+#endif
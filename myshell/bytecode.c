@@ -0,0 +1,87 @@
+#include "bytecode.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+Chunk* chunk_new(void) {
+    Chunk* chunk = xcalloc(1, sizeof(Chunk));
+    chunk->refs = 1;
+    chunk->pure = 1;
+    return chunk;
+}
+
+void chunk_retain(Chunk* chunk) {
+    chunk->refs++;
+}
+
+void chunk_free(Chunk* chunk) {
+    if (!chunk || --chunk->refs > 0) return;
+    for (int i = 0; i < chunk->nconsts; i++) free(chunk->consts[i]);
+    for (int i = 0; i < chunk->ncmds; i++) {
+        free(chunk->cmds[i].assign_slots);
+        free(chunk->cmds[i].redirs);
+    }
+    free(chunk->consts);
+    for (int i = 0; i < chunk->nmatchers; i++) matcher_free(chunk->matchers[i]);
+    free(chunk->cmds);
+    free(chunk->matchers);
+    for (int i = 0; i < chunk->nbodies; i++) chunk_free(chunk->bodies[i]);
+    free(chunk->bodies);
+    free(chunk->code);
+    free(chunk);
+}
+
+// Append one code word; returns its address
+int chunk_emit(Chunk* chunk, int word) {
+    if (chunk->len == chunk->cap) {
+        chunk->cap = chunk->cap ? chunk->cap * 2 : 64;
+        chunk->code = xrealloc(chunk->code, chunk->cap * sizeof(int));
+    }
+    chunk->code[chunk->len] = word;
+    return chunk->len++;
+}
+
+// Intern a string constant; identical strings share one slot
+int chunk_const(Chunk* chunk, const char* text) {
+    for (int i = 0; i < chunk->nconsts; i++) {
+        if (strcmp(chunk->consts[i], text) == 0) return i;
+    }
+    if (chunk->nconsts == chunk->consts_cap) {
+        chunk->consts_cap = chunk->consts_cap ? chunk->consts_cap * 2 : 16;
+        chunk->consts = xrealloc(chunk->consts, chunk->consts_cap * sizeof(char*));
+    }
+    chunk->consts[chunk->nconsts] = xstrdup(text);
+    return chunk->nconsts++;
+}
+
+// Reserve a zeroed command descriptor; returns its index
+int chunk_cmd(Chunk* chunk) {
+    if (chunk->ncmds == chunk->cmds_cap) {
+        chunk->cmds_cap = chunk->cmds_cap ? chunk->cmds_cap * 2 : 8;
+        chunk->cmds = xrealloc(chunk->cmds, chunk->cmds_cap * sizeof(CmdInfo));
+    }
+    memset(&chunk->cmds[chunk->ncmds], 0, sizeof(CmdInfo));
+    chunk->cmds[chunk->ncmds].builtin = -1;
+    chunk->cmds[chunk->ncmds].function = -1;
+    return chunk->ncmds++;
+}
+
+// Take ownership of a compiled case matcher; returns its index
+int chunk_matcher(Chunk* chunk, CaseMatcher* matcher) {
+    if (chunk->nmatchers == chunk->matchers_cap) {
+        chunk->matchers_cap = chunk->matchers_cap ? chunk->matchers_cap * 2 : 4;
+        chunk->matchers = xrealloc(chunk->matchers, chunk->matchers_cap * sizeof(CaseMatcher*));
+    }
+    chunk->matchers[chunk->nmatchers] = matcher;
+    return chunk->nmatchers++;
+}
+
+// Take ownership of a compiled function or substitution body; returns its index
+int chunk_body(Chunk* chunk, Chunk* body) {
+    if (chunk->nbodies == chunk->bodies_cap) {
+        chunk->bodies_cap = chunk->bodies_cap ? chunk->bodies_cap * 2 : 4;
+        chunk->bodies = xrealloc(chunk->bodies, chunk->bodies_cap * sizeof(Chunk*));
+    }
+    chunk->bodies[chunk->nbodies] = body;
+    return chunk->nbodies++;
+}
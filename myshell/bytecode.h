@@ -0,0 +1,161 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "ast.h"
+#include "pattern.h"
+
+// Instruction set of the script VM. Each instruction is one int opcode
+// followed by its operands. Operand legend:
+//   k  index into the chunk's string constants
+//   s  variable slot handle (see var_slot)
+//   c  index into the chunk's command descriptors
+//   m  index into the chunk's case matchers
+//   f  function handle (see function_slot)
+//   b  index into the chunk's bodies (functions and command substitutions)
+//   a  absolute code address
+//   v  immediate integer
+#define OPCODES(X) \
+    X(OP_HALT)          /*       stop executing */ \
+    X(OP_LIT)           /* k     append constant to the current word, quoted */ \
+    X(OP_LIT_GLOB)      /* k     append constant, unquoted (may glob) */ \
+    X(OP_VAR)           /* s     append a variable, quoted */ \
+    X(OP_VAR_SPLIT)     /* s     append a variable, split into fields on IFS */ \
+    X(OP_VAR_PATTERN)   /* s     append a variable unsplit, its glob characters active */ \
+    X(OP_VAR_ARGS)      /*       append "$@": one field per positional parameter */ \
+    X(OP_ARITH_STR)     /*       pop an integer and append its decimal text */ \
+    X(OP_SUBST)         /* b v   append the output of $( ); v is 0 quoted, 1 split
+                                 into fields, 2 unsplit with glob characters active */ \
+    X(OP_FIELDS_END)    /*       finish the word as zero or more fields */ \
+    X(OP_STRING_END)    /*       finish the word as exactly one string */ \
+    X(OP_SET_VAR)       /* s     pop a string into a variable */ \
+    X(OP_ARGS_BEGIN)    /*       mark where a command's words start */ \
+    X(OP_CALL_BUILTIN)  /* c     run a command whose name is a known builtin */ \
+    X(OP_SPAWN)         /* c     run a command whose name is a known program */ \
+    X(OP_RUN)           /* c     run a command, resolving its name at run time */ \
+    X(OP_CAPTURE)       /* c     like RUN, for the one command of a substitution whose
+                                 output is read from a pipe */ \
+    X(OP_PIPE_STAGE)    /* c v   start a pipeline stage; v is 1 for the last one */ \
+    X(OP_PIPE_FORK)     /* v a   fork a compound stage; the parent jumps to a */ \
+    X(OP_CHILD_EXIT)    /*       end a forked stage with status $? */ \
+    X(OP_PIPE_RUN)      /*       wait for the pending pipeline */ \
+    X(OP_JOB)           /* c     start a command as a background job; $? = 0 */ \
+    X(OP_JOB_FORK)      /* a     fork a background job; the parent jumps to a */ \
+    X(OP_REDIR_BEGIN)   /* c a   apply redirections; jump to a on failure */ \
+    X(OP_REDIR_END)     /*       undo the innermost redirections */ \
+    X(OP_PUSH_INT)      /* v     push an integer */ \
+    X(OP_LOAD_INT)      /* s     push a variable as an integer */ \
+    X(OP_STORE_INT)     /* s     pop an integer into a variable */ \
+    X(OP_DUP_INT)       /*       push a copy of the top integer */ \
+    X(OP_POP_INT)       /*       drop the top integer */ \
+    X(OP_ADD)           /*       pop b, a; push a + b, wrapping on overflow */ \
+    X(OP_SUB) \
+    X(OP_MUL) \
+    X(OP_DIV)           /* v     like ADD; v is the line for "division by 0" */ \
+    X(OP_MOD)           /* v */ \
+    X(OP_POW)           /* v */ \
+    X(OP_SHL) \
+    X(OP_SHR) \
+    X(OP_LT)            /*       pop b, a; push a < b ? 1 : 0 */ \
+    X(OP_LE) \
+    X(OP_GT) \
+    X(OP_GE) \
+    X(OP_EQ) \
+    X(OP_NE) \
+    X(OP_BAND) \
+    X(OP_BXOR) \
+    X(OP_BOR) \
+    X(OP_NEG)           /*       pop a; push -a */ \
+    X(OP_BNOT)          /*       pop a; push ~a */ \
+    X(OP_LNOT)          /*       pop a; push !a */ \
+    X(OP_JUMP_IF_ZERO)  /* a     pop an integer; jump if it is 0 */ \
+    X(OP_JUMP_IF_NONZERO) /* a   pop an integer; jump unless it is 0 */ \
+    X(OP_JUMP_IF_NOT_INT) /* s a jump unless a variable is exactly an integer */ \
+    X(OP_TEST_EQ)       /*       pop b, a; $? = a == b ? 0 : 1 */ \
+    X(OP_TEST_NE) \
+    X(OP_TEST_LT) \
+    X(OP_TEST_LE) \
+    X(OP_TEST_GT) \
+    X(OP_TEST_GE) \
+    X(OP_TEST_STREQ)    /*       pop two strings; $? = equal ? 0 : 1 */ \
+    X(OP_TEST_STRNE) \
+    X(OP_PATTERN_END)   /*       finish the word as a pattern, quoted parts escaped */ \
+    X(OP_MATCH)         /* a     pop a pattern; jump if it matches the string below */ \
+    X(OP_CASE)          /* m n a... pop a string; jump to the address of the first arm
+                                 that matches, or to address n when none does */ \
+    X(OP_POP_STRING)    /*       drop the top string */ \
+    X(OP_JUMP)          /* a */ \
+    X(OP_JUMP_IF_OK)    /* a     jump if $? == 0 */ \
+    X(OP_JUMP_IF_FAIL)  /* a     jump if $? != 0 */ \
+    X(OP_NOT)           /*       invert $? */ \
+    X(OP_SET_STATUS)    /* v */ \
+    X(OP_FOR_INIT)      /*       move the pending words into a new loop frame */ \
+    X(OP_FOR_NEXT)      /* s a   assign the next item to a variable, or jump when done */ \
+    X(OP_WHILE_INIT)    /*       push a new loop frame */ \
+    X(OP_LOOP_CHECK)    /* a     jump if the loop watchdog has gone off */ \
+    X(OP_LOOP_SAVE)     /*       record $? as the status of the innermost loop */ \
+    X(OP_LOOP_END)      /*       pop the loop frame; $? = its status */ \
+    X(OP_LOOP_EXIT)     /* v a   pop v loop frames; $? = 0 and jump (break, continue) */ \
+    X(OP_DEFINE)        /* f b   define a function; $? = 0 */ \
+    X(OP_RETURN)        /* v     leave the function; $? = the popped string if v is 1 */ \
+    X(OP_ERROR)         /* k     report a message; $? = 1 and abandon the command */
+
+#define OPCODE_ENUM(op) op,
+typedef enum {
+    OPCODES(OPCODE_ENUM)
+    OP_COUNT
+} Opcode;
+#undef OPCODE_ENUM
+
+typedef struct {
+    RedirType type;
+    int fd;
+} RedirOp;
+
+// Static description of a simple command. At run time its expanded words
+// sit on the VM's string stack as: assignment values, redirection
+// targets, then argv.
+typedef struct {
+    int line;
+    int builtin;            // builtin id for OP_CALL_BUILTIN, -1 otherwise
+    int function;           // function handle for a constant name, -1 otherwise
+    int nassigns;
+    int* assign_slots;
+    int nredirs;
+    RedirOp* redirs;
+} CmdInfo;
+
+typedef struct Chunk Chunk;
+
+struct Chunk {
+    int refs;               // functions keep their bodies after the script's chunk is gone
+    int* code;
+    int len;
+    int cap;
+    char** consts;
+    int nconsts;
+    int consts_cap;
+    CmdInfo* cmds;
+    int ncmds;
+    int cmds_cap;
+    CaseMatcher** matchers;
+    int nmatchers;
+    int matchers_cap;
+    Chunk** bodies;         // compiled functions and command substitutions
+    int nbodies;
+    int bodies_cap;
+    int pure;               // sets no variables and starts no pipelines; its
+                            // commands are checked when it runs
+    int capture;            // a substitution whose one command ends in OP_CAPTURE
+};
+
+Chunk* chunk_new(void);
+void chunk_retain(Chunk* chunk);
+// Drop a reference; the chunk is freed with the last one
+void chunk_free(Chunk* chunk);
+int chunk_emit(Chunk* chunk, int word);
+int chunk_const(Chunk* chunk, const char* text);
+int chunk_cmd(Chunk* chunk);
+int chunk_matcher(Chunk* chunk, CaseMatcher* matcher);
+int chunk_body(Chunk* chunk, Chunk* body);
+
+#endif
@@ -0,0 +1,982 @@
+#include "compile.h"
+#include "parser.h"
+#include "executor.h"
+#include "env.h"
+#include "function.h"
+#include "arith.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+// A loop being compiled. break and continue jump straight to its end or
+// to its next iteration; the jumps wait in lists threaded through their
+// own operands until those addresses are known.
+typedef struct LoopContext {
+    int redirs;             // redirections entered before the loop's body
+    int forks;              // forked pipeline stages around the loop
+    int breaks;             // operand of the latest break jump, or -1
+    int continues;
+    struct LoopContext* outer;
+} LoopContext;
+
+typedef struct {
+    Chunk* chunk;
+    int line;               // line of the command being compiled
+    LoopContext* loop;      // innermost enclosing loop, or NULL
+    int redirs;             // compound commands with redirections around here
+    int forks;              // forked pipeline stages around here
+    int function;           // compiling a function body, where return is allowed
+} Compiler;
+
+typedef enum {
+    WORD_FIELDS,    // command arguments: split and globbed
+    WORD_STRING,    // assignments, redirection targets, case subjects
+    WORD_PATTERN    // case patterns that contain expansions
+} WordMode;
+
+static void compile_node(Compiler* c, const Node* node);
+static Chunk* compile_chunk(const Node* node, int function, int capture);
+
+// The chunk changes shell state beyond what its commands do, so a command
+// substitution cannot run it in the shell process
+static void side_effect(Compiler* c) {
+    c->chunk->pure = 0;
+}
+
+static void compile_list(Compiler* c, const Node* node) {
+    for (; node; node = node->next) compile_node(c, node);
+}
+
+static void emit(Compiler* c, int word) {
+    chunk_emit(c->chunk, word);
+}
+
+static void emit_const(Compiler* c, int op, const char* text) {
+    emit(c, op);
+    emit(c, chunk_const(c->chunk, text));
+}
+
+// Variable names are resolved to slot handles once, at compile time
+static void emit_slot(Compiler* c, int op, const char* name) {
+    emit(c, op);
+    emit(c, var_slot(name));
+}
+
+// 64-bit immediates take two code words, low half first
+static void emit_int(Compiler* c, int64_t value) {
+    uint64_t bits = (uint64_t)value;
+    emit(c, OP_PUSH_INT);
+    emit(c, (int)(uint32_t)(bits & 0xffffffffu));
+    emit(c, (int)(uint32_t)(bits >> 32));
+}
+
+// Emit a jump with an unresolved target; returns the operand's address
+static int emit_jump(Compiler* c, int op) {
+    emit(c, op);
+    return chunk_emit(c->chunk, -1);
+}
+
+static void patch_jump(Compiler* c, int operand) {
+    c->chunk->code[operand] = c->chunk->len;
+}
+
+// Add a jump operand to a list threaded through the unresolved operands
+static void chain_jump(Compiler* c, int* list) {
+    *list = chunk_emit(c->chunk, *list);
+}
+
+static void patch_chain(Compiler* c, int list) {
+    while (list >= 0) {
+        int next = c->chunk->code[list];
+        c->chunk->code[list] = c->chunk->len;
+        list = next;
+    }
+}
+
+static void emit_arith(Compiler* c, const ArithNode* node);
+static void compile_plain_command(Compiler* c, const Node* node);
+
+// Opcode for each binary ArithOp; division and friends take a line operand
+static int binary_opcode(ArithOp op) {
+    switch (op) {
+    case AOP_ADD: return OP_ADD;
+    case AOP_SUB: return OP_SUB;
+    case AOP_MUL: return OP_MUL;
+    case AOP_DIV: return OP_DIV;
+    case AOP_MOD: return OP_MOD;
+    case AOP_POW: return OP_POW;
+    case AOP_SHL: return OP_SHL;
+    case AOP_SHR: return OP_SHR;
+    case AOP_LT: return OP_LT;
+    case AOP_LE: return OP_LE;
+    case AOP_GT: return OP_GT;
+    case AOP_GE: return OP_GE;
+    case AOP_EQ: return OP_EQ;
+    case AOP_NE: return OP_NE;
+    case AOP_BAND: return OP_BAND;
+    case AOP_BXOR: return OP_BXOR;
+    default: return OP_BOR;
+    }
+}
+
+static void emit_binary(Compiler* c, ArithOp op) {
+    int opcode = binary_opcode(op);
+    emit(c, opcode);
+    if (opcode == OP_DIV || opcode == OP_MOD || opcode == OP_POW) emit(c, c->line);
+}
+
+// a && b and a || b leave 0 or 1; b is only evaluated when it matters
+static void emit_logical(Compiler* c, const ArithNode* node) {
+    int is_and = node->kind == ARITH_AND;
+    emit_arith(c, node->a);
+    int short_circuit = emit_jump(c, is_and ? OP_JUMP_IF_ZERO : OP_JUMP_IF_NONZERO);
+    emit_arith(c, node->b);
+    emit(c, OP_LNOT);
+    emit(c, OP_LNOT);
+    int to_end = emit_jump(c, OP_JUMP);
+    patch_jump(c, short_circuit);
+    emit_int(c, is_and ? 0 : 1);
+    patch_jump(c, to_end);
+}
+
+static void emit_arith(Compiler* c, const ArithNode* node) {
+    switch (node->kind) {
+    case ARITH_NUM:
+        emit_int(c, node->value);
+        break;
+    case ARITH_VAR:
+        emit_slot(c, OP_LOAD_INT, node->name);
+        break;
+    case ARITH_UNARY:
+        emit_arith(c, node->a);
+        if (node->op == AOP_NEG) emit(c, OP_NEG);
+        else if (node->op == AOP_BNOT) emit(c, OP_BNOT);
+        else if (node->op == AOP_LNOT) emit(c, OP_LNOT);
+        break;
+    case ARITH_BINARY:
+        emit_arith(c, node->a);
+        emit_arith(c, node->b);
+        emit_binary(c, node->op);
+        break;
+    case ARITH_AND:
+    case ARITH_OR:
+        emit_logical(c, node);
+        break;
+    case ARITH_COND: {
+        emit_arith(c, node->a);
+        int to_else = emit_jump(c, OP_JUMP_IF_ZERO);
+        emit_arith(c, node->b);
+        int to_end = emit_jump(c, OP_JUMP);
+        patch_jump(c, to_else);
+        emit_arith(c, node->c);
+        patch_jump(c, to_end);
+        break;
+    }
+    case ARITH_COMMA:
+        emit_arith(c, node->a);
+        emit(c, OP_POP_INT);
+        emit_arith(c, node->b);
+        break;
+    case ARITH_ASSIGN:
+        side_effect(c);
+        if (node->op != AOP_NONE) emit_slot(c, OP_LOAD_INT, node->name);
+        emit_arith(c, node->a);
+        if (node->op != AOP_NONE) emit_binary(c, node->op);
+        emit(c, OP_DUP_INT);
+        emit_slot(c, OP_STORE_INT, node->name);
+        break;
+    case ARITH_INCDEC:
+        side_effect(c);
+        // The result is the new value for ++x and the old one for x++
+        emit_slot(c, OP_LOAD_INT, node->name);
+        if (!node->prefix) emit(c, OP_DUP_INT);
+        emit_int(c, 1);
+        emit(c, node->op == AOP_ADD ? OP_ADD : OP_SUB);
+        if (node->prefix) emit(c, OP_DUP_INT);
+        emit_slot(c, OP_STORE_INT, node->name);
+        break;
+    }
+}
+
+// Compile $(( expr )) so that it leaves one integer on the stack. A
+// malformed expression becomes a run-time error, as in other shells.
+static void compile_arith(Compiler* c, const char* expr) {
+    const char* error = NULL;
+    ArithNode* node = arith_parse(expr, &error);
+    if (!node) {
+        // The expression may be long; the error must not be cut off
+        char prefix[64];
+        snprintf(prefix, sizeof(prefix), "myshell: line %d: ", c->line);
+        StrBuf text;
+        sb_init(&text);
+        sb_append(&text, prefix);
+        sb_append(&text, expr);
+        sb_append(&text, ": ");
+        sb_append(&text, error);
+        emit_const(c, OP_ERROR, text.data);
+        sb_free(&text);
+        return;
+    }
+    emit_arith(c, node);
+    arith_free(node);
+}
+
+static int has_glob_chars(const char* s) {
+    return strpbrk(s, "*?[") != NULL;
+}
+
+// Nested substitutions recurse through the parser and the compiler here
+// and through vm_run when they run; this is far deeper than any script needs
+#define MAX_SUBSTITUTION_NESTING 100
+
+static int substitution_depth = 0;
+
+// $( ) and `` are parsed and compiled together with the command around
+// them, into a body of their own that OP_SUBST runs
+static void compile_substitution(Compiler* c, const char* text, int how) {
+    if (substitution_depth == MAX_SUBSTITUTION_NESTING) {
+        char message[128];
+        snprintf(message, sizeof(message), "myshell: line %d: command substitutions nested too deeply",
+            c->line);
+        emit_const(c, OP_ERROR, message);
+        return;
+    }
+
+    Source src;
+    source_string(&src, text, strlen(text));
+    Parser parser;
+    parser_init_at(&parser, &src, c->line);
+    Node* head = NULL;
+    Node** tail = &head;
+    Node* node;
+    while ((node = parser_next(&parser)) != NULL) {
+        *tail = node;
+        while (*tail) tail = &(*tail)->next;
+    }
+    int error = parser.error;
+    parser_free(&parser);
+
+    if (error) {
+        // The parser has reported it; the command is abandoned
+        node_free(head);
+        emit(c, OP_SET_STATUS);
+        emit(c, 2);
+        emit(c, OP_HALT);
+        return;
+    }
+
+    // Inside a function, return ends the substitution with its status
+    substitution_depth++;
+    Chunk* body = compile_chunk(head, c->function, 1);
+    substitution_depth--;
+    node_free(head);
+    emit(c, OP_SUBST);
+    emit(c, chunk_body(c->chunk, body));
+    emit(c, how);
+}
+
+// Emit the parts of a word followed by OP_FIELDS_END or OP_STRING_END.
+// Adjacent literal parts that behave the same are merged into one constant.
+static int is_quoted_args(const WordPart* part) {
+    return part->type == PART_VAR && part->quoted && strcmp(part->text, "@") == 0;
+}
+
+static void compile_word(Compiler* c, const Word* word, WordMode mode) {
+    StrBuf pending;
+    int pending_op = -1;
+    sb_init(&pending);
+
+    // "$@" is one field per parameter, and no field at all when there are
+    // none, so the empty text the quotes leave behind is dropped
+    int has_args = 0;
+    for (const WordPart* part = word->parts; part && mode == WORD_FIELDS; part = part->next) {
+        if (is_quoted_args(part)) has_args = 1;
+    }
+
+    for (const WordPart* part = word->parts; part; part = part->next) {
+        if (part->type == PART_LITERAL) {
+            if (has_args && !*part->text) continue;
+            int op = OP_LIT;
+            if (mode == WORD_FIELDS && !part->quoted && has_glob_chars(part->text)) op = OP_LIT_GLOB;
+            if (mode == WORD_PATTERN && !part->quoted) op = OP_LIT_GLOB;
+            if (mode == WORD_FIELDS && !part->quoted && !*part->text) continue;
+
+            if (pending_op >= 0 && pending_op != op) {
+                emit_const(c, pending_op, pending.data);
+                sb_clear(&pending);
+            }
+            pending_op = op;
+            sb_append(&pending, part->text);
+            continue;
+        }
+
+        if (pending_op >= 0) {
+            emit_const(c, pending_op, pending.data);
+            sb_clear(&pending);
+            pending_op = -1;
+        }
+
+        if (has_args && is_quoted_args(part)) {
+            emit(c, OP_VAR_ARGS);
+        }
+        else if (part->type == PART_VAR) {
+            int op = OP_VAR;
+            if (!part->quoted && mode == WORD_FIELDS) op = OP_VAR_SPLIT;
+            if (!part->quoted && mode == WORD_PATTERN) op = OP_VAR_PATTERN;
+            emit_slot(c, op, part->text);
+        }
+        else if (part->type == PART_COMMAND) {
+            int how = 0;
+            if (!part->quoted && mode == WORD_FIELDS) how = 1;
+            if (!part->quoted && mode == WORD_PATTERN) how = 2;
+            compile_substitution(c, part->text, how);
+        }
+        else {
+            compile_arith(c, part->text);
+            emit(c, OP_ARITH_STR);
+        }
+    }
+
+    if (pending_op >= 0) emit_const(c, pending_op, pending.data);
+    sb_free(&pending);
+    if (mode == WORD_FIELDS) emit(c, OP_FIELDS_END);
+    else if (mode == WORD_PATTERN) emit(c, OP_PATTERN_END);
+    else emit(c, OP_STRING_END);
+}
+
+// The $(( )) part of a value made of nothing else, or NULL
+static const WordPart* arith_only(const Word* word) {
+    const WordPart* arith = NULL;
+    for (const WordPart* part = word->parts; part; part = part->next) {
+        if (part->type == PART_LITERAL && !*part->text) continue;
+        if (part->type != PART_ARITH || arith) return NULL;
+        arith = part;
+    }
+    return arith;
+}
+
+// Text of a word with no expansions or glob characters, or NULL
+static char* word_constant(const Word* word) {
+    StrBuf text;
+    sb_init(&text);
+    for (const WordPart* part = word->parts; part; part = part->next) {
+        if (part->type != PART_LITERAL || (!part->quoted && has_glob_chars(part->text))) {
+            sb_free(&text);
+            return NULL;
+        }
+        sb_append(&text, part->text);
+    }
+    return sb_release(&text);
+}
+
+// Integer operand of a test: a literal number or a lone variable
+static int is_int_operand(const Word* word) {
+    const WordPart* part = word->parts;
+    if (!part || part->next) return 0;
+    if (part->type == PART_VAR) return 1;
+    if (part->type != PART_LITERAL || !*part->text) return 0;
+    char* end;
+    strtoll(part->text, &end, 10);
+    return !*end;
+}
+
+static void compile_int_operand(Compiler* c, const Word* word) {
+    const WordPart* part = word->parts;
+    if (part->type == PART_VAR) emit_slot(c, OP_LOAD_INT, part->text);
+    else emit_int(c, strtoll(part->text, NULL, 10));
+}
+
+// A variable operand that is not an integer goes to the test builtin,
+// which reports it
+static void check_int_operand(Compiler* c, const Word* word, int* not_int) {
+    if (word->parts->type != PART_VAR) return;
+    emit_slot(c, OP_JUMP_IF_NOT_INT, word->parts->text);
+    chain_jump(c, not_int);
+}
+
+// A string operand is safe to compile when it cannot be split away
+static int is_string_operand(const Word* word) {
+    const WordPart* part = word->parts;
+    if (!part || part->next) return 0;
+    return part->type == PART_LITERAL || (part->type == PART_VAR && part->quoted);
+}
+
+// [ A op B ] with simple operands compiles to a direct compare
+static int compile_test(Compiler* c, const Node* node) {
+    static const struct { const char* name; int op; } int_ops[] = {
+        { "-eq", OP_TEST_EQ }, { "-ne", OP_TEST_NE }, { "-lt", OP_TEST_LT },
+        { "-le", OP_TEST_LE }, { "-gt", OP_TEST_GT }, { "-ge", OP_TEST_GE }
+    };
+
+    const Word* w = node->u.simple.words;
+    if (node->u.simple.assigns || node->redirs || !word_is(w, "[")) return 0;
+
+    const Word* lhs = w->next;
+    const Word* op_word = lhs ? lhs->next : NULL;
+    const Word* rhs = op_word ? op_word->next : NULL;
+    if (!rhs || !rhs->next || !word_is(rhs->next, "]") || rhs->next->next) return 0;
+
+    const char* op = word_literal(op_word);
+    if (!op) return 0;
+
+    for (size_t i = 0; i < sizeof(int_ops) / sizeof(int_ops[0]); i++) {
+        if (strcmp(op, int_ops[i].name) != 0) continue;
+
+        if (!is_int_operand(lhs) || !is_int_operand(rhs)) return 0;
+        // Both are checked before either is pushed
+        int not_int = -1;
+        check_int_operand(c, lhs, &not_int);
+        check_int_operand(c, rhs, &not_int);
+        compile_int_operand(c, lhs);
+        compile_int_operand(c, rhs);
+        emit(c, int_ops[i].op);
+        if (not_int >= 0) {
+            int to_end = emit_jump(c, OP_JUMP);
+            patch_chain(c, not_int);
+            compile_plain_command(c, node);
+            patch_jump(c, to_end);
+        }
+        return 1;
+    }
+
+    int string_op;
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) string_op = OP_TEST_STREQ;
+    else if (strcmp(op, "!=") == 0) string_op = OP_TEST_STRNE;
+    else return 0;
+
+    if (!is_string_operand(lhs) || !is_string_operand(rhs)) return 0;
+    compile_word(c, lhs, WORD_STRING);
+    compile_word(c, rhs, WORD_STRING);
+    emit(c, string_op);
+    return 1;
+}
+
+static void compile_redir_targets(Compiler* c, const Redir* redir, RedirOp* ops) {
+    for (int i = 0; redir; redir = redir->next, i++) {
+        ops[i].type = redir->type;
+        ops[i].fd = redir->fd;
+        compile_word(c, redir->target, WORD_STRING);
+    }
+}
+
+// Emit the words of a simple command; returns its descriptor index
+static int compile_command_words(Compiler* c, const Node* node) {
+    int index = chunk_cmd(c->chunk);
+    int nassigns = 0;
+    int nredirs = 0;
+
+    for (const Assign* a = node->u.simple.assigns; a; a = a->next) nassigns++;
+    for (const Redir* r = node->redirs; r; r = r->next) nredirs++;
+
+    int* slots = nassigns ? xmalloc(nassigns * sizeof(int)) : NULL;
+    RedirOp* redirs = nredirs ? xmalloc(nredirs * sizeof(RedirOp)) : NULL;
+
+    emit(c, OP_ARGS_BEGIN);
+
+    int i = 0;
+    for (const Assign* a = node->u.simple.assigns; a; a = a->next, i++) {
+        slots[i] = var_slot(a->name);
+        compile_word(c, a->value, WORD_STRING);
+    }
+    compile_redir_targets(c, node->redirs, redirs);
+    for (const Word* w = node->u.simple.words; w; w = w->next) {
+        compile_word(c, w, WORD_FIELDS);
+    }
+
+    CmdInfo* info = &c->chunk->cmds[index];
+    info->line = node->line;
+    info->nassigns = nassigns;
+    info->assign_slots = slots;
+    info->nredirs = nredirs;
+    info->redirs = redirs;
+    return index;
+}
+
+// Count operand of break and continue: a positive number, or 0
+static long loop_count(const char* text) {
+    char* end;
+    long count = strtol(text, &end, 10);
+    return end == text || *end || count < 1 ? 0 : count;
+}
+
+// break N and continue N inside a loop of this script are plain jumps.
+// Everything else, including a count that is out of range, is left to
+// the builtins of the same name, which only report the error.
+static int compile_loop_control(Compiler* c, const Node* node) {
+    const Word* w = node->u.simple.words;
+    int is_break = word_is(w, "break");
+    if (!c->loop || node->u.simple.assigns || node->redirs) return 0;
+    if (!is_break && !word_is(w, "continue")) return 0;
+    if (w->next && w->next->next) return 0;
+
+    long count = 1;
+    if (w->next) {
+        const char* text = word_literal(w->next);
+        if (!text) {
+            char message[256];
+            snprintf(message, sizeof(message), "myshell: line %d: %s: loop count must be a number",
+                c->line, is_break ? "break" : "continue");
+            emit_const(c, OP_ERROR, message);
+            return 1;
+        }
+        count = loop_count(text);
+        if (count == 0) return 0;
+    }
+
+    // Like other shells, a count past the outermost loop means that loop
+    LoopContext* target = c->loop;
+    int frames = 1;
+    for (; frames < count && target->outer; frames++) target = target->outer;
+
+    // A forked pipeline stage can only leave the loop by exiting
+    if (target->forks < c->forks) {
+        emit(c, OP_SET_STATUS);
+        emit(c, 0);
+        emit(c, OP_CHILD_EXIT);
+        return 1;
+    }
+
+    for (int i = target->redirs; i < c->redirs; i++) emit(c, OP_REDIR_END);
+    emit(c, OP_LOOP_EXIT);
+    if (is_break) {
+        emit(c, frames);
+        chain_jump(c, &target->breaks);
+    }
+    else {
+        emit(c, frames - 1);
+        chain_jump(c, &target->continues);
+    }
+    return 1;
+}
+
+// return [N] in a function body; elsewhere the builtin reports the error
+static int compile_return(Compiler* c, const Node* node) {
+    const Word* w = node->u.simple.words;
+    if (!c->function || node->u.simple.assigns || node->redirs || !word_is(w, "return")) return 0;
+    if (w->next && w->next->next) return 0;
+
+    if (w->next) compile_word(c, w->next, WORD_STRING);
+    emit(c, OP_RETURN);
+    emit(c, w->next != NULL);
+    return 1;
+}
+
+// Whether a word runs a command substitution
+static int has_substitution(const Word* word) {
+    for (const WordPart* part = word->parts; part; part = part->next) {
+        if (part->type == PART_COMMAND) return 1;
+    }
+    return 0;
+}
+
+// A constant command name is resolved now instead of on every run;
+// returns the opcode that runs the command
+static int resolve_command(Compiler* c, const Word* words, int index) {
+    char* name = words ? word_constant(words) : NULL;
+    if (!name) return words ? OP_RUN : OP_SPAWN;
+
+    int builtin = builtin_lookup(name);
+    c->chunk->cmds[index].builtin = builtin;
+    c->chunk->cmds[index].function = function_slot(name);
+    free(name);
+    return builtin >= 0 ? OP_CALL_BUILTIN : OP_SPAWN;
+}
+
+// A simple command run by name, with no shortcuts
+static void compile_plain_command(Compiler* c, const Node* node) {
+    int index = compile_command_words(c, node);
+    emit(c, resolve_command(c, node->u.simple.words, index));
+    emit(c, index);
+}
+
+static void compile_simple(Compiler* c, const Node* node) {
+    const Word* words = node->u.simple.words;
+
+    // Plain assignments never build a command. Their status is 0, or that
+    // of the last command substitution in the values.
+    if (!words && !node->redirs) {
+        int substitutions = 0;
+        for (const Assign* a = node->u.simple.assigns; a; a = a->next) {
+            substitutions |= has_substitution(a->value);
+        }
+        if (substitutions) {
+            emit(c, OP_SET_STATUS);
+            emit(c, 0);
+        }
+        side_effect(c);
+        for (const Assign* a = node->u.simple.assigns; a; a = a->next) {
+            const WordPart* arith = arith_only(a->value);
+            if (arith) {
+                compile_arith(c, arith->text);
+                emit_slot(c, OP_STORE_INT, a->name);
+            }
+            else {
+                compile_word(c, a->value, WORD_STRING);
+                emit_slot(c, OP_SET_VAR, a->name);
+            }
+        }
+        if (!substitutions) {
+            emit(c, OP_SET_STATUS);
+            emit(c, 0);
+        }
+        return;
+    }
+
+    if (compile_test(c, node)) return;
+    if (compile_loop_control(c, node)) return;
+    if (compile_return(c, node)) return;
+
+    compile_plain_command(c, node);
+}
+
+// $(command) with one simple command: OP_CAPTURE starts it with its output
+// on a pipe, so an external program costs one spawn and no forked shell
+static void compile_capture(Compiler* c, const Node* node) {
+    int index = compile_command_words(c, node);
+    resolve_command(c, node->u.simple.words, index);
+    emit(c, OP_CAPTURE);
+    emit(c, index);
+    c->chunk->capture = 1;
+}
+
+static void compile_pipeline(Compiler* c, const Node* node) {
+    const Node* stages = node->u.pipeline.stages;
+
+    if (!stages->next) {
+        compile_node(c, stages);
+    }
+    else {
+        side_effect(c);
+        for (const Node* stage = stages; stage; stage = stage->next) {
+            int last = stage->next == NULL;
+            if (stage->type == NODE_SIMPLE) {
+                int index = compile_command_words(c, stage);
+                emit(c, OP_PIPE_STAGE);
+                emit(c, index);
+                emit(c, last);
+            }
+            else {
+                // Compound stages run in a forked copy of the shell
+                emit(c, OP_PIPE_FORK);
+                emit(c, last);
+                int skip = chunk_emit(c->chunk, -1);
+                c->forks++;
+                compile_node(c, stage);
+                c->forks--;
+                emit(c, OP_CHILD_EXIT);
+                patch_jump(c, skip);
+            }
+        }
+        emit(c, OP_PIPE_RUN);
+    }
+
+    if (node->u.pipeline.negate) emit(c, OP_NOT);
+}
+
+// command &: a simple command is started like a pipeline stage, anything
+// else runs in a forked copy of the shell. Either way $? is 0 at once.
+static void compile_background(Compiler* c, const Node* node) {
+    const Node* body = node->u.background.body;
+    side_effect(c);
+    if (body->type == NODE_SIMPLE && (body->u.simple.words || body->redirs)) {
+        int index = compile_command_words(c, body);
+        emit(c, OP_JOB);
+        emit(c, index);
+        return;
+    }
+
+    int skip = emit_jump(c, OP_JOB_FORK);
+    c->forks++;
+    compile_node(c, body);
+    c->forks--;
+    emit(c, OP_CHILD_EXIT);
+    patch_jump(c, skip);
+}
+
+static void compile_if(Compiler* c, const Node* node) {
+    compile_list(c, node->u.if_stmt.cond);
+    int to_else = emit_jump(c, OP_JUMP_IF_FAIL);
+    compile_list(c, node->u.if_stmt.then_body);
+    int to_end = emit_jump(c, OP_JUMP);
+
+    patch_jump(c, to_else);
+    if (node->u.if_stmt.else_body) {
+        compile_list(c, node->u.if_stmt.else_body);
+    }
+    else {
+        emit(c, OP_SET_STATUS);
+        emit(c, 0);
+    }
+    patch_jump(c, to_end);
+}
+
+static void begin_loop(Compiler* c, LoopContext* loop) {
+    loop->redirs = c->redirs;
+    loop->forks = c->forks;
+    loop->breaks = -1;
+    loop->continues = -1;
+    loop->outer = c->loop;
+    c->loop = loop;
+}
+
+// Every iteration ends by recording the body's status and going back to
+// top; continue jumps to the same place
+static void end_loop(Compiler* c, LoopContext* loop, int top) {
+    c->loop = loop->outer;
+    patch_chain(c, loop->continues);
+    emit(c, OP_LOOP_SAVE);
+    emit(c, OP_JUMP);
+    emit(c, top);
+}
+
+static void compile_for(Compiler* c, const Node* node) {
+    LoopContext loop;
+    side_effect(c);
+    emit(c, OP_ARGS_BEGIN);
+    for (const Word* w = node->u.for_loop.words; w; w = w->next) {
+        compile_word(c, w, WORD_FIELDS);
+    }
+    emit(c, OP_FOR_INIT);
+
+    int top = c->chunk->len;
+    int stopped = emit_jump(c, OP_LOOP_CHECK);
+    emit_slot(c, OP_FOR_NEXT, node->u.for_loop.var);
+    int to_end = chunk_emit(c->chunk, -1);
+    begin_loop(c, &loop);
+    compile_list(c, node->u.for_loop.body);
+    end_loop(c, &loop, top);
+
+    patch_jump(c, stopped);
+    patch_jump(c, to_end);
+    emit(c, OP_LOOP_END);
+    patch_chain(c, loop.breaks);
+}
+
+static void compile_while(Compiler* c, const Node* node) {
+    LoopContext loop;
+    emit(c, OP_WHILE_INIT);
+
+    int top = c->chunk->len;
+    int stopped = emit_jump(c, OP_LOOP_CHECK);
+    begin_loop(c, &loop);
+    compile_list(c, node->u.while_loop.cond);
+    int to_end = emit_jump(c, node->u.while_loop.until ? OP_JUMP_IF_OK : OP_JUMP_IF_FAIL);
+    compile_list(c, node->u.while_loop.body);
+    end_loop(c, &loop, top);
+
+    patch_jump(c, stopped);
+    patch_jump(c, to_end);
+    emit(c, OP_LOOP_END);
+    patch_chain(c, loop.breaks);
+}
+
+// The body becomes a chunk of its own, installed when the definition runs
+static void compile_function(Compiler* c, const Node* node) {
+    Chunk* body = compile_chunk(node->u.function.body, 1, 0);
+    side_effect(c);
+    emit(c, OP_DEFINE);
+    emit(c, function_slot(node->u.function.name));
+    emit(c, chunk_body(c->chunk, body));
+}
+
+// Patterns are tried in order with the subject kept on the string stack;
+// each arm's body starts by dropping it.
+// Append a case pattern made only of literal text, with quoted glob
+// characters escaped. Returns 0 when the pattern has expansions.
+static int constant_pattern(const Word* word, StrBuf* pattern) {
+    for (const WordPart* part = word->parts; part; part = part->next) {
+        if (part->type != PART_LITERAL) return 0;
+        for (const char* s = part->text; *s; s++) {
+            if (part->quoted && strchr("*?[\\", *s)) sb_appendc(pattern, '\\');
+            sb_appendc(pattern, *s);
+        }
+    }
+    return 1;
+}
+
+// Compile every pattern into one matcher; returns NULL if any pattern
+// has to be expanded at run time
+static CaseMatcher* compile_matcher(const Node* node) {
+    CaseMatcher* matcher = matcher_new();
+    StrBuf pattern;
+    sb_init(&pattern);
+    int arm_index = 0;
+    for (const CaseArm* arm = node->u.case_stmt.arms; arm; arm = arm->next, arm_index++) {
+        for (const Word* w = arm->patterns; w; w = w->next) {
+            sb_clear(&pattern);
+            if (!constant_pattern(w, &pattern)) {
+                matcher_free(matcher);
+                sb_free(&pattern);
+                return NULL;
+            }
+            matcher_add(matcher, pattern.data, arm_index);
+        }
+    }
+    sb_free(&pattern);
+    return matcher;
+}
+
+// Constant patterns dispatch through OP_CASE's jump table. Patterns with
+// expansions are tried one at a time with OP_MATCH, which keeps the
+// subject on the string stack until an arm is chosen.
+static void compile_case(Compiler* c, const Node* node) {
+    int narms = 0;
+    int npatterns = 0;
+    for (const CaseArm* arm = node->u.case_stmt.arms; arm; arm = arm->next) {
+        narms++;
+        for (const Word* w = arm->patterns; w; w = w->next) npatterns++;
+    }
+
+    // Operands to patch with the address of each arm
+    int* sites = xmalloc((npatterns + narms + 1) * sizeof(int));
+    int* site_arm = xmalloc((npatterns + narms + 1) * sizeof(int));
+    int nsites = 0;
+
+    compile_word(c, node->u.case_stmt.subject, WORD_STRING);
+
+    CaseMatcher* matcher = compile_matcher(node);
+    if (matcher) {
+        emit(c, OP_CASE);
+        emit(c, chunk_matcher(c->chunk, matcher));
+        emit(c, narms);
+        for (int i = 0; i < narms; i++) {
+            sites[nsites] = chunk_emit(c->chunk, -1);
+            site_arm[nsites++] = i;
+        }
+        // No arm matched: continue right after the table
+        patch_jump(c, chunk_emit(c->chunk, -1));
+    }
+    else {
+        int arm_index = 0;
+        for (const CaseArm* arm = node->u.case_stmt.arms; arm; arm = arm->next, arm_index++) {
+            for (const Word* w = arm->patterns; w; w = w->next) {
+                compile_word(c, w, WORD_PATTERN);
+                sites[nsites] = emit_jump(c, OP_MATCH);
+                site_arm[nsites++] = arm_index;
+            }
+        }
+        emit(c, OP_POP_STRING);
+    }
+
+    int* to_end = xmalloc((narms + 1) * sizeof(int));
+    emit(c, OP_SET_STATUS);
+    emit(c, 0);
+    to_end[0] = emit_jump(c, OP_JUMP);
+
+    int arm_index = 0;
+    for (const CaseArm* arm = node->u.case_stmt.arms; arm; arm = arm->next, arm_index++) {
+        for (int i = 0; i < nsites; i++) {
+            if (site_arm[i] == arm_index) patch_jump(c, sites[i]);
+        }
+        if (!matcher) emit(c, OP_POP_STRING);
+        emit(c, OP_SET_STATUS);
+        emit(c, 0);
+        compile_list(c, arm->body);
+        to_end[arm_index + 1] = emit_jump(c, OP_JUMP);
+    }
+
+    for (int i = 0; i <= narms; i++) patch_jump(c, to_end[i]);
+    free(to_end);
+    free(sites);
+    free(site_arm);
+}
+
+// Emit REDIR_BEGIN for a compound command; returns its jump operand
+static int compile_redir_begin(Compiler* c, const Node* node) {
+    int index = chunk_cmd(c->chunk);
+    int nredirs = 0;
+    for (const Redir* r = node->redirs; r; r = r->next) nredirs++;
+    RedirOp* redirs = xmalloc(nredirs * sizeof(RedirOp));
+    side_effect(c);
+
+    emit(c, OP_ARGS_BEGIN);
+    compile_redir_targets(c, node->redirs, redirs);
+
+    CmdInfo* info = &c->chunk->cmds[index];
+    info->line = node->line;
+    info->nredirs = nredirs;
+    info->redirs = redirs;
+
+    emit(c, OP_REDIR_BEGIN);
+    emit(c, index);
+    return chunk_emit(c->chunk, -1);
+}
+
+static void compile_node(Compiler* c, const Node* node) {
+    c->line = node->line;
+
+    // Redirections on a compound command wrap its whole body
+    int redirected = node->redirs && node->type != NODE_SIMPLE;
+    int on_error = redirected ? compile_redir_begin(c, node) : 0;
+    c->redirs += redirected;
+
+    switch (node->type) {
+    case NODE_SIMPLE:
+        compile_simple(c, node);
+        break;
+    case NODE_PIPELINE:
+        compile_pipeline(c, node);
+        break;
+    case NODE_AND:
+    case NODE_OR: {
+        compile_node(c, node->u.binary.left);
+        int skip = emit_jump(c, node->type == NODE_AND ? OP_JUMP_IF_FAIL : OP_JUMP_IF_OK);
+        compile_node(c, node->u.binary.right);
+        patch_jump(c, skip);
+        break;
+    }
+    case NODE_IF:
+        compile_if(c, node);
+        break;
+    case NODE_FOR:
+        compile_for(c, node);
+        break;
+    case NODE_WHILE:
+        compile_while(c, node);
+        break;
+    case NODE_CASE:
+        compile_case(c, node);
+        break;
+    case NODE_GROUP:
+        compile_list(c, node->u.group.body);
+        break;
+    case NODE_FUNCTION:
+        compile_function(c, node);
+        break;
+    case NODE_BACKGROUND:
+        compile_background(c, node);
+        break;
+    }
+
+    if (redirected) {
+        c->redirs--;
+        patch_jump(c, on_error);
+        emit(c, OP_REDIR_END);
+    }
+}
+
+// capture: compiling the body of a command substitution
+static Chunk* compile_chunk(const Node* node, int function, int capture) {
+    Compiler c;
+    c.chunk = chunk_new();
+    c.line = node ? node->line : 0;
+    c.loop = NULL;
+    c.redirs = 0;
+    c.forks = 0;
+    c.function = function;
+    if (capture && node && !node->next && node->type == NODE_SIMPLE && node->u.simple.words) {
+        if (!compile_return(&c, node)) compile_capture(&c, node);
+    }
+    else {
+        compile_list(&c, node);
+    }
+    emit(&c, OP_HALT);
+    return c.chunk;
+}
+
+Chunk* compile_command(const Node* node) {
+    return compile_chunk(node, 0, 0);
+}
@@ -0,0 +1,10 @@
+#ifndef COMPILE_H
+#define COMPILE_H
+
+#include "ast.h"
+#include "bytecode.h"
+
+// Compile a command list into a chunk that ends with OP_HALT
+Chunk* compile_command(const Node* node);
+
+#endif
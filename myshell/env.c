@@ -1,223 +1,575 @@
+#define _POSIX_C_SOURCE 200809L
 #include "env.h"
+#include "util.h"
+#include "spawn.h"
+#include "arith.h"
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <errno.h>
 #include <stdlib.h>
+#include <inttypes.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
-#define MAX_VARS 100
-#define MAX_LINE 256
+#ifdef _WIN32
+#include <process.h>
+#define environ _environ
+#else
+extern char** environ;
+#endif
 
+// Variables live in a growable array of slots; an open-addressing hash
+// table maps interned names to slot indexes. A slot index never changes,
+// so compiled code resolves each name once and keeps the handle.
+// A value may be held as text, as an int64, or both: arithmetic stores
+// only the number, and the text is formatted the first time it is read.
 typedef struct {
-    char name[32];
-    char value[64];
+    char* name;
+    uint32_t hash;
+    char special;           // '?', '$', '!', '0', '#', '*', '@', '1' for $1..$N, or 0
+    int position;           // N of a positional parameter
+    char exported;          // mirrored into the process environment
+    char has_text;          // value holds the current text
+    char has_number;        // number holds the current value
+    char* value;            // text, formatted from number on demand
+    size_t len;
+    size_t cap;
+    int64_t number;         // integer form, parsed from value on demand
 } Var;
 
-static Var vars[MAX_VARS];
+static Var* vars = NULL;
 static int var_count = 0;
+static int vars_cap = 0;
+static int* table = NULL;   // slot + 1, or 0 for an empty bucket
+static size_t table_size = 0;
+static int path_slot = -1;  // assigning PATH drops the command cache
+
 static int exit_status = 0;
-static int process_id = 1234;
-static int arg_count = 0;
-static char arg_list[256] = "";
+static int process_id = 0;
+static int background_pid = 0;      // $!, 0 until a job is started
+static const char* script_name = "myshell";
+static Params params = { NULL, 0 };
+static StrBuf joined_params;        // "$*" and "$@" outside of a word list
+
+// Function scopes. Variables keep their slots while a function runs: local
+// moves the caller's value onto this stack and the end of the call moves
+// it back, so reading a variable costs the same inside a function.
+typedef struct {
+    int slot;
+    Var saved;
+    char* spare;            // a finished local's buffer, reused by the next one
+    size_t spare_cap;
+} SavedVar;
 
+static SavedVar* saved_vars = NULL;
+static int nsaved = 0;
+static int saved_cap = 0;
+static int* scopes = NULL;          // where each scope's saved variables start
+static int nscopes = 0;
+static int scopes_cap = 0;
 
-const char* get_var(const char* name) {
-    // Handle special variables
-    if (strcmp(name, "?") == 0) {
-        static char status_str[16];
-        sprintf(status_str, "%d", exit_status);
-        return status_str;
+// Parameters given with set -- are copied into the store of the function
+// depth that set them; the buffers are kept and reused by the next set.
+typedef struct {
+    char** items;
+    int items_cap;
+    char* text;
+    size_t text_cap;
+} ParamStore;
+
+static ParamStore* stores = NULL;
+static int stores_cap = 0;
+
+static void table_insert(int slot) {
+    size_t mask = table_size - 1;
+    size_t i = vars[slot].hash & mask;
+    while (table[i]) i = (i + 1) & mask;
+    table[i] = slot + 1;
+}
+
+static void table_grow(void) {
+    free(table);
+    table_size = table_size ? table_size * 2 : 64;
+    table = xcalloc(table_size, sizeof(int));
+    for (int slot = 0; slot < var_count; slot++) table_insert(slot);
+}
+
+static int find_slot(const char* name, uint32_t hash) {
+    if (!table) return -1;
+    size_t mask = table_size - 1;
+    for (size_t i = hash & mask; table[i]; i = (i + 1) & mask) {
+        const Var* var = &vars[table[i] - 1];
+        if (var->hash == hash && strcmp(var->name, name) == 0) return table[i] - 1;
     }
-    else if (strcmp(name, "$") == 0) {
-        static char pid_str[16];
-        sprintf(pid_str, "%d", process_id);
-        return pid_str;
+    return -1;
+}
+
+// One-character names with values the shell maintains
+#define SPECIAL_NAMES "?$!0#*@"
+
+// N for the name of positional parameter $N, 0 for any other name
+static int positional_name(const char* name) {
+    if (name[0] < '1' || name[0] > '9' || strspn(name, "0123456789") != strlen(name)) return 0;
+    return atoi(name);
+}
+
+// Look a name up without creating it; returns -1 if it was never interned
+int var_find(const char* name) {
+    return find_slot(name, hash_string(name));
+}
+
+// Intern a name and return its slot handle
+int var_slot(const char* name) {
+    uint32_t hash = hash_string(name);
+    int slot = find_slot(name, hash);
+    if (slot >= 0) return slot;
+
+    if (var_count == vars_cap) {
+        vars_cap = vars_cap ? vars_cap * 2 : 64;
+        vars = xrealloc(vars, vars_cap * sizeof(Var));
     }
-    else if (strcmp(name, "#") == 0) {
-        static char count_str[16];
-        sprintf(count_str, "%d", arg_count);
-        return count_str;
+    // Keep the load factor at or below one half
+    if ((size_t)(var_count + 1) * 2 > table_size) table_grow();
+
+    slot = var_count++;
+    Var* var = &vars[slot];
+    memset(var, 0, sizeof(Var));
+    var->name = xstrdup(name);
+    var->hash = hash;
+    if (name[0] && !name[1] && strchr(SPECIAL_NAMES, name[0])) var->special = name[0];
+    var->position = positional_name(name);
+    if (var->position > 0) var->special = '1';
+    if (strcmp(name, "PATH") == 0) path_slot = slot;
+    table_insert(slot);
+    return slot;
+}
+
+const char* var_name(int slot) {
+    return vars[slot].name;
+}
+
+// Each special variable formats into its own buffer, so "$?-$#" can refer
+// to both values at once
+static const char* special_value(char which, int position) {
+    static char status_text[16], pid_text[16], count_text[16], background_text[16];
+    switch (which) {
+    case '?':
+        sprintf(status_text, "%d", exit_status);
+        return status_text;
+    case '$':
+        sprintf(pid_text, "%d", process_id);
+        return pid_text;
+    case '!':
+        if (!background_pid) return "";
+        sprintf(background_text, "%d", background_pid);
+        return background_text;
+    case '0':
+        return script_name;
+    case '#':
+        sprintf(count_text, "%d", params.count);
+        return count_text;
+    case '1':
+        return position <= params.count ? params.values[position - 1] : "";
+    default:
+        if (!joined_params.data) sb_init(&joined_params);
+        sb_clear(&joined_params);
+        for (int i = 0; i < params.count; i++) {
+            if (i > 0) sb_appendc(&joined_params, ' ');
+            sb_append(&joined_params, params.values[i]);
+        }
+        return joined_params.data;
     }
-    else if (strcmp(name, "*") == 0) {
-        return arg_list;
+}
+
+// Only $? can be assigned; the others ignore it
+static void set_special(char which, const char* value) {
+    if (which == '?') exit_status = atoi(value);
+}
+
+static void put_env(const char* name, const char* value) {
+#ifdef _WIN32
+    _putenv_s(name, value);
+#else
+    setenv(name, value, 1);
+#endif
+}
+
+static void store_text(Var* var, const char* value, size_t len) {
+    if (!var->value || len + 1 > var->cap) {
+        free(var->value);
+        var->cap = len + 1 < 16 ? 16 : len + 1;
+        var->value = xmalloc(var->cap);
     }
-    else if (strcmp(name, "@") == 0) {
-        return arg_list;
+    memcpy(var->value, value, len);
+    var->value[len] = '\0';
+    var->len = len;
+    var->has_text = 1;
+}
+
+static void format_number(Var* var) {
+    char buffer[32];
+    int len = sprintf(buffer, "%" PRId64, var->number);
+    store_text(var, buffer, (size_t)len);
+}
+
+const char* var_get(int slot) {
+    Var* var = &vars[slot];
+    if (var->special) return special_value(var->special, var->position);
+    if (!var->has_text && var->has_number) format_number(var);
+    return var->has_text ? var->value : "";
+}
+
+// Side effects of assigning a variable other code depends on
+static void value_changed(int slot) {
+    Var* var = &vars[slot];
+    if (var->exported) put_env(var->name, var_get(slot));
+    if (slot == path_slot) path_cache_clear();
+}
+
+// Values have no length limit; the buffer is reused when it is big enough
+void var_set(int slot, const char* value) {
+    Var* var = &vars[slot];
+    if (var->special) {
+        set_special(var->special, value);
+        return;
     }
 
-    // Regular variable lookup
-    for (int i = 0; i < var_count; i++) {
-        if (strcmp(vars[i].name, name) == 0)
-            return vars[i].value;
+    store_text(var, value, strlen(value));
+    var->has_number = 0;
+    value_changed(slot);
+}
+
+void var_unset(int slot) {
+    Var* var = &vars[slot];
+    if (var->special) return;
+    free(var->value);
+    var->value = NULL;
+    var->len = var->cap = 0;
+    var->has_text = 0;
+    var->has_number = 0;
+    if (var->exported) {
+#ifdef _WIN32
+        _putenv_s(var->name, "");
+#else
+        unsetenv(var->name);
+#endif
+        var->exported = 0;
     }
-    return "";
+    if (slot == path_slot) path_cache_clear();
 }
 
-void set_var(const char* name, const char* value) {
-    // Update exit status if setting $?
-    if (strcmp(name, "?") == 0) {
-        exit_status = atoi(value);
-        return;
+int var_is_set(int slot) {
+    const Var* var = &vars[slot];
+    if (var->special == '1') return var->position <= params.count;
+    if (var->special == '!') return background_pid != 0;
+    return var->special || var->has_text || var->has_number;
+}
+
+// Exported variables are kept in environ, so children inherit it as is
+void var_export(int slot) {
+    Var* var = &vars[slot];
+    if (var->special) return;
+    var->exported = 1;
+    if (var_is_set(slot)) put_env(var->name, var_get(slot));
+}
+
+// Variables naming variables are followed this far, as in other shells
+#define MAX_NAME_CHAIN 1024
+
+static int name_chain = 0;
+
+// A value used in arithmetic: a decimal number, or else a number in any
+// base or the name of another variable, read by the expression parser.
+// Anything else counts for its leading decimal digits.
+static int64_t text_value(const char* text, int* cacheable) {
+    if (cacheable) *cacheable = 1;
+    const char* p = text;
+    while (*p == ' ' || *p == '\t' || *p == '\n') p++;
+    if (*p == '-' || *p == '+') p++;
+    char* end;
+    int64_t value = strtoll(text, &end, 10);
+    while (*end == ' ' || *end == '\t' || *end == '\n') end++;
+    // 010 is octal, so only a lone 0 may start with one
+    if (!*end && end != text && (*p != '0' || !isdigit((unsigned char)p[1]))) return value;
+
+    const char* error;
+    ArithNode* node = arith_parse(text, &error);
+    if (node && node->kind == ARITH_NUM) {
+        value = node->value;
     }
-    else if (strcmp(name, "#") == 0) {
-        arg_count = atoi(value);
-        return;
+    else if (node && node->kind == ARITH_VAR && name_chain < MAX_NAME_CHAIN) {
+        if (cacheable) *cacheable = 0;
+        name_chain++;
+        value = var_get_int(var_slot(node->name));
+        name_chain--;
+    }
+    arith_free(node);
+    return value;
+}
+
+int64_t var_get_int(int slot) {
+    Var* var = &vars[slot];
+    switch (var->special) {
+    case '?': return exit_status;
+    case '#': return params.count;
+    case '$': return process_id;
+    case '!': return background_pid;
+    case 0: break;
+    default: return text_value(special_value(var->special, var->position), NULL);
+    }
+
+    if (!var->has_number) {
+        if (!var->has_text) return 0;
+        int cacheable;
+        int64_t number = text_value(var->value, &cacheable);
+        // A name's value follows the other variable, so it is read each time
+        if (!cacheable) return number;
+        var->number = number;
+        var->has_number = 1;
     }
-    else if (strcmp(name, "*") == 0 || strcmp(name, "@") == 0) {
-        strncpy(arg_list, value, sizeof(arg_list) - 1);
-        arg_list[sizeof(arg_list) - 1] = '\0';
+    return var->number;
+}
+
+// Just a decimal integer, with no blanks or leading zeros, that fits in
+// 64 bits, so arithmetic reads it the same way test does
+static int text_is_int(const char* text) {
+    const char* p = text + (*text == '-' || *text == '+');
+    if (!isdigit((unsigned char)*p) || (*p == '0' && p[1])) return 0;
+    while (isdigit((unsigned char)*p)) p++;
+    if (*p) return 0;
+    errno = 0;
+    strtoll(text, NULL, 10);
+    return errno != ERANGE;
+}
+
+int var_is_int(int slot) {
+    const Var* var = &vars[slot];
+    switch (var->special) {
+    case '?': case '#': case '$': return 1;
+    case '!': return background_pid != 0;
+    case 0: break;
+    default: return text_is_int(special_value(var->special, var->position));
+    }
+    if (!var->has_text) return var->has_number;
+    return text_is_int(var->value);
+}
+
+// The text form is dropped, not rewritten, so counters never touch text
+void var_set_int(int slot, int64_t value) {
+    Var* var = &vars[slot];
+    if (var->special) {
+        char buffer[32];
+        sprintf(buffer, "%" PRId64, value);
+        set_special(var->special, buffer);
         return;
     }
 
-    for (int i = 0; i < var_count; i++) {
-        if (strcmp(vars[i].name, name) == 0) {
-            strncpy(vars[i].value, value, sizeof(vars[i].value) - 1);
-            vars[i].value[sizeof(vars[i].value) - 1] = '\0';
-            return;
-        }
+    var->number = value;
+    var->has_number = 1;
+    var->has_text = 0;
+    if (var->exported || slot == path_slot) value_changed(slot);
+}
+
+const char* get_var(const char* name) {
+    int slot = var_find(name);
+    if (slot < 0) {
+        // Special variables exist even before anything interned them
+        if (name[0] && !name[1] && strchr(SPECIAL_NAMES, name[0])) return special_value(name[0], 0);
+        if (positional_name(name) > 0) return special_value('1', positional_name(name));
+        return "";
     }
+    return var_get(slot);
+}
+
+void set_var(const char* name, const char* value) {
+    var_set(var_slot(name), value);
+}
 
-    if (var_count < MAX_VARS) {
-        strncpy(vars[var_count].name, name, sizeof(vars[var_count].name) - 1);
-        vars[var_count].name[sizeof(vars[var_count].name) - 1] = '\0';
-        strncpy(vars[var_count].value, value, sizeof(vars[var_count].value) - 1);
-        vars[var_count].value[sizeof(vars[var_count].value) - 1] = '\0';
-        var_count++;
+int64_t get_var_int(const char* name) {
+    int slot = var_find(name);
+    return slot >= 0 ? var_get_int(slot) : strtoll(get_var(name), NULL, 10);
+}
+
+void set_var_int(const char* name, int64_t value) {
+    var_set_int(var_slot(name), value);
+}
+
+// Import the process environment as exported variables
+void import_environment() {
+    for (char** entry = environ; *entry; entry++) {
+        const char* eq = strchr(*entry, '=');
+        if (!eq || eq == *entry) continue;
+        char* name = xstrndup(*entry, eq - *entry);
+        int slot = var_slot(name);
+        Var* var = &vars[slot];
+        if (!var->special) {
+            var_set(slot, eq + 1);
+            var->exported = 1;
+        }
+        free(name);
     }
 }
 
 void init_special_vars() {
     exit_status = 0;
-    process_id = 1234;
-    arg_count = 0;
-    strcpy(arg_list, "");
+#ifdef _WIN32
+    process_id = _getpid();
+#else
+    process_id = (int)getpid();
+#endif
 }
 
-int get_exit_status() {
-    return exit_status;
+// $0 and the script's own $1..$N; the strings must outlive the script
+void set_script_args(const char* name, int count, char** values) {
+    script_name = name;
+    params.values = values;
+    params.count = count;
 }
 
-void update_exit_status(int status) {
-    exit_status = status;
+void set_background_pid(int pid) {
+    background_pid = pid;
 }
 
-void replace_vars(char* line) {
-    char result[MAX_LINE] = "";
-    char* src = line;
-    char* dest = result;
-
-    while (*src) {
-        if (*src == '$') {
-            src++; // skip $
-            if (*src == '{') {
-                // Handle ${var} syntax
-                src++; // skip {
-                char var_name[32];
-                int i = 0;
-                while (*src && *src != '}') {
-                    if (i < 31) var_name[i++] = *src;
-                    src++;
-                }
-                var_name[i] = '\0';
-                if (*src) src++; // skip }
-
-                const char* value = get_var(var_name);
-                strcat(result, value);
-                dest = result + strlen(result);
-            }
-            else {
-                // Handle $var syntax
-                char var_name[32];
-                int i = 0;
-
-                // Check for special variables
-                if (*src == '?' || *src == '$' || *src == '#' || *src == '*' || *src == '@') {
-                    var_name[0] = *src;
-                    var_name[1] = '\0';
-                    src++;
-                }
-                else {
-                    // Handle regular variable names
-                    while (*src && ((unsigned char)*src == '_' ||
-                        ((unsigned char)*src >= 'a' && (unsigned char)*src <= 'z') ||
-                        ((unsigned char)*src >= 'A' && (unsigned char)*src <= 'Z') ||
-                        ((unsigned char)*src >= '0' && (unsigned char)*src <= '9'))) {
-                        if (i < 31) var_name[i++] = *src;
-                        src++;
-                    }
-                    var_name[i] = '\0';
-                }
-
-                if (strlen(var_name) > 0) {
-                    const char* value = get_var(var_name);
-                    strcat(result, value);
-                    dest = result + strlen(result);
-                }
-                else {
-                    *dest++ = '$';
-                }
-            }
-        }
-        else {
-            *dest++ = *src++;
-        }
+// set -- args: copy the arguments, since the words they came from are
+// dropped once the command is done
+void params_set(int count, char** values) {
+    int depth = nscopes;
+    if (depth >= stores_cap) {
+        int old_cap = stores_cap;
+        stores_cap = depth + 8;
+        stores = xrealloc(stores, stores_cap * sizeof(ParamStore));
+        memset(stores + old_cap, 0, (stores_cap - old_cap) * sizeof(ParamStore));
+    }
+    ParamStore* store = &stores[depth];
+
+    size_t total = 0;
+    for (int i = 0; i < count; i++) total += strlen(values[i]) + 1;
+    if (total > store->text_cap) {
+        free(store->text);
+        store->text_cap = total;
+        store->text = xmalloc(total);
+    }
+    if (count > store->items_cap) {
+        free(store->items);
+        store->items_cap = count;
+        store->items = xmalloc(count * sizeof(char*));
     }
-    *dest = '\0';
-    strcpy(line, result);
+
+    char* dest = store->text;
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(values[i]) + 1;
+        memcpy(dest, values[i], len);
+        store->items[i] = dest;
+        dest += len;
+    }
+    params.values = store->items;
+    params.count = count;
 }
 
-void replace_arithmetic_vars(const char* input, char* output) {
-    char work_expr[MAX_LINE];
-    strcpy(work_expr, input);
+// Drop the first n parameters; returns 0 when there are fewer than n
+int params_shift(int n) {
+    if (n > params.count) return 0;
+    params.values += n;
+    params.count -= n;
+    return 1;
+}
 
-    char result[MAX_LINE] = "";
-    char* src = work_expr;
-    char* dest = result;
+Params params_enter(int count, char** values) {
+    Params caller = params;
+    params.values = values;
+    params.count = count;
+    return caller;
+}
 
-    while (*src) {
-        // Skip spaces
-        while (*src == ' ') {
-            *dest++ = *src++;
-        }
+void params_leave(Params caller) {
+    params = caller;
+}
+
+Params params_current(void) {
+    return params;
+}
+
+void scope_push(void) {
+    if (nscopes == scopes_cap) {
+        scopes_cap = scopes_cap ? scopes_cap * 2 : 16;
+        scopes = xrealloc(scopes, scopes_cap * sizeof(int));
+    }
+    scopes[nscopes++] = nsaved;
+}
 
-        if (!*src) break;
-
-        unsigned char uc = (unsigned char)*src;
-
-        // Check if this is a variable name
-        if ((uc == '_' ||
-            (uc >= 'a' && uc <= 'z') ||
-            (uc >= 'A' && uc <= 'Z')) &&
-            (src == work_expr || !((unsigned char)*(src - 1) >= '0' && (unsigned char)*(src - 1) <= '9')) &&
-            (src == work_expr || *(src - 1) != '$')) {
-
-            char var_name[32];
-            int i = 0;
-
-            // Extract the full variable name
-            while (*src && ((unsigned char)*src == '_' ||
-                ((unsigned char)*src >= 'a' && (unsigned char)*src <= 'z') ||
-                ((unsigned char)*src >= 'A' && (unsigned char)*src <= 'Z') ||
-                ((unsigned char)*src >= '0' && (unsigned char)*src <= '9'))) {
-                if (i < 31) var_name[i++] = *src;
-                src++;
-            }
-            var_name[i] = '\0';
-
-            // Check if this is a known variable
-            const char* value = get_var(var_name);
-            if (value && strlen(value) > 0) {
-                strcat(result, value);
-                dest = result + strlen(result);
-            }
-            else {
-                strcat(result, "0");
-                dest = result + strlen(result);
-            }
+// Put back every variable the scope made local, newest first
+void scope_pop(void) {
+    int start = scopes[--nscopes];
+    while (nsaved > start) {
+        SavedVar* entry = &saved_vars[--nsaved];
+        Var* var = &vars[entry->slot];
+        int local_exported = var->exported;
+        free(entry->spare);
+        entry->spare = var->value;
+        entry->spare_cap = var->cap;
+        var->value = entry->saved.value;
+        var->len = entry->saved.len;
+        var->cap = entry->saved.cap;
+        var->has_text = entry->saved.has_text;
+        var->has_number = entry->saved.has_number;
+        var->number = entry->saved.number;
+        var->exported = entry->saved.exported;
+
+        if (var->exported) {
+            put_env(var->name, var_get(entry->slot));
         }
-        else {
-            *dest++ = *src++;
+        else if (local_exported) {
+#ifdef _WIN32
+            _putenv_s(var->name, "");
+#else
+            unsetenv(var->name);
+#endif
         }
+        if (entry->slot == path_slot) path_cache_clear();
+    }
+}
+
+int scope_depth(void) {
+    return nscopes;
+}
+
+// Save the caller's value and start the variable over, unset, for this
+// scope. Making a variable local twice in one scope keeps the first save.
+// An exported variable stays exported: programs started in the scope see
+// the local value once it is set, and the caller's until then, as in bash.
+int var_make_local(int slot) {
+    if (nscopes == 0) return 0;
+    Var* var = &vars[slot];
+    if (var->special) return 1;
+    for (int i = scopes[nscopes - 1]; i < nsaved; i++) {
+        if (saved_vars[i].slot == slot) return 1;
     }
-    *dest = '\0';
-    strcpy(output, result);
-}
\ No newline at end of file
+
+    if (nsaved == saved_cap) {
+        int old_cap = saved_cap;
+        saved_cap = saved_cap ? saved_cap * 2 : 16;
+        saved_vars = xrealloc(saved_vars, saved_cap * sizeof(SavedVar));
+        memset(saved_vars + old_cap, 0, (saved_cap - old_cap) * sizeof(SavedVar));
+    }
+    SavedVar* entry = &saved_vars[nsaved++];
+    entry->slot = slot;
+    entry->saved = *var;
+    var->value = entry->spare;
+    var->cap = entry->spare_cap;
+    var->len = 0;
+    entry->spare = NULL;
+    entry->spare_cap = 0;
+    var->has_text = 0;
+    var->has_number = 0;
+    return 1;
+}
+
+int get_exit_status() {
+    return exit_status;
+}
+
+void update_exit_status(int status) {
+    exit_status = status;
+}
@@ -1,11 +1,54 @@
 #ifndef ENV_H
 #define ENV_H
 
+#include <stdint.h>
+
 void set_var(const char* name, const char* value);
 const char* get_var(const char* name);
-void replace_vars(char* line);
-void replace_arithmetic_vars(const char* input, char* output);
+void set_var_int(const char* name, int64_t value);
+int64_t get_var_int(const char* name);
 void init_special_vars();
+void import_environment();
 int get_exit_status();
+void update_exit_status(int status);
+
+// Slot handles: resolve a name once with var_slot(), then read and write
+// through the handle without hashing. Handles stay valid for the whole run.
+int var_slot(const char* name);
+int var_find(const char* name);
+const char* var_name(int slot);
+const char* var_get(int slot);
+void var_set(int slot, const char* value);
+int64_t var_get_int(int slot);
+// Whether var_get_int gives the whole value, not just a leading number
+int var_is_int(int slot);
+void var_set_int(int slot, int64_t value);
+void var_unset(int slot);
+int var_is_set(int slot);
+void var_export(int slot);
+
+// Positional parameters $1..$N. A function call installs its arguments and
+// puts the caller's back when it returns; the strings are borrowed.
+typedef struct {
+    char** values;
+    int count;
+} Params;
+
+Params params_enter(int count, char** values);
+void params_leave(Params caller);
+Params params_current(void);
+void params_set(int count, char** values);
+int params_shift(int n);
+
+void set_script_args(const char* name, int count, char** values);
+void set_background_pid(int pid);       // $!
+
+// Function scopes for local variables
+void scope_push(void);
+void scope_pop(void);
+int scope_depth(void);
+// Give a variable a fresh, unset value until the current scope ends;
+// returns 0 outside of a function
+int var_make_local(int slot);
 
-#endif
\ No newline at end of file
+#endif
@@ -1,239 +1,808 @@
+#define _POSIX_C_SOURCE 200809L
 #include "executor.h"
 #include "env.h"
+#include "spawn.h"
+#include "redirect.h"
+#include "builtins.h"
+#include "function.h"
+#include "input.h"
+#include "job.h"
+#include "parallel.h"
+#include "output.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #ifdef _WIN32
 #include <direct.h>
 #else
 #include <unistd.h>
-#include <sys/wait.h>
+#include <fcntl.h>
 #endif
 
-#define MAX_LINE 256
-
-// Function to update exit status after command execution
-extern void update_exit_status(int status);
-
-// Check if command is a built-in command
-static int is_builtin_cmd(const char* cmd) {
-    if (strncmp(cmd, "echo", 4) == 0 && (cmd[4] == ' ' || cmd[4] == '\0')) return 1;
-    if (strncmp(cmd, "cd", 2) == 0 && (cmd[2] == ' ' || cmd[2] == '\0')) return 1;
-    if (strncmp(cmd, "pwd", 3) == 0 && (cmd[3] == ' ' || cmd[3] == '\0')) return 1;
-    if (strncmp(cmd, "exit", 4) == 0 && (cmd[4] == ' ' || cmd[4] == '\0')) return 1;
-    if (strncmp(cmd, "set", 3) == 0 && (cmd[3] == ' ' || cmd[3] == '\0')) return 1;
-    if (strncmp(cmd, "unset", 5) == 0 && (cmd[5] == ' ' || cmd[5] == '\0')) return 1;
-    if (strncmp(cmd, "export", 6) == 0 && (cmd[6] == ' ' || cmd[6] == '\0')) return 1;
-    if (strncmp(cmd, "read", 4) == 0 && (cmd[4] == ' ' || cmd[4] == '\0')) return 1;
-    if (strncmp(cmd, "[", 1) == 0) return 1;
-    return 0;
+static int option_pipefail = 0;
+
+// NAME=value strings for a command's prefix assignments
+static char** build_extra_env(const Command* cmd) {
+    if (cmd->nassigns == 0) return NULL;
+    char** extra_env = xmalloc(cmd->nassigns * sizeof(char*));
+    for (int i = 0; i < cmd->nassigns; i++) {
+        StrBuf entry;
+        sb_init(&entry);
+        sb_append(&entry, var_name(cmd->assign_slots[i]));
+        sb_appendc(&entry, '=');
+        sb_append(&entry, cmd->assign_values[i]);
+        extra_env[i] = sb_release(&entry);
+    }
+    return extra_env;
 }
 
-// Test command implementation
-static int test_command(const char* cmd) {
-    char temp[MAX_LINE];
-    strcpy(temp, cmd);
+static void free_extra_env(char** extra_env, int count) {
+    for (int i = 0; i < count; i++) free(extra_env[i]);
+    free(extra_env);
+}
+
+static int is_name(const char* text, size_t len) {
+    if (len == 0 || isdigit((unsigned char)text[0])) return 0;
+    for (size_t i = 0; i < len; i++) {
+        if (!isalnum((unsigned char)text[i]) && text[i] != '_') return 0;
+    }
+    return 1;
+}
 
-    // Remove brackets
-    char* expr = temp;
-    if (*expr == '[') expr++;
+// A line for read, with backslash escapes already removed. escaped marks
+// the characters that were quoted by one, which never separate fields;
+// it stays empty until a backslash turns up.
+typedef struct {
+    StrBuf text;
+    StrBuf escaped;
+} ReadLine;
 
-    // Trim spaces
-    while (*expr == ' ') expr++;
+static void line_push(ReadLine* line, char c, int escaped) {
+    if (escaped && !line->escaped.data) {
+        sb_init(&line->escaped);
+        for (size_t i = 0; i < line->text.len; i++) sb_appendc(&line->escaped, 0);
+    }
+    sb_appendc(&line->text, c);
+    if (line->escaped.data) sb_appendc(&line->escaped, (char)escaped);
+}
 
-    // Remove trailing bracket and spaces
-    char* end = expr + strlen(expr) - 1;
-    while (end > expr && (*end == ' ' || *end == ']')) end--;
-    *(end + 1) = '\0';
+// Read up to delim. Without raw, a backslash quotes the next character
+// and a backslash before the delimiter continues the line. Returns 1 when
+// the delimiter was found, 0 at end of input.
+static int read_delimited(int fd, int delim, int raw, ReadLine* line) {
+    if (raw) return input_line(fd, delim, &line->text);
 
-    // Parse expression: value1 operator value2
-    char* tokens[3];
-    int token_count = 0;
-    char* token = strtok(expr, " ");
-    while (token && token_count < 3) {
-        tokens[token_count++] = token;
-        token = strtok(NULL, " ");
+    StrBuf chunk;
+    sb_init(&chunk);
+    int found;
+    for (;;) {
+        found = input_line(fd, delim, &chunk);
+        int continued = 0;
+        for (size_t i = 0; i < chunk.len; i++) {
+            if (chunk.data[i] != '\\') {
+                line_push(line, chunk.data[i], 0);
+            }
+            else if (i + 1 < chunk.len) {
+                line_push(line, chunk.data[++i], 1);
+            }
+            else {
+                continued = found;
+            }
+        }
+        if (!continued) break;
+        sb_clear(&chunk);
     }
+    sb_free(&chunk);
+    return found;
+}
 
-    if (token_count != 3) return 0;
+// read -n: at most count characters, stopping early at delim
+static int read_count(int fd, int delim, int raw, long count, ReadLine* line) {
+    for (long n = 0; n < count; n++) {
+        int c = input_getc(fd);
+        if (c < 0) return 0;
+        if (c == delim) return 1;
+        if (c == '\\' && !raw) {
+            c = input_getc(fd);
+            if (c < 0) return 0;
+            if (c == delim) {
+                n--;
+                continue;
+            }
+            line_push(line, (char)c, 1);
+        }
+        else {
+            line_push(line, (char)c, 0);
+        }
+    }
+    return 1;
+}
 
-    // Process variables in values
-    char processed_val1[MAX_LINE], processed_val2[MAX_LINE];
-    strcpy(processed_val1, tokens[0]);
-    strcpy(processed_val2, tokens[2]);
-    replace_vars(processed_val1);
-    replace_vars(processed_val2);
+// Split a line on IFS into names the way read does: IFS whitespace around
+// fields is dropped, other IFS characters end one field each, and the
+// last name takes the rest of the line
+static void read_assign(ReadLine* line, char** names, int count) {
+    int slot = var_find("IFS");
+    const char* ifs = slot >= 0 && var_is_set(slot) ? var_get(slot) : " \t\n";
+    const char* text = line->text.data;
+    size_t len = line->text.len;
 
-    // Convert to integers
-    int num1 = atoi(processed_val1);
-    int num2 = atoi(processed_val2);
+#define IS_SEP(i) ((!line->escaped.data || !line->escaped.data[i]) && text[i] && strchr(ifs, text[i]))
+#define IS_BLANK(i) (IS_SEP(i) && (text[i] == ' ' || text[i] == '\t' || text[i] == '\n'))
 
-    // Compare based on operator
-    if (strcmp(tokens[1], "-eq") == 0) {
-        return num1 == num2;
+    size_t i = 0;
+    while (i < len && IS_BLANK(i)) i++;
+    for (int n = 0; n < count; n++) {
+        size_t start = i;
+        while (i < len && !IS_SEP(i)) i++;
+        size_t end = i;
+        while (i < len && IS_BLANK(i)) i++;
+        if (i < len && IS_SEP(i)) {
+            i++;
+            while (i < len && IS_BLANK(i)) i++;
+        }
+        if (n == count - 1 && i < len) {
+            // More fields than names: the last one keeps them, separators
+            // and all, less trailing IFS whitespace
+            end = len;
+            while (end > start && IS_BLANK(end - 1)) end--;
+        }
+        char* value = xstrndup(text + start, end - start);
+        set_var(names[n], value);
+        free(value);
     }
-    else if (strcmp(tokens[1], "-ne") == 0) {
-        return num1 != num2;
+
+#undef IS_SEP
+#undef IS_BLANK
+}
+
+// read [-r] [-d delim] [-n count] [-u fd] [name...]
+static int read_builtin(int argc, char** argv) {
+    int raw = 0;
+    int delim = '\n';
+    long count = -1;
+    int fd = 0;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (const char* opt = argv[i] + 1; *opt; opt++) {
+            if (*opt == 'r') {
+                raw = 1;
+                continue;
+            }
+            if (!strchr("dnua", *opt)) {
+                fprintf(stderr, "myshell: read: -%c: invalid option\n", *opt);
+                return 2;
+            }
+            // The value is the rest of this argument or the next one
+            const char* value = opt[1] ? opt + 1 : (i + 1 < argc ? argv[++i] : NULL);
+            if (!value) {
+                fprintf(stderr, "myshell: read: -%c: option requires an argument\n", *opt);
+                return 2;
+            }
+            if (*opt == 'd') {
+                delim = (unsigned char)value[0];
+            }
+            else if (*opt == 'a') {
+                fprintf(stderr, "myshell: read: -a: arrays are not supported\n");
+                return 2;
+            }
+            else {
+                char* end;
+                long number = strtol(value, &end, 10);
+                if (end == value || *end || number < 0 || number > INT_MAX) {
+                    fprintf(stderr, "myshell: read: %s: invalid %s\n", value,
+                        *opt == 'n' ? "number" : "file descriptor");
+                    return 2;
+                }
+                if (*opt == 'n') count = number;
+                else fd = (int)number;
+            }
+            break;
+        }
     }
-    else if (strcmp(tokens[1], "-gt") == 0) {
-        return num1 > num2;
+    for (int n = i; n < argc; n++) {
+        if (!is_name(argv[n], strlen(argv[n]))) {
+            fprintf(stderr, "myshell: read: `%s': not a valid identifier\n", argv[n]);
+            return 1;
+        }
     }
-    else if (strcmp(tokens[1], "-lt") == 0) {
-        return num1 < num2;
+
+    ReadLine line;
+    sb_init(&line.text);
+    line.escaped.data = NULL;
+    int found = count >= 0 ? read_count(fd, delim, raw, count, &line) :
+        read_delimited(fd, delim, raw, &line);
+    // Lines from Windows files end in \r\n
+    if (delim == '\n' && line.text.len > 0 && line.text.data[line.text.len - 1] == '\r' &&
+        !(line.escaped.data && line.escaped.data[line.text.len - 1])) {
+        line.text.data[--line.text.len] = '\0';
     }
-    else if (strcmp(tokens[1], "-ge") == 0) {
-        return num1 >= num2;
+
+    if (i == argc) {
+        // REPLY gets the line as it is, without IFS trimming
+        set_var("REPLY", line.text.data);
     }
-    else if (strcmp(tokens[1], "-le") == 0) {
-        return num1 <= num2;
+    else {
+        read_assign(&line, argv + i, argc - i);
     }
+    sb_free(&line.text);
+    sb_free(&line.escaped);
+    return found ? 0 : 1;
+}
 
+// set [-o|+o option]...
+// set [-o option|+o option]... [--] [arg...]; any arguments replace the
+// positional parameters
+static int set_command(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            params_set(argc - i - 1, argv + i + 1);
+            return 0;
+        }
+        if (argv[i][0] != '-' && argv[i][0] != '+') {
+            params_set(argc - i, argv + i);
+            return 0;
+        }
+        if ((strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "+o") == 0) && i + 1 < argc) {
+            int on = argv[i][0] == '-';
+            const char* option = argv[++i];
+            if (strcmp(option, "pipefail") == 0) {
+                option_pipefail = on;
+            }
+            else {
+                fprintf(stderr, "myshell: set: %s: invalid option name\n", option);
+                return 1;
+            }
+        }
+        // Other options are accepted and ignored
+    }
     return 0;
 }
 
-// Execute built-in commands
-static void exec_builtin_cmd(const char* cmd) {
-    if (strncmp(cmd, "echo", 4) == 0) {
-        const char* text = cmd + 4;
-        while (*text == ' ') text++;
-
-        char processed_text[MAX_LINE];
-        strcpy(processed_text, text);
-        replace_vars(processed_text);
+// shift [n]
+static int shift_command(int argc, char** argv) {
+    long count = 1;
+    if (argc > 1) {
+        char* end;
+        count = strtol(argv[1], &end, 10);
+        if (end == argv[1] || *end || count < 0) {
+            fprintf(stderr, "myshell: shift: %s: numeric argument required\n", argv[1]);
+            return 1;
+        }
+    }
+    return params_shift((int)count) ? 0 : 1;
+}
 
-        int len = strlen(processed_text);
-        if (len >= 2 &&
-            ((processed_text[0] == '"' && processed_text[len - 1] == '"') ||
-                (processed_text[0] == '\'' && processed_text[len - 1] == '\''))) {
-            processed_text[len - 1] = '\0';
-            printf("%s\n", processed_text + 1);
+// wait [pid|%job]...; with no arguments waits for every job and returns 0
+static int wait_command(int argc, char** argv) {
+    if (argc == 1) {
+        job_wait_all();
+        return 0;
+    }
+    int status = 0;
+    for (int i = 1; i < argc; i++) {
+        int job = job_find(argv[i]);
+        if (job >= 0) {
+            status = job_wait(job);
+        }
+        else if (argv[i][0] == '%') {
+            fprintf(stderr, "myshell: wait: %s: no such job\n", argv[i]);
+            status = 127;
+        }
+        else if (argv[i][0] && strspn(argv[i], "0123456789") == strlen(argv[i])) {
+            fprintf(stderr, "myshell: wait: pid %s is not a child of this shell\n", argv[i]);
+            status = 127;
         }
         else {
-            printf("%s\n", processed_text);
+            fprintf(stderr, "myshell: wait: `%s': not a pid or valid job spec\n", argv[i]);
+            status = 1;
         }
-        update_exit_status(0);
     }
-    else if (strncmp(cmd, "[", 1) == 0) {
-        int result = test_command(cmd);
-        update_exit_status(result ? 0 : 1);
+    return status;
+}
+
+// hash [-r] [name...]
+static int hash_command(int argc, char** argv) {
+    int status = 0;
+    int i = 1;
+    if (i < argc && strcmp(argv[i], "-r") == 0) {
+        path_cache_clear();
+        i++;
     }
-    else if (strncmp(cmd, "pwd", 3) == 0) {
-        char buffer[MAX_LINE];
-#ifdef _WIN32
-        if (_getcwd(buffer, sizeof(buffer)) != NULL) {
-#else
-        if (getcwd(buffer, sizeof(buffer)) != NULL) {
-#endif
-            printf("%s\n", buffer);
-            update_exit_status(0);
-        }
-        else {
-            perror("pwd");
-            update_exit_status(1);
+    else if (argc == 1) {
+        path_cache_print();
+    }
+    for (; i < argc; i++) {
+        if (!path_lookup(argv[i])) {
+            fprintf(stderr, "myshell: hash: %s: not found\n", argv[i]);
+            status = 1;
         }
+    }
+    return status;
+}
+
+// export NAME[=value]...
+static int export_command(int argc, char** argv) {
+    int status = 0;
+    for (int i = 1; i < argc; i++) {
+        const char* eq = strchr(argv[i], '=');
+        size_t len = eq ? (size_t)(eq - argv[i]) : strlen(argv[i]);
+        if (!is_name(argv[i], len)) {
+            fprintf(stderr, "myshell: export: `%s': not a valid identifier\n", argv[i]);
+            status = 1;
+            continue;
         }
-    else if (strncmp(cmd, "exit", 4) == 0) {
-        const char* code = cmd + 4;
-        while (*code == ' ') code++;
-        int exit_code = 0;
-        if (strlen(code) > 0) {
-            exit_code = atoi(code);
+        char* name = xstrndup(argv[i], len);
+        int slot = var_slot(name);
+        if (eq) var_set(slot, eq + 1);
+        var_export(slot);
+        free(name);
+    }
+    return status;
+}
+
+// unset [-f|-v] NAME...; without an option a name that is not a set
+// variable unsets the function of that name
+static int unset_command(int argc, char** argv) {
+    int mode = 0;
+    int i = 1;
+    for (; i < argc && (strcmp(argv[i], "-f") == 0 || strcmp(argv[i], "-v") == 0); i++) {
+        mode = argv[i][1];
+    }
+    for (; i < argc; i++) {
+        int slot = var_find(argv[i]);
+        if (mode != 'f' && slot >= 0 && var_is_set(slot)) {
+            var_unset(slot);
+            continue;
         }
-        exit(exit_code);
+        if (mode == 'v') continue;
+        int fn = function_find(argv[i]);
+        if (fn >= 0) function_unset(fn);
     }
-    else if (strncmp(cmd, "read", 4) == 0) {
-        const char* var = cmd + 4;
-        while (*var == ' ') var++;
+    return 0;
+}
 
-        if (strlen(var) > 0) {
-            char input[256];
-            if (fgets(input, sizeof(input), stdin)) {
-                input[strcspn(input, "\r\n")] = 0;
-                extern void set_var(const char*, const char*);
-                set_var(var, input);
-                update_exit_status(0);
-            }
-            else {
-                update_exit_status(1);
-            }
+// local NAME[=VALUE]...
+static int local_command(int argc, char** argv) {
+    if (!scope_depth()) {
+        fprintf(stderr, "myshell: local: can only be used in a function\n");
+        return 1;
+    }
+    int status = 0;
+    for (int i = 1; i < argc; i++) {
+        const char* eq = strchr(argv[i], '=');
+        size_t len = eq ? (size_t)(eq - argv[i]) : strlen(argv[i]);
+        if (!is_name(argv[i], len)) {
+            fprintf(stderr, "myshell: local: `%s': not a valid identifier\n", argv[i]);
+            status = 1;
+            continue;
         }
+        // Names are short; copying them to the stack keeps calls allocation-free
+        char small[64];
+        char* name = len < sizeof(small) ? small : xmalloc(len + 1);
+        memcpy(name, argv[i], len);
+        name[len] = '\0';
+        int slot = var_slot(name);
+        var_make_local(slot);
+        if (eq) var_set(slot, eq + 1);
+        if (name != small) free(name);
     }
-    else if (strncmp(cmd, "cd", 2) == 0) {
-        const char* path = cmd + 2;
-        while (*path == ' ') path++;
-        if (strlen(path) == 0) path = get_var("HOME");
+    return status;
+}
+
+// return in a function body compiles to a jump out of the function
+static int return_command(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    fprintf(stderr, "myshell: return: can only `return' from a function\n");
+    return 2;
+}
+
+// The arguments, the spaces between them and the newline go out as one write
+static int echo_command(int argc, char** argv) {
+    const char* stack_parts[64];
+    size_t stack_lens[64];
+    int count = argc > 1 ? 2 * (argc - 1) : 1;
+    const char** parts = count <= 64 ? stack_parts : xmalloc(count * sizeof(char*));
+    size_t* lens = count <= 64 ? stack_lens : xmalloc(count * sizeof(size_t));
 
+    int n = 0;
+    for (int i = 1; i < argc; i++) {
+        parts[n] = argv[i];
+        lens[n++] = strlen(argv[i]);
+        parts[n] = i + 1 < argc ? " " : "\n";
+        lens[n++] = 1;
+    }
+    if (n == 0) {
+        parts[n] = "\n";
+        lens[n++] = 1;
+    }
+    out_writev(parts, lens, n);
+
+    if (parts != stack_parts) {
+        free(parts);
+        free(lens);
+    }
+    return 0;
+}
+
+static int pwd_command(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    // Grow the buffer until the whole path fits
+    size_t size = 256;
+    char* buffer = NULL;
+    for (;;) {
+        buffer = xrealloc(buffer, size);
 #ifdef _WIN32
-        int result = _chdir(path);
+        if (_getcwd(buffer, (int)size) != NULL) break;
 #else
-        int result = chdir(path);
+        if (getcwd(buffer, size) != NULL) break;
 #endif
-        if (result != 0) {
-            perror("cd");
-            update_exit_status(1);
+        if (errno != ERANGE) {
+            perror("pwd");
+            free(buffer);
+            return 1;
         }
-        else {
-            update_exit_status(0);
+        size *= 2;
+    }
+    out_str(buffer);
+    out_char('\n');
+    free(buffer);
+    return 0;
+}
+
+static int exit_command(int argc, char** argv) {
+    int exit_code = get_exit_status();
+    if (argc > 1) {
+        exit_code = atoi(argv[1]);
+    }
+    out_flush();
+    input_sync_all();
+    exit(exit_code);
+}
+
+// Inside a loop, break and continue compile to jumps. These only run when
+// there is no loop to leave or the count is unusable, so they just report.
+static int loop_control_command(int argc, char** argv) {
+    if (argc > 2) {
+        fprintf(stderr, "myshell: %s: too many arguments\n", argv[0]);
+        return 1;
+    }
+    if (argc > 1) {
+        char* end;
+        long count = strtol(argv[1], &end, 10);
+        if (end == argv[1] || *end) {
+            fprintf(stderr, "myshell: %s: %s: numeric argument required\n", argv[0], argv[1]);
+            return 1;
+        }
+        if (count < 1) {
+            fprintf(stderr, "myshell: %s: %s: loop count out of range\n", argv[0], argv[1]);
+            return 1;
         }
     }
-    else {
-        char buffer[MAX_LINE];
-        sprintf(buffer, "sh -c %s", cmd);
-        int result = system(buffer);
+    fprintf(stderr, "myshell: %s: only meaningful in a `for', `while', or `until' loop\n", argv[0]);
+    return 0;
+}
+
+
+static int cd_command(int argc, char** argv) {
+    const char* path = argc > 1 ? argv[1] : get_var("HOME");
 #ifdef _WIN32
-        update_exit_status(result == 0 ? 0 : 1);
+    int result = _chdir(path);
 #else
-        update_exit_status(WEXITSTATUS(result));
+    int result = chdir(path);
 #endif
+    if (result != 0) {
+        perror("cd");
+        return 1;
     }
+    return 0;
+}
+
+typedef struct {
+    const char* name;
+    BuiltinFn fn;
+    int pure;               // only writes output; see builtin_pure
+    int special;            // POSIX special builtin: prefix assignments stay
+} Builtin;
+
+// Builtins known when the shell is compiled. Their ids are their indexes,
+// and core_slots below is a perfect hash table for exactly these names:
+// core_hash gives every one of them a different slot. Adding a name means
+// choosing new multipliers and regenerating core_slots.
+static Builtin core_builtins[] = {
+    { "echo", echo_command, 1, 0 },
+    { "cd", cd_command, 0, 0 },
+    { "pwd", pwd_command, 1, 0 },
+    { "exit", exit_command, 0, 1 },
+    { "set", set_command, 0, 1 },
+    { "unset", unset_command, 0, 1 },
+    { "export", export_command, 0, 1 },
+    { "read", read_builtin, 0, 0 },
+    { "[", test_command, 1, 0 },
+    { "hash", hash_command, 0, 0 },
+    { "test", test_command, 1, 0 },
+    { "true", true_command, 1, 0 },
+    { "false", false_command, 1, 0 },
+    { "printf", printf_command, 1, 0 },
+    { "basename", basename_command, 1, 0 },
+    { "dirname", dirname_command, 1, 0 },
+    { "seq", seq_command, 1, 0 },
+    { "break", loop_control_command, 0, 1 },
+    { "continue", loop_control_command, 0, 1 },
+    { "local", local_command, 0, 1 },
+    { "return", return_command, 0, 1 },
+    { "shift", shift_command, 0, 1 },
+    { "wait", wait_command, 0, 0 },
+    { "parallel", parallel_command, 0, 0 },
+};
+
+#define CORE_BUILTINS (int)(sizeof(core_builtins) / sizeof(core_builtins[0]))
+#define CORE_SLOTS 64
+
+// Core builtin id + 1, or 0 for an unused slot
+static const signed char core_slots[CORE_SLOTS] = {
+    9, 20, 0, 16, 0, 0, 0, 0, 0, 0, 0, 13, 10, 0, 0, 0,
+    12, 2, 0, 3, 0, 1, 0, 0, 24, 0, 0, 0, 0, 4, 8, 7,
+    0, 0, 5, 0, 22, 0, 14, 18, 11, 0, 17, 0, 0, 0, 6, 0,
+    21, 0, 0, 0, 0, 0, 0, 23, 0, 0, 15, 0, 0, 0, 0, 19
+};
+
+static unsigned core_hash(const char* name, size_t len) {
+    unsigned first = (unsigned char)name[0];
+    unsigned last = (unsigned char)name[len - 1];
+    return (unsigned)(len + first * 5 + last * 40) & (CORE_SLOTS - 1);
+}
+
+// Builtins added at run time with builtin_register; ids follow the core ones
+static Builtin* extra_builtins = NULL;
+static int extra_count = 0;
+static int extra_cap = 0;
+static int* extra_table = NULL; // extra index + 1, or 0 for an empty bucket
+static size_t extra_table_size = 0;
+
+static void extra_insert(int index) {
+    size_t mask = extra_table_size - 1;
+    size_t i = hash_string(extra_builtins[index].name) & mask;
+    while (extra_table[i]) i = (i + 1) & mask;
+    extra_table[i] = index + 1;
+}
+
+static int find_extra(const char* name) {
+    if (!extra_table) return -1;
+    size_t mask = extra_table_size - 1;
+    for (size_t i = hash_string(name) & mask; extra_table[i]; i = (i + 1) & mask) {
+        int index = extra_table[i] - 1;
+        if (strcmp(extra_builtins[index].name, name) == 0) return CORE_BUILTINS + index;
     }
+    return -1;
+}
 
-// Function to handle command execution
-void exec_cmd(const char* cmd) {
-    // Check if it's a built-in command
-    if (is_builtin_cmd(cmd)) {
-        exec_builtin_cmd(cmd);
+// Map a command name to its builtin id, or -1 if it is not a builtin
+int builtin_lookup(const char* name) {
+    size_t len = strlen(name);
+    if (len > 0) {
+        int id = core_slots[core_hash(name, len)] - 1;
+        if (id >= 0 && strcmp(core_builtins[id].name, name) == 0) return id;
+    }
+    return find_extra(name);
+}
+
+static Builtin* builtin_get(int id) {
+    return id < CORE_BUILTINS ? &core_builtins[id] : &extra_builtins[id - CORE_BUILTINS];
+}
+
+int builtin_register(const char* name, BuiltinFn fn) {
+    int id = builtin_lookup(name);
+    if (id >= 0) {
+        // Nothing is known about the replacement
+        Builtin* builtin = builtin_get(id);
+        builtin->fn = fn;
+        builtin->pure = 0;
+        return id;
+    }
+
+    if (extra_count == extra_cap) {
+        extra_cap = extra_cap ? extra_cap * 2 : 8;
+        extra_builtins = xrealloc(extra_builtins, extra_cap * sizeof(Builtin));
+    }
+    if ((size_t)(extra_count + 1) * 2 > extra_table_size) {
+        free(extra_table);
+        extra_table_size = extra_table_size ? extra_table_size * 2 : 16;
+        extra_table = xcalloc(extra_table_size, sizeof(int));
+        for (int i = 0; i < extra_count; i++) extra_insert(i);
+    }
+    extra_builtins[extra_count].name = xstrdup(name);
+    extra_builtins[extra_count].fn = fn;
+    extra_builtins[extra_count].pure = 0;
+    extra_builtins[extra_count].special = 0;
+    extra_insert(extra_count++);
+    return CORE_BUILTINS + extra_count - 1;
+}
+
+int builtin_pure(int id) {
+    return builtin_get(id)->pure;
+}
+
+static void exec_builtin_cmd(int id, int argc, char** argv) {
+    update_exit_status(builtin_get(id)->fn(argc, argv));
+}
+
+// Prefix assignments whose old values fit on the stack
+#define MAX_SAVED_ASSIGNS 8
+
+static void run_cmd(const Command* cmd) {
+    if (cmd->argc > 0 && cmd->builtin < 0) {
+        // Prefix assignments go to the program's environment only
+        char** extra_env = build_extra_env(cmd);
+        update_exit_status(spawn_wait(cmd->argv, extra_env, cmd->nassigns));
+        free_extra_env(extra_env, cmd->nassigns);
         return;
     }
 
-    // Create a copy for processing
-    char work_cmd[MAX_LINE];
-    strcpy(work_cmd, cmd);
+    if (cmd->argc == 0) {
+        for (int i = 0; i < cmd->nassigns; i++) {
+            var_set(cmd->assign_slots[i], cmd->assign_values[i]);
+        }
+        update_exit_status(0);
+        return;
+    }
 
-    // Check for redirections and pipes
-    char* output_redir = strchr(work_cmd, '>');
-    char* input_redir = strchr(work_cmd, '<');
-    char* pipe_pos = strchr(work_cmd, '|');
+    if (cmd->nassigns == 0 || builtin_get(cmd->builtin)->special) {
+        for (int i = 0; i < cmd->nassigns; i++) {
+            var_set(cmd->assign_slots[i], cmd->assign_values[i]);
+        }
+        exec_builtin_cmd(cmd->builtin, cmd->argc, cmd->argv);
+        return;
+    }
 
-    // Handle redirections/pipes
-    if (output_redir || input_redir || pipe_pos) {
-        char buffer[MAX_LINE];
-#ifdef _WIN32
-        sprintf(buffer, "cmd /c %s", cmd);
-#else
-        sprintf(buffer, "%s", cmd);
-#endif
-        int result = system(buffer);
-#ifdef _WIN32
-        update_exit_status(result == 0 ? 0 : 1);
-#else
-        update_exit_status(WEXITSTATUS(result));
-#endif
+    // As for a program, IFS=: read ... only sets IFS for the one command
+    char* saved[MAX_SAVED_ASSIGNS];
+    char** old = cmd->nassigns <= MAX_SAVED_ASSIGNS ? saved : xmalloc(cmd->nassigns * sizeof(char*));
+    for (int i = 0; i < cmd->nassigns; i++) {
+        int slot = cmd->assign_slots[i];
+        old[i] = var_is_set(slot) ? xstrdup(var_get(slot)) : NULL;
+        var_set(slot, cmd->assign_values[i]);
+    }
+    exec_builtin_cmd(cmd->builtin, cmd->argc, cmd->argv);
+    // Last to first, so a name assigned twice gets its first value back
+    for (int i = cmd->nassigns - 1; i >= 0; i--) {
+        if (old[i]) var_set(cmd->assign_slots[i], old[i]);
+        else var_unset(cmd->assign_slots[i]);
+        free(old[i]);
+    }
+    if (old != saved) free(old);
+}
+
+// Function to handle command execution
+void exec_cmd(const Command* cmd) {
+    if (cmd->nredirs == 0) {
+        run_cmd(cmd);
         return;
     }
 
-    // Regular command execution
-    char buffer[MAX_LINE];
-#ifdef _WIN32
-    sprintf(buffer, "cmd /c %s", cmd);
-#else
-    sprintf(buffer, "%s", cmd);
-#endif
-    int result = system(buffer);
-#ifdef _WIN32
-    update_exit_status(result == 0 ? 0 : 1);
-#else
-    update_exit_status(WEXITSTATUS(result));
-#endif
-}
\ No newline at end of file
+    RedirUndo undo;
+    redir_undo_init(&undo);
+    if (redirect_apply(cmd->redirs, cmd->redir_targets, cmd->nredirs, &undo)) {
+        run_cmd(cmd);
+    }
+    else {
+        update_exit_status(1);
+    }
+    redirect_restore(&undo);
+    redir_undo_free(&undo);
+}
+
+// Start a command without waiting for it. Programs are spawned directly;
+// builtins run in a forked copy of the shell. Returns the child's pid, or
+// -1 with *status set when there is nothing to wait for.
+pid_t exec_cmd_async(const Command* cmd, int* status) {
+    if (cmd->argc > 0 && cmd->builtin < 0) {
+        RedirUndo undo;
+        redir_undo_init(&undo);
+        pid_t pid = -1;
+        *status = 1;
+        if (redirect_apply(cmd->redirs, cmd->redir_targets, cmd->nredirs, &undo)) {
+            char** extra_env = build_extra_env(cmd);
+            *status = spawn_start(cmd->argv, extra_env, cmd->nassigns, &pid);
+            free_extra_env(extra_env, cmd->nassigns);
+            if (*status != 0) pid = -1;
+        }
+        redirect_restore(&undo);
+        redir_undo_free(&undo);
+        return pid;
+    }
+
+    out_flush();
+    fflush(stderr);
+    input_sync_all();
+    pid_t pid = fork();
+    if (pid == 0) {
+        exec_cmd(cmd);
+        out_flush();
+        input_sync_all();
+        _exit(get_exit_status());
+    }
+    if (pid < 0) {
+        perror("fork");
+        *status = 1;
+    }
+    return pid;
+}
+
+void pipeline_init(Pipeline* pipeline) {
+    memset(pipeline, 0, sizeof(Pipeline));
+    pipeline->in_fd = -1;
+    redir_undo_init(&pipeline->undo);
+}
+
+// Wire fd 0 to the previous stage and fd 1 to a new pipe (unless this is
+// the last stage). The shell's own descriptors are saved in the pipeline.
+int pipeline_begin_stage(Pipeline* pipeline, int last) {
+    int fds[2];
+    if (!last) {
+        if (pipe(fds) < 0) {
+            perror("pipe");
+            return 0;
+        }
+        // Only the dup2'd copies may leak into children
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    }
+
+    out_flush();
+    if (pipeline->in_fd >= 0) {
+        redirect_fd(0, pipeline->in_fd, &pipeline->undo);
+        close(pipeline->in_fd);
+        pipeline->in_fd = -1;
+    }
+    if (!last) {
+        redirect_fd(1, fds[1], &pipeline->undo);
+        close(fds[1]);
+        pipeline->in_fd = fds[0];
+    }
+    return 1;
+}
+
+// Put the shell's descriptors back and remember the stage's child
+void pipeline_end_stage(Pipeline* pipeline, pid_t pid, int status) {
+    redirect_restore(&pipeline->undo);
+    if (pipeline->count == pipeline->cap) {
+        pipeline->cap = pipeline->cap ? pipeline->cap * 2 : 4;
+        pipeline->pids = xrealloc(pipeline->pids, pipeline->cap * sizeof(pid_t));
+        pipeline->statuses = xrealloc(pipeline->statuses, pipeline->cap * sizeof(int));
+    }
+    pipeline->pids[pipeline->count] = pid;
+    pipeline->statuses[pipeline->count] = status;
+    pipeline->count++;
+}
+
+// Wait for every stage; the status is the last stage's, or with pipefail
+// the last non-zero one
+int pipeline_wait(Pipeline* pipeline) {
+    if (pipeline->in_fd >= 0) close(pipeline->in_fd);
+    pipeline->in_fd = -1;
+    int result = 0;
+    for (int i = 0; i < pipeline->count; i++) {
+        int status = pipeline->pids[i] >= 0 ? wait_child(pipeline->pids[i]) : pipeline->statuses[i];
+        if (!option_pipefail || status != 0) result = status;
+    }
+    pipeline->count = 0;
+    return result;
+}
+
+// Drop a pipeline without waiting for it, as a forked stage does
+void pipeline_free(Pipeline* pipeline) {
+    if (pipeline->in_fd >= 0) close(pipeline->in_fd);
+    free(pipeline->pids);
+    free(pipeline->statuses);
+    redir_undo_free(&pipeline->undo);
+}
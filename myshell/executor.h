@@ -1,7 +1,52 @@
 #ifndef EXECUTOR_H
 #define EXECUTOR_H
 
-void exec_cmd(const char* cmd);
+#include "bytecode.h"
+#include "util.h"
+#include "spawn.h"
+#include "redirect.h"
+
+// A fully expanded simple command, ready to run
+typedef struct {
+    int line;
+    int builtin;                // builtin id, or -1 for an external program
+    int argc;
+    char** argv;
+    int nassigns;
+    const int* assign_slots;
+    char** assign_values;
+    int nredirs;
+    const RedirOp* redirs;
+    char** redir_targets;
+} Command;
+
+// Stages of a pipeline being started, all running at the same time
+typedef struct {
+    pid_t* pids;                // -1 for stages that never started
+    int* statuses;              // status of those stages
+    int count;
+    int cap;
+    int in_fd;                  // read end feeding the next stage
+    RedirUndo undo;             // the shell's own fd 0 and fd 1
+} Pipeline;
+
+// Builtins run inside the shell process and return their exit status
+typedef int (*BuiltinFn)(int argc, char** argv);
+
+int builtin_lookup(const char* name);
+// Add a builtin, or replace the one with the same name; returns its id.
+// Commands compiled afterwards run it without starting a process.
+int builtin_register(const char* name, BuiltinFn fn);
+// Whether a builtin changes nothing but its output, so a command
+// substitution may run it in the shell
+int builtin_pure(int id);
+void exec_cmd(const Command* cmd);
+pid_t exec_cmd_async(const Command* cmd, int* status);
+
+void pipeline_init(Pipeline* pipeline);
+int pipeline_begin_stage(Pipeline* pipeline, int last);
+void pipeline_end_stage(Pipeline* pipeline, pid_t pid, int status);
+int pipeline_wait(Pipeline* pipeline);
+void pipeline_free(Pipeline* pipeline);
 
 #endif
-#pragma once
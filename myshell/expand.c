@@ -0,0 +1,254 @@
+#include "expand.h"
+#include "env.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <glob.h>
+#endif
+
+void args_init(ArgList* args, Arena* arena) {
+    args->arena = arena;
+    args->cap = 16;
+    args->count = 0;
+    args->items = xmalloc(args->cap * sizeof(char*));
+    args->items[0] = NULL;
+}
+
+char* args_push_space(ArgList* args, size_t len) {
+    if (args->count + 2 > args->cap) {
+        args->cap *= 2;
+        args->items = xrealloc(args->items, args->cap * sizeof(char*));
+    }
+    char* space = args->arena ? arena_alloc(args->arena, len + 1) : xmalloc(len + 1);
+    space[len] = '\0';
+    args->items[args->count++] = space;
+    args->items[args->count] = NULL;
+    return space;
+}
+
+// Append a copy of text
+void args_push(ArgList* args, const char* text, size_t len) {
+    memcpy(args_push_space(args, len), text, len);
+}
+
+// Drop (and free) every argument above the given count
+void args_truncate(ArgList* args, int count) {
+    if (args->count <= count) return;
+    if (args->arena) {
+        arena_pop_to(args->arena, args->items[count]);
+        args->count = count;
+    }
+    while (args->count > count) {
+        free(args->items[--args->count]);
+    }
+    args->items[args->count] = NULL;
+}
+
+void args_free(ArgList* args) {
+    args_truncate(args, 0);
+    free(args->items);
+    args->items = NULL;
+}
+
+void fb_init(FieldBuilder* fb) {
+    fb->spans = NULL;
+    fb->nspans = 0;
+    fb->spans_cap = 0;
+    fb->len = 0;
+    sb_init(&fb->scratch);
+    sb_init(&fb->pattern);
+    fb->have_field = 0;
+    fb->globbing = 0;
+}
+
+void fb_free(FieldBuilder* fb) {
+    free(fb->spans);
+    sb_free(&fb->scratch);
+    sb_free(&fb->pattern);
+}
+
+static int is_glob_char(char c) {
+    return c == '*' || c == '?' || c == '[';
+}
+
+// '[' only starts a pattern when a ']' follows, so "[ a -lt b ]" never globs
+static int has_glob(const char* s) {
+    for (; *s; s++) {
+        if (*s == '*' || *s == '?') return 1;
+        if (*s == '[' && strchr(s + 1, ']')) return 1;
+    }
+    return 0;
+}
+
+void fb_reset(FieldBuilder* fb) {
+    fb->nspans = 0;
+    fb->len = 0;
+    sb_clear(&fb->scratch);
+    fb->have_field = 0;
+    fb->globbing = 0;
+}
+
+static const char* span_text(const FieldBuilder* fb, const Span* span) {
+    return span->text ? span->text : fb->scratch.data + span->offset;
+}
+
+static void add_span(FieldBuilder* fb, const char* text, size_t offset, size_t len, int quoted) {
+    fb->len += len;
+    if (fb->nspans > 0) {
+        // Extend the previous span when this one continues it
+        Span* last = &fb->spans[fb->nspans - 1];
+        if (last->quoted == quoted && (text ? last->text && last->text + last->len == text
+                                            : !last->text && last->offset + last->len == offset)) {
+            last->len += len;
+            return;
+        }
+    }
+    if (fb->nspans == fb->spans_cap) {
+        fb->spans_cap = fb->spans_cap ? fb->spans_cap * 2 : 16;
+        fb->spans = xrealloc(fb->spans, fb->spans_cap * sizeof(Span));
+    }
+    Span* span = &fb->spans[fb->nspans++];
+    span->text = text;
+    span->offset = offset;
+    span->len = len;
+    span->quoted = quoted;
+}
+
+void fb_literal(FieldBuilder* fb, const char* text, int quoted) {
+    size_t len = strlen(text);
+    if (quoted) {
+        add_span(fb, text, 0, len, 1);
+        fb->have_field = 1;
+        return;
+    }
+    if (len == 0) return;
+    add_span(fb, text, 0, len, 0);
+    if (has_glob(text)) fb->globbing = 1;
+    fb->have_field = 1;
+}
+
+void fb_text(FieldBuilder* fb, const char* text, size_t len, int quoted) {
+    size_t offset = fb->scratch.len;
+    sb_append_len(&fb->scratch, text, len);
+    add_span(fb, NULL, offset, len, quoted);
+    fb->have_field = 1;
+}
+
+void fb_detach(FieldBuilder* fb) {
+    for (int i = 0; i < fb->nspans; i++) {
+        Span* span = &fb->spans[i];
+        if (!span->text) continue;
+        span->offset = fb->scratch.len;
+        sb_append_len(&fb->scratch, span->text, span->len);
+        span->text = NULL;
+    }
+}
+
+// Copy the spans into one new string on the list
+static void push_field(FieldBuilder* fb, ArgList* out) {
+    char* dest = args_push_space(out, fb->len);
+    for (int i = 0; i < fb->nspans; i++) {
+        memcpy(dest, span_text(fb, &fb->spans[i]), fb->spans[i].len);
+        dest += fb->spans[i].len;
+    }
+}
+
+// The field as a glob pattern: quoted glob characters are escaped
+static void build_pattern(FieldBuilder* fb) {
+    sb_clear(&fb->pattern);
+    for (int i = 0; i < fb->nspans; i++) {
+        const Span* span = &fb->spans[i];
+        const char* text = span_text(fb, span);
+        if (!span->quoted) {
+            sb_append_len(&fb->pattern, text, span->len);
+            continue;
+        }
+        for (size_t k = 0; k < span->len; k++) {
+            if (is_glob_char(text[k]) || text[k] == '\\') sb_appendc(&fb->pattern, '\\');
+            sb_appendc(&fb->pattern, text[k]);
+        }
+    }
+}
+
+// Add a finished field, replacing it by its pathname matches if it is a pattern
+static void emit_field(FieldBuilder* fb, ArgList* out) {
+#ifndef _WIN32
+    if (fb->globbing) {
+        build_pattern(fb);
+        glob_t matches;
+        if (glob(fb->pattern.data, 0, NULL, &matches) == 0) {
+            for (size_t i = 0; i < matches.gl_pathc; i++) {
+                args_push(out, matches.gl_pathv[i], strlen(matches.gl_pathv[i]));
+            }
+            globfree(&matches);
+            fb_reset(fb);
+            return;
+        }
+        globfree(&matches);
+    }
+#endif
+    push_field(fb, out);
+    fb_reset(fb);
+}
+
+// Append the result of an expansion; unquoted values are split on IFS.
+// IFS whitespace around fields is dropped; each other IFS character ends
+// one field, so a::b gives an empty field between a and b. An unset IFS
+// splits on whitespace and an empty one not at all.
+void fb_value(FieldBuilder* fb, const char* value, int quoted, ArgList* out) {
+    if (quoted) {
+        fb_literal(fb, value, 1);
+        return;
+    }
+
+    int slot = var_find("IFS");
+    const char* ifs = slot >= 0 && var_is_set(slot) ? var_get(slot) : " \t\n";
+
+    // Runs between separators are referenced in place
+    const char* run = value;
+    int after_blank = 0;        // whitespace just ended a field
+    for (const char* s = value;; s++) {
+        int end = *s == '\0';
+        if (!end && !strchr(ifs, *s)) {
+            if (is_glob_char(*s)) fb->globbing = 1;
+            continue;
+        }
+        if (s > run) {
+            add_span(fb, run, 0, (size_t)(s - run), 0);
+            fb->have_field = 1;
+            after_blank = 0;
+        }
+        if (end) break;
+        run = s + 1;
+        if (*s == ' ' || *s == '\t' || *s == '\n') {
+            if (!fb->have_field) continue;
+            emit_field(fb, out);
+            after_blank = 1;
+        }
+        else {
+            // The field may be empty; blanks before it were this separator
+            if (!after_blank) emit_field(fb, out);
+            after_blank = 0;
+        }
+    }
+}
+
+// Finish a word used as command arguments: zero or more fields
+void fb_end_fields(FieldBuilder* fb, ArgList* out) {
+    if (fb->have_field) emit_field(fb, out);
+    fb_reset(fb);
+}
+
+// Finish a word used as a single string (assignments, redirections, case)
+void fb_end_string(FieldBuilder* fb, ArgList* out) {
+    push_field(fb, out);
+    fb_reset(fb);
+}
+
+// Finish a case pattern: the text with quoted glob characters escaped
+void fb_end_pattern(FieldBuilder* fb, ArgList* out) {
+    build_pattern(fb);
+    args_push(out, fb->pattern.data, fb->pattern.len);
+    fb_reset(fb);
+}
@@ -0,0 +1,65 @@
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include "util.h"
+#include "arena.h"
+
+// Growable, NULL-terminated list of expanded arguments. With an arena the
+// strings are allocated there and the list is used as a stack: dropping
+// items frees them and anything allocated after them.
+typedef struct {
+    char** items;
+    int count;
+    int cap;
+    Arena* arena;               // NULL to use malloc
+} ArgList;
+
+void args_init(ArgList* args, Arena* arena);
+void args_push(ArgList* args, const char* text, size_t len);
+// Push a string of len bytes (plus the NUL) for the caller to fill in
+char* args_push_space(ArgList* args, size_t len);
+void args_truncate(ArgList* args, int count);
+void args_free(ArgList* args);
+
+// A piece of the word being built. Constants and variable values are
+// referenced where they are; generated text (numbers) is copied into the
+// builder's scratch buffer and referenced by offset.
+typedef struct {
+    const char* text;       // NULL when the text is in scratch
+    size_t offset;
+    size_t len;
+    int quoted;
+} Span;
+
+// Builds fields out of word parts: quoted text is kept verbatim, unquoted
+// expansions are split on IFS and unquoted glob characters trigger
+// pathname expansion when the field is finished. A field is a list of
+// spans until it is finished; then it is copied once into an exactly sized
+// string, and a glob pattern is only built when the field needs one.
+typedef struct {
+    Span* spans;
+    int nspans;
+    int spans_cap;
+    size_t len;             // total length of the spans
+    StrBuf scratch;
+    StrBuf pattern;         // the field with quoted glob characters escaped
+    int have_field;
+    int globbing;
+} FieldBuilder;
+
+void fb_init(FieldBuilder* fb);
+void fb_free(FieldBuilder* fb);
+void fb_reset(FieldBuilder* fb);
+// text must stay unchanged until the word is finished
+void fb_literal(FieldBuilder* fb, const char* text, int quoted);
+void fb_value(FieldBuilder* fb, const char* value, int quoted, ArgList* out);
+// Copy text that is about to go away, such as a formatted number
+void fb_text(FieldBuilder* fb, const char* text, size_t len, int quoted);
+// Copy every referenced value into scratch; called before variables change
+// in the middle of a word, as $(( x = 1 )) does
+void fb_detach(FieldBuilder* fb);
+void fb_end_fields(FieldBuilder* fb, ArgList* out);
+void fb_end_string(FieldBuilder* fb, ArgList* out);
+void fb_end_pattern(FieldBuilder* fb, ArgList* out);
+
+#endif
@@ -0,0 +1,76 @@
+#include "function.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    char* name;
+    uint32_t hash;
+    Chunk* body;            // NULL while the name has no function
+} Function;
+
+static Function* functions = NULL;
+static int function_count = 0;
+static int functions_cap = 0;
+static int* table = NULL;   // slot + 1, or 0 for an empty bucket
+static size_t table_size = 0;
+
+static void table_insert(int slot) {
+    size_t mask = table_size - 1;
+    size_t i = functions[slot].hash & mask;
+    while (table[i]) i = (i + 1) & mask;
+    table[i] = slot + 1;
+}
+
+static int find_slot(const char* name, uint32_t hash) {
+    if (!table) return -1;
+    size_t mask = table_size - 1;
+    for (size_t i = hash & mask; table[i]; i = (i + 1) & mask) {
+        const Function* fn = &functions[table[i] - 1];
+        if (fn->hash == hash && strcmp(fn->name, name) == 0) return table[i] - 1;
+    }
+    return -1;
+}
+
+int function_find(const char* name) {
+    return find_slot(name, hash_string(name));
+}
+
+int function_slot(const char* name) {
+    uint32_t hash = hash_string(name);
+    int slot = find_slot(name, hash);
+    if (slot >= 0) return slot;
+
+    if (function_count == functions_cap) {
+        functions_cap = functions_cap ? functions_cap * 2 : 32;
+        functions = xrealloc(functions, functions_cap * sizeof(Function));
+    }
+    if ((size_t)(function_count + 1) * 2 > table_size) {
+        free(table);
+        table_size = table_size ? table_size * 2 : 64;
+        table = xcalloc(table_size, sizeof(int));
+        for (int i = 0; i < function_count; i++) table_insert(i);
+    }
+
+    slot = function_count++;
+    functions[slot].name = xstrdup(name);
+    functions[slot].hash = hash;
+    functions[slot].body = NULL;
+    table_insert(slot);
+    return slot;
+}
+
+Chunk* function_get(int slot) {
+    return functions[slot].body;
+}
+
+void function_define(int slot, Chunk* body) {
+    chunk_retain(body);
+    chunk_free(functions[slot].body);
+    functions[slot].body = body;
+}
+
+void function_unset(int slot) {
+    chunk_free(functions[slot].body);
+    functions[slot].body = NULL;
+}
@@ -0,0 +1,20 @@
+#ifndef FUNCTION_H
+#define FUNCTION_H
+
+#include "bytecode.h"
+
+// Shell functions. Like variables, a name is interned once to a handle, so
+// a command compiled with a constant name checks for a function by
+// indexing an array instead of hashing its name on every run.
+
+int function_slot(const char* name);
+// Look a name up without interning it; returns -1 if it never was
+int function_find(const char* name);
+
+// The compiled body, or NULL when no function has this name
+Chunk* function_get(int slot);
+// Define or replace a function; the table takes a reference to body
+void function_define(int slot, Chunk* body);
+void function_unset(int slot);
+
+#endif
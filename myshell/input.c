@@ -0,0 +1,107 @@
+#define _POSIX_C_SOURCE 200809L
+#include "input.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+// Descriptors below this get a buffer; read -u with a higher one is
+// read a byte at a time
+#define MAX_INPUT_FDS 10
+
+typedef enum {
+    INPUT_UNKNOWN,          // not looked at since the last sync
+    INPUT_BUFFERED,         // seekable: read ahead and give back
+    INPUT_UNBUFFERED        // a pipe or terminal
+} InputMode;
+
+typedef struct {
+    InputMode mode;
+    char* data;
+    size_t start;           // next byte to hand out
+    size_t len;
+} InputBuffer;
+
+static InputBuffer buffers[MAX_INPUT_FDS];
+static unsigned in_use = 0;         // bit per descriptor not in INPUT_UNKNOWN
+
+// The buffer for fd, or NULL when it has to be read a byte at a time
+static InputBuffer* buffer_for(int fd) {
+    if (fd < 0 || fd >= MAX_INPUT_FDS) return NULL;
+    InputBuffer* buffer = &buffers[fd];
+    if (buffer->mode == INPUT_UNKNOWN) {
+        buffer->mode = lseek(fd, 0, SEEK_CUR) >= 0 ? INPUT_BUFFERED : INPUT_UNBUFFERED;
+        buffer->start = buffer->len = 0;
+        in_use |= 1u << fd;
+    }
+    if (buffer->mode == INPUT_UNBUFFERED) return NULL;
+    if (!buffer->data) buffer->data = xmalloc(INPUT_BUFFER_SIZE);
+    return buffer;
+}
+
+static int refill(InputBuffer* buffer, int fd) {
+    ssize_t n;
+    while ((n = read(fd, buffer->data, INPUT_BUFFER_SIZE)) < 0 && errno == EINTR) {
+        // Interrupted; read again
+    }
+    buffer->start = 0;
+    buffer->len = n > 0 ? (size_t)n : 0;
+    return n > 0;
+}
+
+static int read_byte(int fd) {
+    unsigned char c;
+    ssize_t n;
+    while ((n = read(fd, &c, 1)) < 0 && errno == EINTR) {
+        // Interrupted; read again
+    }
+    return n == 1 ? c : -1;
+}
+
+int input_getc(int fd) {
+    InputBuffer* buffer = buffer_for(fd);
+    if (!buffer) return read_byte(fd);
+    if (buffer->start == buffer->len && !refill(buffer, fd)) return -1;
+    return (unsigned char)buffer->data[buffer->start++];
+}
+
+int input_line(int fd, int delim, StrBuf* out) {
+    InputBuffer* buffer = buffer_for(fd);
+    if (!buffer) {
+        int c;
+        while ((c = read_byte(fd)) >= 0) {
+            if (c == delim) return 1;
+            sb_appendc(out, (char)c);
+        }
+        return 0;
+    }
+
+    for (;;) {
+        if (buffer->start == buffer->len && !refill(buffer, fd)) return 0;
+        const char* from = buffer->data + buffer->start;
+        size_t available = buffer->len - buffer->start;
+        const char* end = memchr(from, delim, available);
+        if (end) {
+            sb_append_len(out, from, (size_t)(end - from));
+            buffer->start += (size_t)(end - from) + 1;
+            return 1;
+        }
+        sb_append_len(out, from, available);
+        buffer->start = buffer->len;
+    }
+}
+
+void input_sync(int fd) {
+    if (fd < 0 || fd >= MAX_INPUT_FDS || !(in_use & (1u << fd))) return;
+    InputBuffer* buffer = &buffers[fd];
+    if (buffer->mode == INPUT_BUFFERED && buffer->start < buffer->len) {
+        lseek(fd, -(off_t)(buffer->len - buffer->start), SEEK_CUR);
+    }
+    buffer->start = buffer->len = 0;
+    buffer->mode = INPUT_UNKNOWN;
+    in_use &= ~(1u << fd);
+}
+
+void input_sync_all(void) {
+    for (int fd = 0; in_use; fd++) input_sync(fd);
+}
@@ -0,0 +1,28 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "util.h"
+
+// Input for the read builtin. A regular file is read in large blocks and
+// lines are cut out of the buffer, so a read loop over a file costs one
+// system call per block instead of one per byte. The bytes buffered past
+// what read consumed still belong to the file offset other processes
+// share, so they are given back with lseek before a process starts, before
+// a descriptor changes and before the shell exits. Pipes and terminals
+// cannot take bytes back; they are read a byte at a time, as in other
+// shells, so the next reader starts right after the line.
+
+#define INPUT_BUFFER_SIZE 65536
+
+// Read up to delim, which is consumed but not stored; returns 1 if delim
+// was found, 0 at end of input
+int input_line(int fd, int delim, StrBuf* out);
+
+// The next byte, or -1 at end of input
+int input_getc(int fd);
+
+// Give input buffered from fd back to it, or from every descriptor
+void input_sync(int fd);
+void input_sync_all(void);
+
+#endif
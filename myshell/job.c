@@ -0,0 +1,188 @@
+#define _POSIX_C_SOURCE 200809L
+#include "job.h"
+#include "env.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+// Finished jobs nobody waited for are kept for a later wait, up to the
+// process limit as in other shells but never fewer than this; past it the
+// oldest are forgotten
+#define MIN_FINISHED_JOBS 1024
+
+typedef struct {
+    pid_t pid;
+    int number;             // %N
+    int status;
+    int done;
+} Job;
+
+static Job* jobs = NULL;
+static int njobs = 0;
+static int jobs_cap = 0;
+static int nfinished = 0;
+static pid_t owner = 0;             // process the table and the pipe belong to
+static int wake_fds[2] = { -1, -1 };
+static long max_finished = MIN_FINISHED_JOBS;
+
+static void child_exited(int sig) {
+    (void)sig;
+    int saved = errno;
+    if (write(wake_fds[1], "x", 1) < 0) {
+        // The pipe is full, which already says the same thing
+    }
+    errno = saved;
+}
+
+// Set up before the first job starts, so its exit cannot be missed. A
+// forked copy of the shell inherits the table but none of the children in
+// it, so it starts over with a pipe of its own.
+void job_prepare(void) {
+    pid_t self = getpid();
+    if (owner == self) return;
+
+    njobs = 0;
+    nfinished = 0;
+    if (wake_fds[0] >= 0) {
+        close(wake_fds[0]);
+        close(wake_fds[1]);
+    }
+    if (pipe(wake_fds) < 0) {
+        perror("pipe");
+        wake_fds[0] = wake_fds[1] = -1;
+    }
+    for (int i = 0; i < 2 && wake_fds[i] >= 0; i++) {
+        fcntl(wake_fds[i], F_SETFL, O_NONBLOCK);
+        fcntl(wake_fds[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = child_exited;
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGCHLD, &action, NULL);
+
+    long child_max = sysconf(_SC_CHILD_MAX);
+    if (child_max > max_finished) max_finished = child_max;
+    owner = self;
+}
+
+// Empty the pipe, then collect the jobs that have exited. Emptying it
+// first means an exit that happens during the scan leaves a byte behind.
+// The table is only scanned when a child exited since the last call,
+// unless all is set.
+static void reap(int all) {
+    char buffer[256];
+    int woken = 0;
+    while (read(wake_fds[0], buffer, sizeof(buffer)) > 0) woken = 1;
+    if (!woken && !all && wake_fds[0] >= 0) return;
+
+    for (int i = 0; i < njobs; i++) {
+        if (!jobs[i].done && poll_child(jobs[i].pid, &jobs[i].status)) {
+            jobs[i].done = 1;
+            nfinished++;
+        }
+    }
+}
+
+static void remove_job(int index) {
+    if (jobs[index].done) nfinished--;
+    memmove(&jobs[index], &jobs[index + 1], (njobs - index - 1) * sizeof(Job));
+    njobs--;
+}
+
+static void forget_oldest_finished(void) {
+    for (int i = 0; i < njobs; i++) {
+        if (jobs[i].done) {
+            remove_job(i);
+            return;
+        }
+    }
+}
+
+int job_add(pid_t pid) {
+    job_prepare();
+    if (nfinished >= max_finished) forget_oldest_finished();
+
+    if (njobs == jobs_cap) {
+        jobs_cap = jobs_cap ? jobs_cap * 2 : 16;
+        jobs = xrealloc(jobs, jobs_cap * sizeof(Job));
+    }
+    Job* job = &jobs[njobs++];
+    job->pid = pid;
+    job->number = njobs > 1 ? jobs[njobs - 2].number + 1 : 1;
+    job->status = 0;
+    job->done = 0;
+    set_background_pid((int)pid);
+
+    // The job may have exited already; its byte in the pipe must not be
+    // drained before it is in the table
+    reap(0);
+    return job->number;
+}
+
+int job_find(const char* spec) {
+    if (owner != getpid() || njobs == 0) return -1;
+
+    if (spec[0] == '%') {
+        if (strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0 || strcmp(spec, "%") == 0) {
+            return njobs - 1;
+        }
+        if (strcmp(spec, "%-") == 0) return njobs > 1 ? njobs - 2 : -1;
+        char* end;
+        long number = strtol(spec + 1, &end, 10);
+        if (end == spec + 1 || *end) return -1;
+        for (int i = 0; i < njobs; i++) {
+            if (jobs[i].number == number) return i;
+        }
+        return -1;
+    }
+
+    char* end;
+    long pid = strtol(spec, &end, 10);
+    if (end == spec || *end) return -1;
+    for (int i = 0; i < njobs; i++) {
+        if ((long)jobs[i].pid == pid) return i;
+    }
+    return -1;
+}
+
+// Sleep until some child exits
+static void sleep_until_exit(void) {
+    struct pollfd wake;
+    wake.fd = wake_fds[0];
+    wake.events = POLLIN;
+    wake.revents = 0;
+    while (poll(&wake, 1, -1) < 0 && errno == EINTR) {
+        // A signal other than SIGCHLD; keep waiting
+    }
+}
+
+int job_wait(int job) {
+    if (wake_fds[0] < 0) {
+        // No pipe to sleep on: block on this child alone
+        if (!jobs[job].done) jobs[job].status = wait_child(jobs[job].pid);
+        jobs[job].done = 1;
+    }
+    // One full scan first, in case the exit came before anyone listened
+    reap(1);
+    while (!jobs[job].done) {
+        sleep_until_exit();
+        reap(0);
+    }
+    int status = jobs[job].status;
+    remove_job(job);
+    return status;
+}
+
+void job_wait_all(void) {
+    if (owner != getpid()) return;
+    while (njobs > 0) job_wait(0);
+}
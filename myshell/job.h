@@ -0,0 +1,27 @@
+#ifndef JOB_H
+#define JOB_H
+
+#include "spawn.h"
+
+// Background jobs started with '&'. Every job is one process: a program
+// spawned directly or a forked copy of the shell. A SIGCHLD handler
+// writes to a pipe, so waiting for a job sleeps until some child exits
+// instead of polling, and jobs are only checked after one has.
+
+// Listen for children exiting; call before starting a job
+void job_prepare(void);
+
+// Record a started job and make it $!; returns its job number
+int job_add(pid_t pid);
+
+// Find a job by pid or by %N, %%, %+ or %-; returns a handle for
+// job_wait, or -1 when there is no such job
+int job_find(const char* spec);
+
+// Wait for a job and forget it; returns its exit status
+int job_wait(int job);
+
+// Wait for every job
+void job_wait_all(void);
+
+#endif
@@ -0,0 +1,611 @@
+#include "lexer.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+void lexer_init(Lexer* lx, Source* src) {
+    lx->src = src;
+    lx->pos = 0;
+    lx->line = 1;
+    lx->line_start = 0;
+    lx->heredocs = NULL;
+}
+
+void lexer_skip_to(Lexer* lx, size_t pos) {
+    lx->pos = pos;
+    lx->line_start = pos;
+}
+
+static int peek_at(const Lexer* lx, size_t offset) {
+    size_t i = lx->pos + offset;
+    return source_fill(lx->src, i) ? (unsigned char)lx->src->data[i] : '\0';
+}
+
+static int peek(const Lexer* lx) {
+    return peek_at(lx, 0);
+}
+
+static int advance(Lexer* lx) {
+    int c = peek(lx);
+    if (lx->pos < lx->src->len) lx->pos++;
+    if (c == '\n') {
+        lx->line++;
+        lx->line_start = lx->pos;
+    }
+    return c;
+}
+
+// Text between two offsets that the lexer has already read
+static char* slice(const Lexer* lx, size_t start, size_t end) {
+    return xstrndup(lx->src->data + start, end - start);
+}
+
+static int is_meta(int c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == ';' || c == '&' ||
+        c == '|' || c == '<' || c == '>' || c == '(' || c == ')' || c == '\0';
+}
+
+static int is_name_start(int c) {
+    return c == '_' || isalpha(c);
+}
+
+static int is_name_char(int c) {
+    return c == '_' || isalnum(c);
+}
+
+// Word under construction: finished parts plus the pending literal run
+typedef struct {
+    Word* word;
+    WordPart** tail;
+    StrBuf lit;
+    int lit_quoted;
+    int lit_pending;
+} WordBuilder;
+
+static void wb_init(WordBuilder* wb) {
+    wb->word = xcalloc(1, sizeof(Word));
+    wb->tail = &wb->word->parts;
+    sb_init(&wb->lit);
+    wb->lit_quoted = 0;
+    wb->lit_pending = 0;
+}
+
+static void wb_add_part(WordBuilder* wb, PartType type, int quoted, char* text) {
+    WordPart* part = xcalloc(1, sizeof(WordPart));
+    part->type = type;
+    part->quoted = quoted;
+    part->text = text;
+    *wb->tail = part;
+    wb->tail = &part->next;
+}
+
+static void wb_flush(WordBuilder* wb) {
+    if (!wb->lit_pending) return;
+    wb_add_part(wb, PART_LITERAL, wb->lit_quoted, xstrndup(wb->lit.data, wb->lit.len));
+    sb_clear(&wb->lit);
+    wb->lit_pending = 0;
+}
+
+// Append literal text, starting a new part whenever the quoting changes
+static void wb_literal(WordBuilder* wb, int quoted, const char* s, size_t len) {
+    if (wb->lit_pending && wb->lit_quoted != quoted) wb_flush(wb);
+    wb->lit_quoted = quoted;
+    wb->lit_pending = 1;
+    sb_append_len(&wb->lit, s, len);
+}
+
+static Word* wb_finish(WordBuilder* wb) {
+    wb_flush(wb);
+    sb_free(&wb->lit);
+    return wb->word;
+}
+
+static void wb_abort(WordBuilder* wb) {
+    sb_free(&wb->lit);
+    word_free(wb->word);
+}
+
+// Scan to the closing parenthesis of $(( or $(, honouring nesting and quotes
+static int scan_parens(Lexer* lx, int depth) {
+    while (depth > 0) {
+        int c = peek(lx);
+        if (c == '\0') return 0;
+        advance(lx);
+        if (c == '(') depth++;
+        else if (c == ')') depth--;
+        else if (c == '\\' && peek(lx) != '\0') advance(lx);
+        else if (c == '\'') {
+            while (peek(lx) != '\0' && peek(lx) != '\'') advance(lx);
+            if (peek(lx) == '\0') return 0;
+            advance(lx);
+        }
+        else if (c == '"') {
+            while (peek(lx) != '\0' && peek(lx) != '"') {
+                if (peek(lx) == '\\' && peek_at(lx, 1) != '\0') advance(lx);
+                advance(lx);
+            }
+            if (peek(lx) == '\0') return 0;
+            advance(lx);
+        }
+    }
+    return 1;
+}
+
+// Lex `command` after the opening backquote. Inside, a backslash only
+// quotes $, ` and \ (and " within double quotes); the command's own
+// lexer sees everything else as written.
+static int lex_backquote(Lexer* lx, WordBuilder* wb, int quoted) {
+    StrBuf text;
+    sb_init(&text);
+    for (;;) {
+        int c = peek(lx);
+        if (c == '\0') {
+            sb_free(&text);
+            return 0;
+        }
+        advance(lx);
+        if (c == '`') break;
+        if (c == '\\') {
+            int d = peek(lx);
+            if (d == '$' || d == '`' || d == '\\' || (quoted && d == '"')) c = advance(lx);
+        }
+        sb_appendc(&text, (char)c);
+    }
+    wb_flush(wb);
+    wb_add_part(wb, PART_COMMAND, quoted, sb_release(&text));
+    return 1;
+}
+
+// Lex an expansion after '$'; returns 0 on an unterminated construct
+static int lex_dollar(Lexer* lx, WordBuilder* wb, int quoted) {
+    int c = peek(lx);
+
+    if (c == '(' && peek_at(lx, 1) == '(') {
+        advance(lx);
+        advance(lx);
+        size_t start = lx->pos;
+        if (!scan_parens(lx, 2)) return 0;
+        // Drop the closing "))"
+        wb_flush(wb);
+        wb_add_part(wb, PART_ARITH, quoted, slice(lx, start, lx->pos - 2));
+        return 1;
+    }
+    if (c == '(') {
+        advance(lx);
+        size_t start = lx->pos;
+        if (!scan_parens(lx, 1)) return 0;
+        wb_flush(wb);
+        wb_add_part(wb, PART_COMMAND, quoted, slice(lx, start, lx->pos - 1));
+        return 1;
+    }
+    if (c == '{') {
+        advance(lx);
+        size_t start = lx->pos;
+        while (peek(lx) != '\0' && peek(lx) != '}') advance(lx);
+        if (peek(lx) == '\0') return 0;
+        size_t end = lx->pos;
+        advance(lx);
+        wb_flush(wb);
+        wb_add_part(wb, PART_VAR, quoted, slice(lx, start, end));
+        return 1;
+    }
+    if (c == '?' || c == '$' || c == '#' || c == '*' || c == '@' || c == '!' || isdigit(c)) {
+        char name[2] = { (char)advance(lx), '\0' };
+        wb_flush(wb);
+        wb_add_part(wb, PART_VAR, quoted, xstrdup(name));
+        return 1;
+    }
+    if (is_name_start(c)) {
+        size_t start = lx->pos;
+        while (is_name_char(peek(lx))) advance(lx);
+        wb_flush(wb);
+        wb_add_part(wb, PART_VAR, quoted, slice(lx, start, lx->pos));
+        return 1;
+    }
+
+    // A lone '$' is literal
+    wb_literal(wb, quoted, "$", 1);
+    return 1;
+}
+
+void lexer_heredoc(Lexer* lx, const Word* delimiter, int strip_tabs, Word* body) {
+    HereDoc* doc = xcalloc(1, sizeof(HereDoc));
+    StrBuf text;
+    sb_init(&text);
+    for (const WordPart* part = delimiter->parts; part; part = part->next) {
+        // The delimiter is never expanded: <<$x ends at a line reading $x
+        if (part->type == PART_VAR) sb_appendc(&text, '$');
+        sb_append(&text, part->text);
+        doc->quoted |= part->quoted;
+    }
+    doc->delimiter = sb_release(&text);
+    doc->strip_tabs = strip_tabs;
+    doc->line = lx->line;
+    doc->body = body;
+
+    HereDoc** tail = &lx->heredocs;
+    while (*tail) tail = &(*tail)->next;
+    *tail = doc;
+}
+
+void lexer_drop_heredocs(Lexer* lx) {
+    while (lx->heredocs) {
+        HereDoc* doc = lx->heredocs;
+        lx->heredocs = doc->next;
+        free(doc->delimiter);
+        free(doc);
+    }
+}
+
+// Offset of the newline ending the current line, or of the end of input
+static size_t line_end(Lexer* lx) {
+    size_t i = lx->pos;
+    while (source_fill(lx->src, i)) {
+        const char* data = lx->src->data;
+        const char* newline = memchr(data + i, '\n', lx->src->len - i);
+        if (newline) return (size_t)(newline - data);
+        i = lx->src->len;
+    }
+    return i;
+}
+
+// Move past a line read in one piece, and its newline if it has one
+static void skip_line(Lexer* lx, size_t end) {
+    lx->pos = end;
+    if (source_fill(lx->src, end)) advance(lx);
+}
+
+// Read one here-document body, up to its delimiter line or the end of the
+// input. With an unquoted delimiter, $ and ` expand and a backslash quotes
+// $, `, \ and newline; the whole body is one quoted string either way.
+static int read_heredoc(Lexer* lx, HereDoc* doc) {
+    WordBuilder wb;
+    wb_init(&wb);
+    wb_literal(&wb, 1, "", 0);
+    size_t delimiter_len = strlen(doc->delimiter);
+
+    for (;;) {
+        if (doc->strip_tabs) {
+            while (peek(lx) == '\t') advance(lx);
+        }
+        size_t end = line_end(lx);
+        const char* line = lx->src->data + lx->pos;
+        size_t len = end - lx->pos;
+        if (len == delimiter_len && memcmp(line, doc->delimiter, len) == 0) {
+            skip_line(lx, end);
+            break;
+        }
+        if (peek(lx) == '\0') {
+            fprintf(stderr, "myshell: line %d: warning: here-document at line %d delimited by end-of-file (wanted `%s')\n",
+                lx->pos > lx->line_start ? lx->line : lx->line - 1, doc->line, doc->delimiter);
+            break;
+        }
+
+        // Lines with nothing to expand are copied in one piece
+        size_t plain = 0;
+        if (!doc->quoted) {
+            while (plain < len && line[plain] != '$' && line[plain] != '`' && line[plain] != '\\') plain++;
+        }
+        if (doc->quoted || plain == len) {
+            wb_literal(&wb, 1, line, len);
+            skip_line(lx, end);
+            if (end < lx->src->len) wb_literal(&wb, 1, "\n", 1);
+            continue;
+        }
+
+        int c;
+        do {
+            size_t start = lx->pos;
+            for (;;) {
+                c = peek(lx);
+                if (c == '\0' || c == '$' || c == '`' || c == '\\') break;
+                advance(lx);
+                if (c == '\n') break;
+            }
+            wb_literal(&wb, 1, lx->src->data + start, lx->pos - start);
+            if (c == '\0' || c == '\n') break;
+
+            advance(lx);
+            int ok = 1;
+            if (c == '$') {
+                ok = lex_dollar(lx, &wb, 1);
+            }
+            else if (c == '`') {
+                ok = lex_backquote(lx, &wb, 1);
+            }
+            else if (peek(lx) == '$' || peek(lx) == '`' || peek(lx) == '\\') {
+                char ch = (char)advance(lx);
+                wb_literal(&wb, 1, &ch, 1);
+            }
+            else if (peek(lx) == '\n') {
+                // Line continuation
+                advance(lx);
+            }
+            else {
+                wb_literal(&wb, 1, "\\", 1);
+            }
+            if (!ok) {
+                wb_abort(&wb);
+                return 0;
+            }
+        } while (c != '\n');
+    }
+
+    Word* word = wb_finish(&wb);
+    doc->body->parts = word->parts;
+    free(word);
+    return 1;
+}
+
+// Read the bodies of the here-documents started on the line just ended
+static int read_heredocs(Lexer* lx) {
+    int ok = 1;
+    for (HereDoc* doc = lx->heredocs; doc && ok; doc = doc->next) ok = read_heredoc(lx, doc);
+    lexer_drop_heredocs(lx);
+    return ok;
+}
+
+static Token make_token(TokenType type, int line) {
+    Token tok;
+    memset(&tok, 0, sizeof(tok));
+    tok.type = type;
+    tok.line = line;
+    tok.fd = -1;
+    return tok;
+}
+
+static Token error_token(const char* message, int line) {
+    Token tok = make_token(TOK_ERROR, line);
+    tok.error = message;
+    return tok;
+}
+
+static Token lex_word(Lexer* lx) {
+    Token tok = make_token(TOK_WORD, lx->line);
+    WordBuilder wb;
+    wb_init(&wb);
+
+    for (;;) {
+        int c = peek(lx);
+        if (is_meta(c)) break;
+
+        if (c == '\\') {
+            advance(lx);
+            if (peek(lx) == '\n') {
+                // Line continuation
+                advance(lx);
+                continue;
+            }
+            if (peek(lx) == '\0') break;
+            char ch = (char)advance(lx);
+            wb_literal(&wb, 1, &ch, 1);
+        }
+        else if (c == '\'') {
+            advance(lx);
+            size_t start = lx->pos;
+            while (peek(lx) != '\0' && peek(lx) != '\'') advance(lx);
+            if (peek(lx) == '\0') {
+                wb_abort(&wb);
+                return error_token("unterminated single quote", tok.line);
+            }
+            wb_literal(&wb, 1, lx->src->data + start, lx->pos - start);
+            advance(lx);
+        }
+        else if (c == '"') {
+            advance(lx);
+            // Even "" produces a (quoted, empty) part so the argument survives
+            wb_literal(&wb, 1, "", 0);
+            for (;;) {
+                int d = peek(lx);
+                if (d == '\0') {
+                    wb_abort(&wb);
+                    return error_token("unterminated double quote", tok.line);
+                }
+                advance(lx);
+                if (d == '"') break;
+                if (d == '\\') {
+                    int e = peek(lx);
+                    if (e == '$' || e == '`' || e == '"' || e == '\\') {
+                        char ch = (char)advance(lx);
+                        wb_literal(&wb, 1, &ch, 1);
+                    }
+                    else if (e == '\n') {
+                        advance(lx);
+                    }
+                    else {
+                        wb_literal(&wb, 1, "\\", 1);
+                    }
+                }
+                else if (d == '$') {
+                    if (!lex_dollar(lx, &wb, 1)) {
+                        wb_abort(&wb);
+                        return error_token("unterminated expansion", tok.line);
+                    }
+                }
+                else if (d == '`') {
+                    if (!lex_backquote(lx, &wb, 1)) {
+                        wb_abort(&wb);
+                        return error_token("unterminated command substitution", tok.line);
+                    }
+                }
+                else {
+                    char ch = (char)d;
+                    wb_literal(&wb, 1, &ch, 1);
+                }
+            }
+        }
+        else if (c == '$') {
+            advance(lx);
+            if (!lex_dollar(lx, &wb, 0)) {
+                wb_abort(&wb);
+                return error_token("unterminated expansion", tok.line);
+            }
+        }
+        else if (c == '`') {
+            advance(lx);
+            if (!lex_backquote(lx, &wb, 0)) {
+                wb_abort(&wb);
+                return error_token("unterminated command substitution", tok.line);
+            }
+        }
+        else {
+            char ch = (char)advance(lx);
+            wb_literal(&wb, 0, &ch, 1);
+        }
+    }
+
+    tok.word = wb_finish(&wb);
+    return tok;
+}
+
+// Digits immediately followed by a redirection operator form an fd prefix
+static int lex_io_number(Lexer* lx) {
+    size_t n = 0;
+    int fd = 0;
+    while (isdigit(peek_at(lx, n))) fd = fd * 10 + (peek_at(lx, n++) - '0');
+    if (n == 0 || n > 4) return -1;
+    if (peek_at(lx, n) != '<' && peek_at(lx, n) != '>') return -1;
+    lx->pos += n;
+    return fd;
+}
+
+static void skip_blanks(Lexer* lx) {
+    for (;;) {
+        int c = peek(lx);
+        if (c == ' ' || c == '\t' || c == '\r') {
+            advance(lx);
+        }
+        else if (c == '\\' && peek_at(lx, 1) == '\n') {
+            advance(lx);
+            advance(lx);
+        }
+        else if (c == '#') {
+            while (peek(lx) != '\0' && peek(lx) != '\n') advance(lx);
+        }
+        else {
+            break;
+        }
+    }
+}
+
+static Token lex_token(Lexer* lx) {
+    int line = lx->line;
+    int c = peek(lx);
+
+    if (c == '\0' || c == '\n') {
+        advance(lx);
+        if (lx->heredocs && !read_heredocs(lx)) {
+            return error_token("unterminated expansion in here-document", line);
+        }
+        return make_token(c == '\n' ? TOK_NEWLINE : TOK_EOF, line);
+    }
+    if (c == ';') {
+        advance(lx);
+        if (peek(lx) == ';') {
+            advance(lx);
+            return make_token(TOK_DSEMI, line);
+        }
+        return make_token(TOK_SEMI, line);
+    }
+    if (c == '&') {
+        advance(lx);
+        if (peek(lx) == '&') {
+            advance(lx);
+            return make_token(TOK_AND, line);
+        }
+        return make_token(TOK_AMP, line);
+    }
+    if (c == '|') {
+        advance(lx);
+        if (peek(lx) == '|') {
+            advance(lx);
+            return make_token(TOK_OR, line);
+        }
+        return make_token(TOK_PIPE, line);
+    }
+    if (c == '(') {
+        advance(lx);
+        return make_token(TOK_LPAREN, line);
+    }
+    if (c == ')') {
+        advance(lx);
+        return make_token(TOK_RPAREN, line);
+    }
+
+    int fd = isdigit(c) ? lex_io_number(lx) : -1;
+    c = peek(lx);
+    if (c == '<' || c == '>') {
+        Token tok = make_token(TOK_REDIR, line);
+        tok.fd = fd;
+        advance(lx);
+        if (c == '<') {
+            if (peek(lx) == '&') {
+                advance(lx);
+                tok.redir = REDIR_DUP_IN;
+            }
+            else if (peek(lx) == '<') {
+                advance(lx);
+                if (peek(lx) == '<') {
+                    advance(lx);
+                    tok.redir = REDIR_HERESTRING;
+                }
+                else {
+                    if (peek(lx) == '-') {
+                        advance(lx);
+                        tok.strip_tabs = 1;
+                    }
+                    tok.redir = REDIR_HEREDOC;
+                }
+            }
+            else {
+                tok.redir = REDIR_IN;
+            }
+        }
+        else {
+            if (peek(lx) == '>') {
+                advance(lx);
+                tok.redir = REDIR_APPEND;
+            }
+            else if (peek(lx) == '&') {
+                advance(lx);
+                tok.redir = REDIR_DUP_OUT;
+            }
+            else {
+                tok.redir = REDIR_OUT;
+            }
+        }
+        return tok;
+    }
+
+    return lex_word(lx);
+}
+
+Token lexer_next(Lexer* lx) {
+    skip_blanks(lx);
+    int column = (int)(lx->pos - lx->line_start) + 1;
+    Token tok = lex_token(lx);
+    tok.column = column;
+    return tok;
+}
+
+const char* token_name(const Token* tok) {
+    switch (tok->type) {
+    case TOK_EOF: return "end of file";
+    case TOK_WORD: return tok->word && tok->word->parts && tok->word->parts->text ?
+        tok->word->parts->text : "word";
+    case TOK_NEWLINE: return "newline";
+    case TOK_SEMI: return ";";
+    case TOK_DSEMI: return ";;";
+    case TOK_AMP: return "&";
+    case TOK_AND: return "&&";
+    case TOK_OR: return "||";
+    case TOK_PIPE: return "|";
+    case TOK_LPAREN: return "(";
+    case TOK_RPAREN: return ")";
+    case TOK_REDIR: return "redirection";
+    case TOK_ERROR: return tok->error;
+    }
+    return "token";
+}
@@ -0,0 +1,67 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <stddef.h>
+#include "ast.h"
+#include "source.h"
+
+typedef enum {
+    TOK_EOF,
+    TOK_WORD,
+    TOK_NEWLINE,
+    TOK_SEMI,       // ;
+    TOK_DSEMI,      // ;;
+    TOK_AMP,        // &
+    TOK_AND,        // &&
+    TOK_OR,         // ||
+    TOK_PIPE,       // |
+    TOK_LPAREN,     // (
+    TOK_RPAREN,     // )
+    TOK_REDIR,      // <, >, >>, <&, >&, <<, <<-, <<< with an optional fd prefix
+    TOK_ERROR
+} TokenType;
+
+typedef struct {
+    TokenType type;
+    int line;
+    int column;
+    Word* word;             // TOK_WORD, owned by whoever consumes the token
+    RedirType redir;        // TOK_REDIR
+    int fd;                 // TOK_REDIR: explicit descriptor or -1
+    int strip_tabs;         // TOK_REDIR: <<- rather than <<
+    const char* error;      // TOK_ERROR
+} Token;
+
+// A here-document whose body comes after the end of the current line
+typedef struct HereDoc {
+    char* delimiter;
+    int quoted;             // part of the delimiter was quoted: no expansion
+    int strip_tabs;
+    int line;               // where the << is, for the end-of-file warning
+    Word* body;             // filled in when the body has been read
+    struct HereDoc* next;
+} HereDoc;
+
+// Tokens refer to the source by offset, so the buffer may grow while
+// a stream is being read
+typedef struct {
+    Source* src;
+    size_t pos;
+    int line;
+    size_t line_start;      // offset of the first byte of the current line
+    HereDoc* heredocs;      // bodies to read after the next newline, in order
+} Lexer;
+
+void lexer_init(Lexer* lx, Source* src);
+Token lexer_next(Lexer* lx);
+// Continue at pos, past script text that a command read as its input
+void lexer_skip_to(Lexer* lx, size_t pos);
+
+// Read a here-document body into body's parts once the newline ending the
+// current line is reached. body stays owned by the caller.
+void lexer_heredoc(Lexer* lx, const Word* delimiter, int strip_tabs, Word* body);
+// Forget bodies not read yet, after a syntax error
+void lexer_drop_heredocs(Lexer* lx);
+const char* token_name(const Token* tok);
+
+#endif
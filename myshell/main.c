@@ -1,19 +1,28 @@
 #include <stdio.h>
+#include <string.h>
 #include "parser.h"
+#include "source.h"
+#include "env.h"
+#include "input.h"
+#include "output.h"
 
 int main(int argc, char* argv[]) {
     if (argc < 2) {
-        printf("Usage: myshell script.sh\n");
+        printf("Usage: myshell script.sh [arg...]\n       myshell - [arg...] (read the script from stdin)\n");
         return 1;
     }
 
-    FILE* fp = fopen(argv[1], "r");
-    if (!fp) {
-        perror("open");
+    Source src;
+    if (!source_open(&src, argv[1])) {
         return 1;
     }
 
-    interpret(fp);
-    fclose(fp);
-    return 0;
+    import_environment();
+    // Like other shells, $0 is the script's path and the rest are $1..$N
+    set_script_args(strcmp(argv[1], "-") == 0 ? "myshell" : argv[1], argc - 2, argv + 2);
+    interpret(&src);
+    out_flush();
+    input_sync_all();
+    source_close(&src);
+    return get_exit_status();
 }
@@ -0,0 +1,202 @@
+#define _POSIX_C_SOURCE 200809L
+#include "output.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#ifdef _WIN32
+#include <io.h>
+#define write _write
+#define isatty _isatty
+#else
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#endif
+
+static char buffer[OUT_BUFFER_SIZE];
+static size_t used = 0;
+typedef enum {
+    BUFFER_UNKNOWN,         // not looked at since the last flush
+    BUFFER_FULL,
+    BUFFER_LINE,            // fd 1 is a terminal
+    BUFFER_NONE             // fd 2 is the same file, so errors must not pass output
+} BufferMode;
+
+static BufferMode mode = BUFFER_UNKNOWN;
+static StrBuf* capture = NULL;
+
+static void write_all(const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(1, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            // Nobody is reading; the output is lost either way
+            return;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+void out_flush(void) {
+    if (used > 0) write_all(buffer, used);
+    used = 0;
+    // fd 1 may be about to change, so look at it again
+    mode = BUFFER_UNKNOWN;
+}
+
+#ifndef _WIN32
+// fd 2 only changes through redirections, which say so, so it is looked at
+// once per change instead of on every flush
+static int stderr_known = 0;
+static int stderr_ok = 0;
+static struct stat stderr_stat;
+#endif
+
+void out_stderr_changed(void) {
+#ifndef _WIN32
+    stderr_known = 0;
+#endif
+}
+
+static BufferMode find_mode(void) {
+#ifdef _WIN32
+    return isatty(1) ? BUFFER_LINE : BUFFER_FULL;
+#else
+    struct stat out;
+    if (fstat(1, &out) != 0) return BUFFER_FULL;
+    if (!stderr_known) {
+        stderr_ok = fstat(2, &stderr_stat) == 0;
+        stderr_known = 1;
+    }
+    // As after 2>&1
+    if (stderr_ok && out.st_dev == stderr_stat.st_dev && out.st_ino == stderr_stat.st_ino) return BUFFER_NONE;
+    return S_ISCHR(out.st_mode) && isatty(1) ? BUFFER_LINE : BUFFER_FULL;
+#endif
+}
+
+static void after_write(const char* data, size_t len) {
+    if (mode == BUFFER_UNKNOWN) mode = find_mode();
+    if (mode == BUFFER_NONE || (mode == BUFFER_LINE && memchr(data, '\n', len))) out_flush();
+}
+
+StrBuf* out_capture(StrBuf* target) {
+    StrBuf* previous = capture;
+    capture = target;
+    return previous;
+}
+
+void out_write(const char* data, size_t len) {
+    if (capture) {
+        sb_append_len(capture, data, len);
+        return;
+    }
+    if (len > OUT_BUFFER_SIZE - used) {
+        out_flush();
+        if (len >= OUT_BUFFER_SIZE) {
+            write_all(data, len);
+            return;
+        }
+    }
+    memcpy(buffer + used, data, len);
+    used += len;
+    after_write(data, len);
+}
+
+void out_str(const char* s) {
+    out_write(s, strlen(s));
+}
+
+void out_char(char c) {
+    if (capture) {
+        sb_appendc(capture, c);
+        return;
+    }
+    if (used == OUT_BUFFER_SIZE) out_flush();
+    buffer[used++] = c;
+    if (c == '\n' || mode != BUFFER_FULL) after_write(&c, 1);
+}
+
+void out_printf(const char* format, ...) {
+    char text[1024];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (len < 0) return;
+    if ((size_t)len < sizeof(text)) {
+        out_write(text, (size_t)len);
+        return;
+    }
+
+    // Too long for the stack buffer: format straight into our own
+    va_start(args, format);
+    if (capture) {
+        sb_reserve(capture, (size_t)len);
+        vsnprintf(capture->data + capture->len, (size_t)len + 1, format, args);
+        capture->len += (size_t)len;
+    }
+    else if ((size_t)len < OUT_BUFFER_SIZE) {
+        out_flush();
+        vsnprintf(buffer, OUT_BUFFER_SIZE, format, args);
+        used = (size_t)len;
+        after_write(buffer, used);
+    }
+    else {
+        out_flush();
+        char* text_copy = xmalloc((size_t)len + 1);
+        vsnprintf(text_copy, (size_t)len + 1, format, args);
+        write_all(text_copy, (size_t)len);
+        free(text_copy);
+    }
+    va_end(args);
+}
+
+void out_writev(const char** parts, const size_t* lens, int count) {
+    size_t total = 0;
+    for (int i = 0; i < count; i++) total += lens[i];
+
+    if (capture) {
+        for (int i = 0; i < count; i++) out_write(parts[i], lens[i]);
+        return;
+    }
+    // Unbuffered output still goes out in one call rather than one per part
+    if (mode == BUFFER_UNKNOWN) mode = find_mode();
+    if (mode != BUFFER_NONE && (total <= OUT_BUFFER_SIZE - used || total < OUT_BUFFER_SIZE / 2)) {
+        for (int i = 0; i < count; i++) out_write(parts[i], lens[i]);
+        return;
+    }
+
+    out_flush();
+#ifdef _WIN32
+    for (int i = 0; i < count; i++) write_all(parts[i], lens[i]);
+#else
+    struct iovec iov[64];
+    int i = 0;
+    while (i < count) {
+        int n = 0;
+        while (i + n < count && n < 64) {
+            iov[n].iov_base = (void*)parts[i + n];
+            iov[n].iov_len = lens[i + n];
+            n++;
+        }
+        ssize_t written = writev(1, iov, n);
+        if (written < 0 && errno == EINTR) continue;
+        if (written < 0) return;
+        // Finish a short write piece by piece
+        for (int k = 0; k < n; k++) {
+            size_t len = lens[i + k];
+            if ((size_t)written >= len) {
+                written -= (ssize_t)len;
+                continue;
+            }
+            write_all(parts[i + k] + written, len - (size_t)written);
+            written = 0;
+        }
+        i += n;
+    }
+#endif
+}
@@ -0,0 +1,35 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include "util.h"
+
+// Builtins write fd 1 through one buffer owned by the shell instead of
+// stdio. It goes out with a single write(2) when full, after every line
+// when fd 1 is a terminal, and whenever out_flush is called: before fd 1
+// is redirected, before any process is started and before the shell exits.
+// When fd 2 is the same file as fd 1 every write goes out at once, so
+// output and error messages keep the order they were written in.
+
+#define OUT_BUFFER_SIZE 65536
+
+void out_write(const char* data, size_t len);
+void out_str(const char* s);
+void out_char(char c);
+void out_printf(const char* format, ...);
+
+// Write several pieces as one; when they do not fit in the buffer they
+// are passed to writev(2) directly
+void out_writev(const char** parts, const size_t* lens, int count);
+
+void out_flush(void);
+
+// Called when fd 2 is redirected or restored
+void out_stderr_changed(void);
+
+// Send everything written from now on to target instead of fd 1, or go
+// back to fd 1 when target is NULL; returns the previous target. Command
+// substitutions capture builtins this way without a pipe or a process.
+StrBuf* out_capture(StrBuf* target);
+
+#endif
@@ -0,0 +1,286 @@
+#define _POSIX_C_SOURCE 200809L
+#include "parallel.h"
+#include "executor.h"
+#include "function.h"
+#include "input.h"
+#include "vm.h"
+#include "env.h"
+#include "output.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+// GNU parallel's status for "more than 100 runs failed"
+#define MAX_FAILED_STATUS 101
+
+typedef struct {
+    pid_t pid;
+    int fd;                 // read end of the output pipe, -1 once closed
+    int status;
+    int done;
+    StrBuf out;             // output not yet written; data is NULL until used
+} Task;
+
+typedef struct {
+    char** words;           // the command and its arguments, with {}
+    int nwords;
+    int has_slot;           // some word contains {}
+    char** items;
+    int nitems;
+    Task* tasks;
+    int null_fd;            // /dev/null, every run's stdin
+} Parallel;
+
+static int usage(void) {
+    fprintf(stderr, "myshell: parallel: usage: parallel [-j N] command [arg...] [::: item...]\n");
+    return 2;
+}
+
+static char* replace_slots(const char* word, const char* item) {
+    StrBuf sb;
+    sb_init(&sb);
+    const char* slot;
+    while ((slot = strstr(word, "{}")) != NULL) {
+        sb_append_len(&sb, word, (size_t)(slot - word));
+        sb_append(&sb, item);
+        word = slot + 2;
+    }
+    sb_append(&sb, word);
+    return sb_release(&sb);
+}
+
+// The command line for one item
+static char** item_argv(const Parallel* par, const char* item, int* argc) {
+    int n = par->nwords + (par->has_slot ? 0 : 1);
+    char** argv = xmalloc((n + 1) * sizeof(char*));
+    for (int i = 0; i < par->nwords; i++) argv[i] = replace_slots(par->words[i], item);
+    if (!par->has_slot) argv[par->nwords] = xstrdup(item);
+    argv[n] = NULL;
+    *argc = n;
+    return argv;
+}
+
+// Start one run with its stdin on /dev/null and its stdout on a new pipe.
+// A run that cannot start is done at once with the spawn error's status.
+static void start_task(Parallel* par, int index, int running_from) {
+    Task* task = &par->tasks[index];
+    int argc;
+    char** argv = item_argv(par, par->items[index], &argc);
+    task->fd = -1;
+    task->pid = -1;
+    task->status = 1;
+
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("myshell: parallel: pipe");
+        task->done = 1;
+    }
+    else {
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+        int slot = function_find(argv[0]);
+        int in_shell = builtin_lookup(argv[0]) >= 0 || (slot >= 0 && function_get(slot));
+
+        out_flush();
+        fflush(stderr);
+        input_sync_all();
+        RedirUndo undo;
+        redir_undo_init(&undo);
+        if (par->null_fd >= 0) redirect_fd(0, par->null_fd, &undo);
+        redirect_fd(1, fds[1], &undo);
+        if (in_shell) {
+            task->pid = fork();
+            if (task->pid == 0) {
+                // Other runs' pipes must not stay open in this one
+                for (int i = running_from; i < index; i++) {
+                    if (par->tasks[i].fd >= 0) close(par->tasks[i].fd);
+                }
+                close(fds[0]);
+                close(fds[1]);
+                vm_run_command(argc, argv);
+                out_flush();
+                input_sync_all();
+                _exit(get_exit_status());
+            }
+            if (task->pid < 0) perror("fork");
+        }
+        else {
+            task->status = spawn_start(argv, NULL, 0, &task->pid);
+            if (task->status != 0) task->pid = -1;
+        }
+        redirect_restore(&undo);
+        redir_undo_free(&undo);
+
+        close(fds[1]);
+        if (task->pid > 0) task->fd = fds[0];
+        else close(fds[0]);
+        task->done = task->pid <= 0;
+    }
+
+    for (int i = 0; i < argc; i++) free(argv[i]);
+    free(argv);
+}
+
+// Read what a run wrote. The run whose output is next in order writes
+// straight through; the others are held until it is their turn. Returns 0
+// once the run has closed its end and been waited for.
+static int read_task(Task* task, int head) {
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(task->fd, buffer, sizeof(buffer))) < 0 && errno == EINTR) {
+        // Interrupted; read again
+    }
+    if (n > 0) {
+        if (head) {
+            // What it wrote before its turn comes first
+            if (task->out.data) {
+                out_write(task->out.data, task->out.len);
+                sb_free(&task->out);
+            }
+            out_write(buffer, (size_t)n);
+        }
+        else {
+            if (!task->out.data) sb_init(&task->out);
+            sb_append_len(&task->out, buffer, (size_t)n);
+        }
+        return 1;
+    }
+    close(task->fd);
+    task->fd = -1;
+    task->status = wait_child(task->pid);
+    task->done = 1;
+    return 0;
+}
+
+// The items after :::, or else one per line of stdin
+static char** read_items(int* count) {
+    int cap = 16;
+    char** items = xmalloc(cap * sizeof(char*));
+    *count = 0;
+    StrBuf line;
+    sb_init(&line);
+    for (;;) {
+        int found = input_line(0, '\n', &line);
+        if (!found && line.len == 0) break;
+        if (*count == cap) {
+            cap *= 2;
+            items = xrealloc(items, cap * sizeof(char*));
+        }
+        items[(*count)++] = xstrndup(line.data, line.len);
+        sb_clear(&line);
+        if (!found) break;
+    }
+    sb_free(&line);
+    return items;
+}
+
+static int parse_jobs(const char* text, long* jobs) {
+    char* end;
+    *jobs = strtol(text, &end, 10);
+    if (end == text || *end || *jobs < 0) {
+        fprintf(stderr, "myshell: parallel: %s: invalid number of jobs\n", text);
+        return 0;
+    }
+    return 1;
+}
+
+int parallel_command(int argc, char** argv) {
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            if (!parse_jobs(argv[++i], &jobs)) return 2;
+        }
+        else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2]) {
+            if (!parse_jobs(argv[i] + 2, &jobs)) return 2;
+        }
+        else {
+            return usage();
+        }
+    }
+
+    Parallel par;
+    par.words = argv + i;
+    par.nwords = 0;
+    while (i + par.nwords < argc && strcmp(argv[i + par.nwords], ":::") != 0) par.nwords++;
+    if (par.nwords == 0) return usage();
+    par.has_slot = 0;
+    for (int w = 0; w < par.nwords; w++) par.has_slot |= strstr(par.words[w], "{}") != NULL;
+
+    int from_stdin = i + par.nwords == argc;
+    if (from_stdin) {
+        par.items = read_items(&par.nitems);
+    }
+    else {
+        par.items = argv + i + par.nwords + 1;
+        par.nitems = argc - i - par.nwords - 1;
+    }
+    // -j 0 runs every item at once
+    if (jobs <= 0 || jobs > par.nitems) jobs = par.nitems > 0 ? par.nitems : 1;
+
+    par.null_fd = open("/dev/null", O_RDONLY);
+    if (par.null_fd >= 0) fcntl(par.null_fd, F_SETFD, FD_CLOEXEC);
+    par.tasks = xcalloc(par.nitems > 0 ? par.nitems : 1, sizeof(Task));
+    struct pollfd* fds = xmalloc(jobs * sizeof(struct pollfd));
+    int* owners = xmalloc(jobs * sizeof(int));
+
+    int started = 0;
+    int emitted = 0;
+    int running = 0;
+    int failed = 0;
+    while (emitted < par.nitems) {
+        while (running < jobs && started < par.nitems) {
+            start_task(&par, started, emitted);
+            if (!par.tasks[started].done) running++;
+            started++;
+        }
+
+        // Write out every finished run that is next in order
+        while (emitted < started && par.tasks[emitted].done) {
+            Task* task = &par.tasks[emitted++];
+            if (task->out.data) {
+                out_write(task->out.data, task->out.len);
+                sb_free(&task->out);
+            }
+            if (task->status != 0) failed++;
+        }
+        if (running == 0) continue;
+
+        int nfds = 0;
+        for (int t = emitted; t < started; t++) {
+            if (par.tasks[t].fd < 0) continue;
+            fds[nfds].fd = par.tasks[t].fd;
+            fds[nfds].events = POLLIN;
+            fds[nfds].revents = 0;
+            owners[nfds++] = t;
+        }
+        if (poll(fds, nfds, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("myshell: parallel: poll");
+            break;
+        }
+        for (int f = 0; f < nfds; f++) {
+            if (!fds[f].revents) continue;
+            if (!read_task(&par.tasks[owners[f]], owners[f] == emitted)) running--;
+        }
+    }
+
+    free(fds);
+    free(owners);
+    free(par.tasks);
+    if (par.null_fd >= 0) close(par.null_fd);
+    if (from_stdin) {
+        for (int t = 0; t < par.nitems; t++) free(par.items[t]);
+        free(par.items);
+    }
+    return failed > MAX_FAILED_STATUS - 1 ? MAX_FAILED_STATUS : failed;
+}
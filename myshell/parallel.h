@@ -0,0 +1,18 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// parallel [-j N] command [arg...] [::: item...]
+//
+// Runs the command once per item, at most N at a time (default: one per
+// online CPU). Each {} in the arguments is replaced by the item; without
+// one the item is appended. Items come from the arguments after :::, or
+// one per line from stdin. Every run's output goes to a pipe and is
+// written out in item order, so the result is the same as running the
+// items one after another. Programs are spawned directly; functions and
+// builtins run in a forked copy of the shell.
+//
+// The status is 0 when every run succeeded, otherwise the number of runs
+// that failed, up to 101 for more than 100, as GNU parallel reports it.
+int parallel_command(int argc, char** argv);
+
+#endif
@@ -1,829 +1,586 @@
 #include "parser.h"
+#include "compile.h"
+#include "vm.h"
 #include "env.h"
-#include "executor.h"
+#include "util.h"
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
 
-#define MAX_LINE 256
-#define MAX_BLOCK 100
-
-// Enhanced condition evaluation to handle string comparisons and file tests
-static int eval_condition(const char* condition) {
-    if (!condition) return 0;
-    
-    // Parse condition in format like: [ "$var" = "value" ] or [ $var -eq 5 ]
-    char temp[MAX_LINE];
-    strcpy(temp, condition);
-
-    // Remove brackets if present
-    char* start = temp;
-    char* end = temp + strlen(temp) - 1;
-    while (*start == ' ' || *start == '[') start++;
-    while (end > start && (*end == ' ' || *end == ']')) end--;
-    *(end + 1) = '\0';
-
-    // Tokenize the condition
-    char* token1 = strtok(start, " ");
-    if (!token1) return 0;
-    
-    char* token2 = strtok(NULL, " ");
-    if (!token2) return 0;
-    
-    char* token3 = strtok(NULL, " ");
-    if (!token3) return 0;
-
-    char val1[64], val2[64];
-    if (token1[0] == '$') {
-        // Process the token to handle variable substitution
-        char temp_token1[MAX_LINE];
-        strcpy(temp_token1, token1);
-        replace_vars(temp_token1);
-        strcpy(val1, temp_token1);
-    }
-    else {
-        // Remove quotes if present
-        if ((token1[0] == '"' || token1[0] == '\'') &&
-            token1[strlen(token1) - 1] == token1[0]) {
-            strcpy(val1, token1 + 1);
-            val1[strlen(val1) - 1] = '\0';
-        }
-        else {
-            strcpy(val1, token1);
-        }
-    }
-
-    if (token3[0] == '$') {
-        // Process the token to handle variable substitution
-        char temp_token3[MAX_LINE];
-        strcpy(temp_token3, token3);
-        replace_vars(temp_token3);
-        strcpy(val2, temp_token3);
-    }
-    else {
-        // Remove quotes if present
-        if ((token3[0] == '"' || token3[0] == '\'') &&
-            token3[strlen(token3) - 1] == token3[0]) {
-            strcpy(val2, token3 + 1);
-            val2[strlen(val2) - 1] = '\0';
-        }
-        else {
-            strcpy(val2, token3);
-        }
-    }
-
-    // Compare based on operator
-    if (strcmp(token2, "=") == 0 || strcmp(token2, "==") == 0) {
-        return strcmp(val1, val2) == 0;
-    }
-    else if (strcmp(token2, "!=") == 0) {
-        return strcmp(val1, val2) != 0;
-    }
-    else if (strcmp(token2, "-eq") == 0) {
-        return atoi(val1) == atoi(val2);
-    }
-    else if (strcmp(token2, "-ne") == 0) {
-        return atoi(val1) != atoi(val2);
-    }
-    else if (strcmp(token2, "-gt") == 0) {
-        return atoi(val1) > atoi(val2);
-    }
-    else if (strcmp(token2, "-lt") == 0) {
-        return atoi(val1) < atoi(val2);
-    }
-    else if (strcmp(token2, "-ge") == 0) {
-        return atoi(val1) >= atoi(val2);
-    }
-    else if (strcmp(token2, "-le") == 0) {
-        return atoi(val1) <= atoi(val2);
-    }
-
-    return 0;
+static void next(Parser* p) {
+    // Words that were looked at but not taken (keywords) are dropped here
+    word_free(p->tok.word);
+    p->tok = lexer_next(&p->lx);
 }
 
-// Simple arithmetic expression evaluator
-static int evaluate_simple_arithmetic(const char* expr) {
-    if (!expr) return 0;
-    char expr_copy[MAX_LINE];
-    strcpy(expr_copy, expr);
+void parser_init(Parser* p, Source* src) {
+    parser_init_at(p, src, 1);
+}
 
-    int result = 0;
-    char* token = strtok(expr_copy, " ");
+void parser_init_at(Parser* p, Source* src, int line) {
+    lexer_init(&p->lx, src);
+    p->lx.line = line;
+    p->error = 0;
+    p->depth = 0;
+    p->tok.word = NULL;
+    next(p);
+}
 
-    if (token) {
-        result = atoi(token);
-        token = strtok(NULL, " ");
+void parser_free(Parser* p) {
+    lexer_drop_heredocs(&p->lx);
+    word_free(p->tok.word);
+    p->tok.word = NULL;
+}
 
-        while (token) {
-            if (strcmp(token, "+") == 0) {
-                token = strtok(NULL, " ");
-                if (token) result += atoi(token);
-            }
-            else if (strcmp(token, "-") == 0) {
-                token = strtok(NULL, " ");
-                if (token) result -= atoi(token);
-            }
-            else if (strcmp(token, "*") == 0) {
-                token = strtok(NULL, " ");
-                if (token) result *= atoi(token);
-            }
-            else if (strcmp(token, "/") == 0) {
-                token = strtok(NULL, " ");
-                if (token) {
-                    int divisor = atoi(token);
-                    if (divisor != 0) result /= divisor;
-                }
-            }
-            token = strtok(NULL, " ");
-        }
+static void syntax_error(Parser* p) {
+    if (p->error) return;
+    p->error = 1;
+    // Commands being dropped may own the words bodies would be read into
+    lexer_drop_heredocs(&p->lx);
+    if (p->tok.type == TOK_ERROR) {
+        fprintf(stderr, "myshell: line %d, column %d: syntax error: %s\n",
+            p->tok.line, p->tok.column, p->tok.error);
+    }
+    else {
+        fprintf(stderr, "myshell: line %d, column %d: syntax error near unexpected token `%s'\n",
+            p->tok.line, p->tok.column, token_name(&p->tok));
     }
-
-    return result;
 }
 
-// Check if a line is an arithmetic assignment
-static int is_arithmetic_assignment(const char* line) {
-    if (!line) return 0;
-    // Check for pattern: variable=$((expression))
-    char* eq = strchr(line, '=');
-    if (!eq) return 0;
+// Take ownership of the current word token and advance
+static Word* take_word(Parser* p) {
+    Word* word = p->tok.word;
+    p->tok.word = NULL;
+    next(p);
+    return word;
+}
 
-    char* arith_start = strstr(eq, "$((");
-    if (!arith_start || arith_start != eq + 1) return 0;
+static int is_keyword(Parser* p, const char* keyword) {
+    return p->tok.type == TOK_WORD && word_is(p->tok.word, keyword);
+}
 
+static int expect_keyword(Parser* p, const char* keyword) {
+    if (!is_keyword(p, keyword)) {
+        syntax_error(p);
+        return 0;
+    }
+    next(p);
     return 1;
 }
 
-// Process arithmetic assignment
-static void process_arithmetic_assignment(const char* line) {
-    if (!line) return;
-    char temp_line[MAX_LINE];
-    strcpy(temp_line, line);
-
-    char* eq = strchr(temp_line, '=');
-    if (!eq) return;
-
-    *eq = '\0';
-    char* var_name = temp_line;
-    char* value_expr = eq + 1;
-
-    // Trim spaces from variable name
-    while (*var_name == ' ' || *var_name == '\t') var_name++;
-    char* end = var_name + strlen(var_name) - 1;
-    while (end > var_name && (*end == ' ' || *end == '\t')) end--;
-    *(end + 1) = '\0';
-
-    // Check if this is arithmetic expression $((expr))
-    if (strncmp(value_expr, "$((", 3) == 0) {
-        char* expr_start = value_expr + 3;
-        char* expr_end = strstr(expr_start, "))");
-        if (expr_end) {
-            *expr_end = '\0';
-
-            // Replace variables in arithmetic expression
-            char processed_expr[MAX_LINE];
-            replace_arithmetic_vars(expr_start, processed_expr);
-
-            // Evaluate arithmetic
-            int result = evaluate_simple_arithmetic(processed_expr);
-
-            char result_str[32];
-            sprintf(result_str, "%d", result);
-            set_var(var_name, result_str);
-        }
+static void skip_newlines(Parser* p) {
+    while (p->tok.type == TOK_NEWLINE) next(p);
+}
+
+// Tokens that close a compound list
+static int at_list_end(Parser* p) {
+    static const char* const terminators[] = {
+        "then", "elif", "else", "fi", "do", "done", "esac", "}", NULL
+    };
+
+    if (p->tok.type == TOK_EOF || p->tok.type == TOK_RPAREN || p->tok.type == TOK_DSEMI) return 1;
+    if (p->tok.type != TOK_WORD) return 0;
+    for (int i = 0; terminators[i]; i++) {
+        if (word_is(p->tok.word, terminators[i])) return 1;
     }
+    return 0;
 }
 
-// Function to split a command line by semicolons for sequential execution
-static void execute_sequential_commands(char* line) {
-    if (!line) return;
-    // Make a copy of the line to work with
-    char work_line[MAX_LINE];
-    strcpy(work_line, line);
-
-    // Find the first semicolon to split commands
-    char* cmd = strtok(work_line, ";");
-    while (cmd != NULL) {
-        // Trim leading/trailing spaces
-        while (*cmd == ' ' || *cmd == '\t') cmd++;
-        char* end = cmd + strlen(cmd) - 1;
-        while (end > cmd && (*end == ' ' || *end == '\t')) end--;
-        *(end + 1) = '\0';
-
-        if (strlen(cmd) > 0) {
-            char temp_cmd[MAX_LINE];
-            strcpy(temp_cmd, cmd);
-            replace_vars(temp_cmd);
-            exec_cmd(temp_cmd);
-        }
-        cmd = strtok(NULL, ";");
+static int is_valid_name(const char* s, size_t len) {
+    if (len == 0 || !(s[0] == '_' || isalpha((unsigned char)s[0]))) return 0;
+    for (size_t i = 1; i < len; i++) {
+        if (!(s[i] == '_' || isalnum((unsigned char)s[i]))) return 0;
     }
+    return 1;
 }
 
-// Function to execute conditional commands with && and ||
-static void execute_conditional_commands(char* line) {
-    if (!line) return;
-    // First check if this is an arithmetic assignment
-    if (is_arithmetic_assignment(line)) {
-        process_arithmetic_assignment(line);
-        return;
-    }
-
-    // Check for && first
-    char temp_line[MAX_LINE];
-    strcpy(temp_line, line);
-
-    char* and_pos = strstr(temp_line, "&&");
-    if (and_pos) {
-        *and_pos = '\0';
-        and_pos += 2;
-
-        // Trim spaces
-        char* cmd1 = temp_line;
-        while (*cmd1 == ' ' || *cmd1 == '\t') cmd1++;
-        char* end = cmd1 + strlen(cmd1) - 1;
-        while (end > cmd1 && (*end == ' ' || *end == '\t')) end--;
-        *(end + 1) = '\0';
-
-        char* cmd2 = and_pos;
-        while (*cmd2 == ' ' || *cmd2 == '\t') cmd2++;
-
-        if (strlen(cmd1) > 0) {
-            char temp_cmd1[MAX_LINE];
-            strcpy(temp_cmd1, cmd1);
-            execute_sequential_commands(temp_cmd1);
-        }
+// Split NAME=value words into an assignment; returns NULL for other words
+static Assign* as_assignment(Word* word) {
+    WordPart* first = word->parts;
+    if (!first || first->type != PART_LITERAL || first->quoted) return NULL;
 
-        // Execute second command only if first succeeded
-        if (get_exit_status() == 0) {
-            if (strlen(cmd2) > 0) {
-                char temp_cmd2[MAX_LINE];
-                strcpy(temp_cmd2, cmd2);
-                execute_conditional_commands(temp_cmd2);
-            }
-        }
-        return;
-    }
+    char* eq = strchr(first->text, '=');
+    if (!eq || !is_valid_name(first->text, eq - first->text)) return NULL;
 
-    // Check for ||
-    char* or_pos = strstr(temp_line, "||");
-    if (or_pos) {
-        *or_pos = '\0';
-        or_pos += 2;
+    Assign* assign = xcalloc(1, sizeof(Assign));
+    assign->name = xstrndup(first->text, eq - first->text);
 
-        // Trim spaces
-        char* cmd1 = temp_line;
-        while (*cmd1 == ' ' || *cmd1 == '\t') cmd1++;
-        char* end = cmd1 + strlen(cmd1) - 1;
-        while (end > cmd1 && (*end == ' ' || *end == '\t')) end--;
-        *(end + 1) = '\0';
+    // The value keeps the remaining parts; the first one loses "NAME="
+    char* rest = xstrdup(eq + 1);
+    free(first->text);
+    first->text = rest;
+    assign->value = word;
+    return assign;
+}
 
-        char* cmd2 = or_pos;
-        while (*cmd2 == ' ' || *cmd2 == '\t') cmd2++;
+static Node* parse_and_or(Parser* p);
+static Node* parse_command(Parser* p);
 
-        if (strlen(cmd1) > 0) {
-            char temp_cmd1[MAX_LINE];
-            strcpy(temp_cmd1, cmd1);
-            execute_sequential_commands(temp_cmd1);
-        }
+// Bodies nest by recursion here, in the compiler and in node_free, so
+// absurdly deep nesting is a syntax error rather than a stack overflow.
+// The limit is far above anything a real script needs.
+#define MAX_NESTING 1000
 
-        // Execute second command only if first failed
-        if (get_exit_status() != 0) {
-            if (strlen(cmd2) > 0) {
-                char temp_cmd2[MAX_LINE];
-                strcpy(temp_cmd2, cmd2);
-                execute_conditional_commands(temp_cmd2);
-            }
-        }
-        return;
+static int enter_body(Parser* p) {
+    if (p->depth < MAX_NESTING) {
+        p->depth++;
+        return 1;
     }
-
-    // If no && or ||, execute normally
-    execute_sequential_commands(line);
+    if (!p->error) {
+        p->error = 1;
+        fprintf(stderr, "myshell: line %d: compound commands nested too deeply\n", p->tok.line);
+    }
+    return 0;
 }
 
-// Check if a line is a comment
-static int is_comment(const char* line) {
-    if (!line) return 0;
-    const char* p = line;
-    while (*p == ' ' || *p == '\t') p++;
-    return *p == '#';
+// An and-or list followed by '&' becomes a background job
+static Node* background(Node* node) {
+    Node* job = node_new(NODE_BACKGROUND, node->line);
+    job->u.background.body = node;
+    return job;
 }
 
-// Enhanced function to handle if-elif-else-fi structures
-static void handle_if_statement(FILE* fp) {
-    if (!fp) return;
-    char line[MAX_LINE];
-    char condition[MAX_LINE] = "";
+// compound_list: and-or lists separated by ';', '&' or newlines
+static Node* parse_list(Parser* p) {
+    Node* head = NULL;
+    Node** tail = &head;
+    if (!enter_body(p)) return NULL;
 
-    // Read the condition line
-    if (fgets(line, sizeof(line), fp)) {
-        line[strcspn(line, "\r\n")] = 0;
+    for (;;) {
+        skip_newlines(p);
+        if (p->error || at_list_end(p)) break;
 
-        // Check if 'then' is on the same line
-        char* then_pos = strstr(line, "; then");
-        if (!then_pos) {
-            then_pos = strstr(line, " then");  // Space before 'then'
-        }
-        
-        if (then_pos) {
-            // Extract condition from 'if ... then'
-            *then_pos = '\0';
-            strcpy(condition, line);
-        }
-        else {
-            // 'then' might be on the next line, so just copy the whole line
-            strcpy(condition, line);
-            
-            // Check if current line ends with 'then' or contains 'then' in a different format
-            char* stripped_line = line;
-            while (*stripped_line == ' ' || *stripped_line == '\t') stripped_line++;
-            
-            // If it contains 'if' but no 'then', read next line to see if it's 'then'
-            if (strncmp(stripped_line, "if ", 3) == 0 || strcmp(stripped_line, "if") == 0) {
-                // Read next line to see if it's just 'then'
-                char next_line[MAX_LINE];
-                if (fgets(next_line, sizeof(next_line), fp)) {
-                    next_line[strcspn(next_line, "\r\n")] = 0;
-                    char* next_stripped = next_line;
-                    while (*next_stripped == ' ' || *next_stripped == '\t') next_stripped++;
-                    
-                    if (strcmp(next_stripped, "then") == 0) {
-                        // The condition is in the original line, 'then' is on next line
-                        strcpy(condition, line);
-                    } else {
-                        // The next line is not 'then', so we put it back conceptually
-                        // For now, we'll just continue with the condition from the first line
-                        strcpy(condition, line);
-                    }
-                }
-            }
-        }
-        
-        // Remove 'if' from the beginning of the condition if present
-        if (strncmp(condition, "if", 2) == 0) {
-            char* temp = condition + 2;
-            if (*temp == ' ' || *temp == '\t') {
-                temp++;
-                while (*temp == ' ' || *temp == '\t') temp++;
-                strcpy(condition, temp);
-            }
-        }
-    }
-
-    char block[MAX_BLOCK][MAX_LINE];
-    int block_len = 0;
-    int elif_found = 0;
-    int else_found = 0;
-
-    // Read commands until elif, else, or fi
-    while (fgets(line, sizeof(line), fp)) {
-        line[strcspn(line, "\r\n")] = 0;
+        Node* node = parse_and_or(p);
+        if (!node) break;
+        if (p->tok.type == TOK_AMP) node = background(node);
+        *tail = node;
+        tail = &node->next;
 
-        // Check if this is a continuation of the condition with 'then' on a separate line
-        if (block_len == 0) {  // First command block, check if we just had the condition
-            char* stripped_line = line;
-            while (*stripped_line == ' ' || *stripped_line == '\t') stripped_line++;
-            
-            if (strcmp(stripped_line, "then") == 0) {
-                // This is just 'then', continue reading commands
-                continue;
-            }
+        if (p->tok.type == TOK_SEMI || p->tok.type == TOK_AMP || p->tok.type == TOK_NEWLINE) {
+            next(p);
+            continue;
         }
+        if (!at_list_end(p)) syntax_error(p);
+        break;
+    }
+    p->depth--;
+    return head;
+}
 
-        if (strncmp(line, "elif", 4) == 0) {
-            elif_found = 1;
-            break;
-        }
-        if (strcmp(line, "else") == 0) {
-            else_found = 1;
-            break;
-        }
-        if (strcmp(line, "fi") == 0) {
-            if (eval_condition(condition)) {
-                for (int i = 0; i < block_len; i++) {
-                    execute_conditional_commands(block[i]);
-                }
-            }
-            return;
-        }
+static Node* parse_and_or(Parser* p) {
+    Node* left = parse_command(p);
+
+    while (left && !p->error && (p->tok.type == TOK_AND || p->tok.type == TOK_OR)) {
+        Node* node = node_new(p->tok.type == TOK_AND ? NODE_AND : NODE_OR, p->tok.line);
+        next(p);
+        skip_newlines(p);
+        node->u.binary.left = left;
+        node->u.binary.right = parse_command(p);
+        left = node;
+        if (!node->u.binary.right) break;
+    }
+    return p->error ? NULL : left;
+}
 
-        strcpy(block[block_len++], line);
+static int parse_redirect(Parser* p, Redir*** tail) {
+    Redir* redir = xcalloc(1, sizeof(Redir));
+    redir->type = p->tok.redir;
+    redir->fd = p->tok.fd;
+    if (redir->fd < 0) {
+        redir->fd = (redir->type == REDIR_IN || redir->type == REDIR_DUP_IN ||
+            redir->type == REDIR_HERESTRING || redir->type == REDIR_HEREDOC) ? 0 : 1;
     }
+    int strip_tabs = p->tok.strip_tabs;
+    next(p);
 
-    // Execute the if block if condition is true
-    if (eval_condition(condition)) {
-        for (int i = 0; i < block_len; i++) {
-            execute_conditional_commands(block[i]);
-        }
-        // Skip to 'fi' - consume the rest of the if-elif-else-fi structure
-        int nested_level = 1;
-        while (nested_level > 0 && fgets(line, sizeof(line), fp)) {
-            line[strcspn(line, "\r\n")] = 0;
-            if (strcmp(line, "fi") == 0) {
-                nested_level--;
-            }
-            else if (strncmp(line, "if", 2) == 0 && (line[2] == ' ' || line[2] == '\0')) {
-                // Handle nested if statements
-                nested_level++;
-                // Need to recursively handle the nested if statement
-                // This is complex, so we'll just continue reading until all nested if's are closed
-            }
-            else if (nested_level == 1 && (strncmp(line, "elif", 4) == 0 || strcmp(line, "else") == 0)) {
-                // These are part of the current if structure, not nested ones
-                // Continue reading until we find fi
-            }
-        }
+    if (p->tok.type != TOK_WORD) {
+        free(redir);
+        syntax_error(p);
+        return 0;
+    }
+    if (redir->type == REDIR_HEREDOC) {
+        // The body follows the line, which the next token may end
+        redir->target = xcalloc(1, sizeof(Word));
+        lexer_heredoc(&p->lx, p->tok.word, strip_tabs, redir->target);
+        next(p);
     }
     else {
-        // Condition was false
-        if (elif_found) {
-            handle_if_statement(fp);
-        }
-        else if (else_found) {
-            block_len = 0;
-            while (fgets(line, sizeof(line), fp)) {
-                line[strcspn(line, "\r\n")] = 0;
-                if (strcmp(line, "fi") == 0) break;
-                strcpy(block[block_len++], line);
-            }
-            for (int i = 0; i < block_len; i++) {
-                execute_conditional_commands(block[i]);
-            }
-        }
-        else {
-            // Skip to 'fi'
-            int nested_level = 1;
-            while (nested_level > 0 && fgets(line, sizeof(line), fp)) {
-                line[strcspn(line, "\r\n")] = 0;
-                if (strcmp(line, "fi") == 0) {
-                    nested_level--;
-                }
-                else if (strncmp(line, "if", 2) == 0 && (line[2] == ' ' || line[2] == '\0')) {
-                    nested_level++;
-                }
-            }
-        }
+        redir->target = take_word(p);
     }
+    **tail = redir;
+    *tail = &redir->next;
+    return 1;
 }
 
-// Check if a line is a case pattern (ends with ')')
-static int is_case_pattern(const char* line) {
-    if (!line) return 0;
-    char temp[MAX_LINE];
-    strcpy(temp, line);
-
-    // Trim spaces
-    char* p = temp;
-    while (*p == ' ' || *p == '\t') p++;
-
-    // Check if line contains ')' 
-    return strchr(p, ')') != NULL;
+static void parse_redirects(Parser* p, Node* node) {
+    Redir** tail = &node->redirs;
+    while (*tail) tail = &(*tail)->next;
+    while (p->tok.type == TOK_REDIR) {
+        if (!parse_redirect(p, &tail)) return;
+    }
 }
 
-// Enhanced function to handle case statements
-static void handle_case_statement(FILE* fp) {
-    if (!fp) return;
-    char line[MAX_LINE];
-    char case_var[64] = "";
-
-    // Read and process the "case ... in" line to extract variable
-    if (fgets(line, sizeof(line), fp)) {
-        line[strcspn(line, "\r\n")] = 0;
-        
-        // Extract variable from "case $name in"
-        char* case_start = line;
-        while (*case_start == ' ' || *case_start == '\t') case_start++;
-        
-        // Find "in" to extract the variable/expression
-        char* in_pos = strstr(case_start, " in");
-        if (!in_pos) {
-            in_pos = strstr(case_start, "in");
-        }
-        if (!in_pos) return;
-        
-        *in_pos = '\0';
-        strcpy(case_var, case_start);
-        
-        // Trim spaces from variable
-        char* end = case_var + strlen(case_var) - 1;
-        while (end > case_var && (*end == ' ' || *end == '\t')) {
-            *end = '\0';
-            end--;
-        }
-    }
+static Node* parse_compound(Parser* p);
 
-    // Get the value to match
-    char case_value[64] = "";
-    if (case_var[0] == '$') {
-        const char* value = get_var(case_var + 1);
-        if (value && strlen(value) > 0) {
-            strcpy(case_value, value);
-        } else {
-            strcpy(case_value, "");  // Use empty string if variable not found
-        }
-    } else {
-        strcpy(case_value, case_var);
+// The body of name() or function name: any compound command
+static Node* parse_function(Parser* p, int line, Word* name) {
+    Node* node = node_new(NODE_FUNCTION, line);
+    const char* text = word_literal(name);
+    if (!text) {
+        word_free(name);
+        syntax_error(p);
+        return node;
     }
+    node->u.function.name = xstrdup(text);
+    word_free(name);
+
+    skip_newlines(p);
+    node->u.function.body = parse_compound(p);
+    if (!node->u.function.body) {
+        syntax_error(p);
+        return node;
+    }
+    parse_redirects(p, node->u.function.body);
+    return node;
+}
 
-    int found_match = 0;
-    int should_execute = 0;
-    int skip_to_esac = 0;
-
-    // Process case options until "esac"
-    while (fgets(line, sizeof(line), fp)) {
-        line[strcspn(line, "\r\n")] = 0;
-
-        // Check for end of case
-        if (strcmp(line, "esac") == 0) {
-            return;
-        }
+// name ( ) after the name was read as a command word
+static Node* parse_function_parens(Parser* p, Node* simple) {
+    Word* name = simple->u.simple.words;
+    simple->u.simple.words = NULL;
+    int line = simple->line;
+    node_free(simple);
+
+    next(p);
+    if (p->tok.type != TOK_RPAREN) {
+        word_free(name);
+        syntax_error(p);
+        return node_new(NODE_FUNCTION, line);
+    }
+    next(p);
+    return parse_function(p, line, name);
+}
 
-        // Check if this is a pattern line (contains ')')
-        char* pattern_end = strchr(line, ')');
-        if (pattern_end) {
-            // Extract pattern before ')'
-            char temp_line[MAX_LINE];
-            strcpy(temp_line, line);
-            temp_line[pattern_end - line] = '\0';
-            
-            char* pattern = temp_line;
-            // Skip leading spaces
-            while (*pattern == ' ' || *pattern == '\t') pattern++;
-
-            // Remove quotes if present
-            int len = strlen(pattern);
-            if (len >= 2 &&
-                ((pattern[0] == '"' && pattern[len - 1] == '"') ||
-                    (pattern[0] == '\'' && pattern[len - 1] == '\''))) {
-                pattern[len - 1] = '\0';
-                pattern++;
-            }
+static Node* parse_simple(Parser* p) {
+    Node* node = node_new(NODE_SIMPLE, p->tok.line);
+    Assign** assign_tail = &node->u.simple.assigns;
+    Word** word_tail = &node->u.simple.words;
+    Redir** redir_tail = &node->redirs;
 
-            // Check if this pattern matches
-            if (!found_match && (strcmp(pattern, case_value) == 0 || strcmp(pattern, "*") == 0)) {
-                found_match = 1;
-                should_execute = 1;
-            } else {
-                should_execute = 0;  // This pattern doesn't match
+    for (;;) {
+        if (p->tok.type == TOK_WORD) {
+            Word* word = take_word(p);
+            Assign* assign = node->u.simple.words ? NULL : as_assignment(word);
+            if (assign) {
+                *assign_tail = assign;
+                assign_tail = &assign->next;
             }
-
-            // Check if there are commands after the ')'
-            char* cmd_start = line + (pattern_end - temp_line) + 1;
-            while (*cmd_start == ' ' || *cmd_start == '\t') cmd_start++;
-            
-            // If there are commands on the same line as the pattern
-            if (strlen(cmd_start) > 0) {
-                char* double_semicolon = strstr(cmd_start, ";;");
-                if (double_semicolon) {
-                    // Command ends with ;;
-                    *double_semicolon = '\0';
-                    // Trim trailing spaces
-                    char* end_ptr = double_semicolon - 1;
-                    while (end_ptr > cmd_start && (*end_ptr == ' ' || *end_ptr == '\t')) {
-                        *end_ptr = '\0';
-                        end_ptr--;
-                    }
-                    
-                    if (strlen(cmd_start) > 0 && should_execute) {
-                        execute_conditional_commands(cmd_start);
-                    }
-                    // After ;;, we've completed this case option
-                    if (should_execute) {
-                        skip_to_esac = 1;  // Skip remaining case options
-                    }
-                } else {
-                    // Command continues until ;;
-                    if (should_execute) {
-                        execute_conditional_commands(cmd_start);
-                    }
-                    // Don't set skip_to_esac yet, we need to continue looking for ;;
+            else {
+                *word_tail = word;
+                word_tail = &word->next;
+                if (p->tok.type == TOK_LPAREN && node->u.simple.words == word &&
+                    !node->u.simple.assigns && !node->redirs) {
+                    return parse_function_parens(p, node);
                 }
             }
-            // If no commands on same line, commands will be on following lines
-            // The should_execute flag is set, so we'll execute commands until ;;
         }
-        // Check if line is ;;
-        else if (strcmp(line, ";;") == 0) {
-            if (should_execute) {
-                skip_to_esac = 1;  // Skip remaining case options after executing one
-            }
-            should_execute = 0;  // Reset execution flag for next case option
-        }
-        // Regular command line inside a case option
-        else if (should_execute) {
-            // This is a command inside a matching case option
-            char* trimmed_line = line;
-            while (*trimmed_line == ' ' || *trimmed_line == '\t') trimmed_line++;
-            
-            if (strcmp(trimmed_line, ";;") == 0) {
-                // Found ;;, end of this case option
-                skip_to_esac = 1;  // Skip remaining case options after executing one
-                should_execute = 0; // Reset execution flag
-            } else {
-                // Execute the command
-                execute_conditional_commands(line);
-            }
+        else if (p->tok.type == TOK_REDIR) {
+            if (!parse_redirect(p, &redir_tail)) break;
         }
-        
-        // If we found a match and executed it, skip to esac
-        if (skip_to_esac) {
-            // Continue reading until we find esac
-            while (fgets(line, sizeof(line), fp)) {
-                line[strcspn(line, "\r\n")] = 0;
-                if (strcmp(line, "esac") == 0) {
-                    return;  // Exit function when we find esac
-                }
-            }
-            return;  // In case we reach EOF
+        else {
+            break;
         }
     }
-}
-
-void interpret(FILE* fp) {
-    if (!fp) return;
-    char line[MAX_LINE];
-    char block[MAX_BLOCK][MAX_LINE];
-    int block_len;
 
-    init_special_vars();
+    if (p->tok.type == TOK_ERROR) syntax_error(p);
+    if (!node->u.simple.words && !node->u.simple.assigns && !node->redirs) syntax_error(p);
+    return node;
+}
 
-    while (fgets(line, sizeof(line), fp)) {
-        line[strcspn(line, "\r\n")] = 0;
-        if (strlen(line) == 0) continue;
+// Called with 'if' or 'elif' already consumed; elif chains share the final 'fi'
+static Node* parse_if(Parser* p, int line) {
+    Node* node = node_new(NODE_IF, line);
+    node->u.if_stmt.cond = parse_list(p);
+    if (!expect_keyword(p, "then")) return node;
+    node->u.if_stmt.then_body = parse_list(p);
+
+    if (is_keyword(p, "elif")) {
+        int elif_line = p->tok.line;
+        next(p);
+        if (!enter_body(p)) return node;
+        node->u.if_stmt.else_body = parse_if(p, elif_line);
+        p->depth--;
+        return node;
+    }
+    if (is_keyword(p, "else")) {
+        next(p);
+        node->u.if_stmt.else_body = parse_list(p);
+    }
+    expect_keyword(p, "fi");
+    return node;
+}
 
-        if (is_comment(line)) continue;
+static Node* parse_for(Parser* p, int line) {
+    Node* node = node_new(NODE_FOR, line);
 
-        // Variable assignment
-        if (strchr(line, '=') &&
-            strncmp(line, "if", 2) != 0 &&
-            strncmp(line, "for", 3) != 0 &&
-            strncmp(line, "while", 5) != 0 &&
-            strncmp(line, "export", 6) != 0) {
+    const char* name = p->tok.type == TOK_WORD ? word_literal(p->tok.word) : NULL;
+    if (!name || !is_valid_name(name, strlen(name))) {
+        syntax_error(p);
+        return node;
+    }
+    node->u.for_loop.var = xstrdup(name);
+    next(p);
+    skip_newlines(p);
+
+    if (is_keyword(p, "in")) {
+        next(p);
+        Word** tail = &node->u.for_loop.words;
+        while (p->tok.type == TOK_WORD) {
+            *tail = take_word(p);
+            tail = &(*tail)->next;
+        }
+        if (p->tok.type != TOK_SEMI && p->tok.type != TOK_NEWLINE) {
+            syntax_error(p);
+            return node;
+        }
+        next(p);
+    }
+    else {
+        // "for name; do" iterates over the positional parameters
+        Word* word = xcalloc(1, sizeof(Word));
+        word->parts = xcalloc(1, sizeof(WordPart));
+        word->parts->type = PART_VAR;
+        word->parts->quoted = 1;
+        word->parts->text = xstrdup("@");
+        node->u.for_loop.words = word;
+        if (p->tok.type == TOK_SEMI) next(p);
+    }
 
-            if (is_arithmetic_assignment(line)) {
-                process_arithmetic_assignment(line);
-                continue;
-            }
+    skip_newlines(p);
+    if (!expect_keyword(p, "do")) return node;
+    node->u.for_loop.body = parse_list(p);
+    expect_keyword(p, "done");
+    return node;
+}
 
-            // Regular assignment
-            char* eq = strchr(line, '=');
-            if (eq) {
-                *eq = '\0';
-                char* var_name = line;
-                char* value = eq + 1;
-
-                // Trim variable name
-                while (*var_name == ' ' || *var_name == '\t') var_name++;
-                char* end = var_name + strlen(var_name) - 1;
-                while (end > var_name && (*end == ' ' || *end == '\t')) end--;
-                *(end + 1) = '\0';
-
-                // Process value - remove surrounding quotes if present
-                char processed_value[MAX_LINE];
-                strcpy(processed_value, value);
-
-                // Check for quotes and remove them
-                int len = strlen(processed_value);
-                if (len >= 2 &&
-                    ((processed_value[0] == '"' && processed_value[len - 1] == '"') ||
-                        (processed_value[0] == '\'' && processed_value[len - 1] == '\''))) {
-                    processed_value[len - 1] = '\0';
-                    strcpy(processed_value, processed_value + 1);
-                }
+// while and until share a node; until runs the body while cond fails
+static Node* parse_while(Parser* p, int line, int until) {
+    Node* node = node_new(NODE_WHILE, line);
+    node->u.while_loop.until = until;
+    node->u.while_loop.cond = parse_list(p);
+    if (!expect_keyword(p, "do")) return node;
+    node->u.while_loop.body = parse_list(p);
+    expect_keyword(p, "done");
+    return node;
+}
 
-                // Then do variable substitution
-                replace_vars(processed_value);
-                set_var(var_name, processed_value);
-            }
-            continue;
-        }
+static Node* parse_case(Parser* p, int line) {
+    Node* node = node_new(NODE_CASE, line);
 
-        // Handle if statements
-        if (strncmp(line, "if", 2) == 0 && (line[2] == ' ' || line[2] == '\0')) {
-            handle_if_statement(fp);
-            continue;
+    if (p->tok.type != TOK_WORD) {
+        syntax_error(p);
+        return node;
+    }
+    node->u.case_stmt.subject = take_word(p);
+    skip_newlines(p);
+    if (!expect_keyword(p, "in")) return node;
+    skip_newlines(p);
+
+    CaseArm** arm_tail = &node->u.case_stmt.arms;
+    while (!p->error && !is_keyword(p, "esac")) {
+        CaseArm* arm = xcalloc(1, sizeof(CaseArm));
+        *arm_tail = arm;
+        arm_tail = &arm->next;
+
+        if (p->tok.type == TOK_LPAREN) next(p);
+
+        // pattern ('|' pattern)* ')'
+        Word** pattern_tail = &arm->patterns;
+        for (;;) {
+            if (p->tok.type != TOK_WORD) {
+                syntax_error(p);
+                return node;
+            }
+            *pattern_tail = take_word(p);
+            pattern_tail = &(*pattern_tail)->next;
+            if (p->tok.type != TOK_PIPE) break;
+            next(p);
+        }
+        if (p->tok.type != TOK_RPAREN) {
+            syntax_error(p);
+            return node;
+        }
+        next(p);
+
+        arm->body = parse_list(p);
+        if (p->tok.type == TOK_DSEMI) {
+            next(p);
+            skip_newlines(p);
+        }
+        else if (!is_keyword(p, "esac")) {
+            syntax_error(p);
+            return node;
         }
+    }
+    expect_keyword(p, "esac");
+    return node;
+}
 
-        // Handle for loops
-        if (strncmp(line, "for", 3) == 0) {
-            char var[32];
-            char values[10][32];
-            int vcount = 0;
-
-            char temp_line[MAX_LINE];
-            strcpy(temp_line, line);
+static Node* parse_group(Parser* p, int line) {
+    Node* node = node_new(NODE_GROUP, line);
+    node->u.group.body = parse_list(p);
+    expect_keyword(p, "}");
+    return node;
+}
 
-            char* do_pos = strstr(temp_line, "do");
-            char* semicolon_pos = strchr(temp_line, ';');
+static Node* parse_compound(Parser* p) {
+    int line = p->tok.line;
 
-            if (semicolon_pos && do_pos) {
-                *do_pos = '\0';
-            }
+    if (is_keyword(p, "if")) {
+        next(p);
+        return parse_if(p, line);
+    }
+    if (is_keyword(p, "for")) {
+        next(p);
+        return parse_for(p, line);
+    }
+    if (is_keyword(p, "while") || is_keyword(p, "until")) {
+        int until = is_keyword(p, "until");
+        next(p);
+        return parse_while(p, line, until);
+    }
+    if (is_keyword(p, "case")) {
+        next(p);
+        return parse_case(p, line);
+    }
+    if (is_keyword(p, "{")) {
+        next(p);
+        return parse_group(p, line);
+    }
+    if (is_keyword(p, "function")) {
+        next(p);
+        if (p->tok.type != TOK_WORD) {
+            syntax_error(p);
+            return node_new(NODE_FUNCTION, line);
+        }
+        Word* name = take_word(p);
+        if (p->tok.type == TOK_LPAREN) {
+            next(p);
+            if (p->tok.type != TOK_RPAREN) {
+                word_free(name);
+                syntax_error(p);
+                return node_new(NODE_FUNCTION, line);
+            }
+            next(p);
+        }
+        return parse_function(p, line, name);
+    }
+    return NULL;
+}
 
-            char* token = strtok(temp_line, " \t");
-            if (token && strcmp(token, "for") == 0) {
-                token = strtok(NULL, " \t");
-                if (token) {
-                    strcpy(var, token);
-                    token = strtok(NULL, " \t");
-                    if (token && strcmp(token, "in") == 0) {
-                        while ((token = strtok(NULL, " \t")) != NULL) {
-                            if (strcmp(token, ";") == 0 || strcmp(token, "do") == 0) break;
-                            int len = strlen(token);
-                            if (len > 0 && token[len - 1] == ';') {
-                                token[len - 1] = '\0';
-                            }
-                            strcpy(values[vcount++], token);
-                        }
-                    }
-                }
-            }
+// pipeline: ['!'] command ('|' command)*
+static Node* parse_command(Parser* p) {
+    int line = p->tok.line;
+    int negate = 0;
 
-            if (!do_pos) {
-                while (fgets(line, sizeof(line), fp)) {
-                    line[strcspn(line, "\r\n")] = 0;
-                    if (strcmp(line, "do") == 0) break;
-                    if (strcmp(line, "done") == 0) return;
-                }
-            }
+    if (is_keyword(p, "!")) {
+        negate = 1;
+        next(p);
+    }
 
-            block_len = 0;
-            while (fgets(line, sizeof(line), fp)) {
-                line[strcspn(line, "\r\n")] = 0;
-                if (strcmp(line, "done") == 0) break;
-                strcpy(block[block_len++], line);
-            }
+    Node* stages = NULL;
+    Node** tail = &stages;
+    int count = 0;
 
-            for (int i = 0; i < vcount; i++) {
-                set_var(var, values[i]);
-                for (int j = 0; j < block_len; j++) {
-                    char temp[MAX_LINE];
-                    strcpy(temp, block[j]);
-                    execute_conditional_commands(temp);
-                }
+    for (;;) {
+        Node* stage = NULL;
+        if (p->tok.type == TOK_WORD || p->tok.type == TOK_REDIR) {
+            if (at_list_end(p)) {
+                syntax_error(p);
+                break;
             }
-            continue;
+            stage = parse_compound(p);
+            if (stage) parse_redirects(p, stage);
+            else stage = parse_simple(p);
+        }
+        else {
+            syntax_error(p);
+            break;
         }
 
-        // Handle while loops
-        if (strncmp(line, "while", 5) == 0) {
-            char temp_line[MAX_LINE];
-            strcpy(temp_line, line);
-            char* condition_start = temp_line + 5;
-            while (*condition_start == ' ') condition_start++;
-
-            char condition[MAX_LINE];
-            char* do_pos = strstr(condition_start, "do");
-            if (do_pos) {
-                *do_pos = '\0';
-                strcpy(condition, condition_start);
-            }
-            else {
-                strcpy(condition, condition_start);
-            }
-
-            if (!do_pos) {
-                while (fgets(line, sizeof(line), fp)) {
-                    line[strcspn(line, "\r\n")] = 0;
-                    if (strcmp(line, "do") == 0) break;
-                    if (strcmp(line, "done") == 0) return;
-                }
-            }
+        *tail = stage;
+        tail = &stage->next;
+        count++;
 
-            block_len = 0;
-            while (fgets(line, sizeof(line), fp)) {
-                line[strcspn(line, "\r\n")] = 0;
-                if (strcmp(line, "done") == 0) break;
-                strcpy(block[block_len++], line);
-            }
+        if (p->error || p->tok.type != TOK_PIPE) break;
+        next(p);
+        skip_newlines(p);
+    }
 
-            int iteration_count = 0;
-            const int MAX_ITERATIONS = 1000;
+    if (p->error) {
+        node_free(stages);
+        return NULL;
+    }
+    if (count == 1 && !negate) return stages;
 
-            while (iteration_count++ < MAX_ITERATIONS) {
-                char current_condition[MAX_LINE];
-                strcpy(current_condition, condition);
-                replace_vars(current_condition);
+    Node* node = node_new(NODE_PIPELINE, line);
+    node->u.pipeline.stages = stages;
+    node->u.pipeline.negate = negate;
+    return node;
+}
 
-                if (!eval_condition(current_condition)) break;
+Node* parser_next(Parser* p) {
+    skip_newlines(p);
+    if (p->error || p->tok.type == TOK_EOF) return NULL;
+
+    Node* head = NULL;
+    Node** tail = &head;
+
+    for (;;) {
+        Node* node = parse_and_or(p);
+        if (!node) break;
+        if (p->tok.type == TOK_AMP) node = background(node);
+        *tail = node;
+        tail = &node->next;
+
+        if (p->tok.type == TOK_SEMI || p->tok.type == TOK_AMP) {
+            next(p);
+            if (p->tok.type != TOK_NEWLINE && p->tok.type != TOK_EOF) continue;
+        }
+        // The newline is left for the next call, so a streamed script is
+        // not read past the command about to run
+        if (p->tok.type == TOK_NEWLINE) break;
+        if (p->tok.type != TOK_EOF) syntax_error(p);
+        break;
+    }
 
-                for (int j = 0; j < block_len; j++) {
-                    char temp[MAX_LINE];
-                    strcpy(temp, block[j]);
-                    execute_conditional_commands(temp);
-                }
-            }
-            continue;
-        }
+    if (p->error) {
+        node_free(head);
+        return NULL;
+    }
+    return head;
+}
 
-        // Handle case statements
-        if (strncmp(line, "case", 4) == 0) {
-            handle_case_statement(fp);
-            continue;
-        }
+// Parse a script one complete command at a time, compile each command to
+// bytecode and run it on the VM before reading the next
+void interpret(Source* src) {
+    init_special_vars();
 
-        // Handle command execution
-        execute_conditional_commands(line);
+    Parser parser;
+    parser_init(&parser, src);
+
+    // Each complete command is parsed and compiled once, then run by the VM
+    Node* node;
+    while ((node = parser_next(&parser)) != NULL) {
+        Chunk* chunk = compile_command(node);
+        node_free(node);
+        source_lend(src, parser.lx.pos);
+        vm_run(chunk);
+        chunk_free(chunk);
+        size_t pos = source_reclaim(src, parser.lx.pos);
+        if (pos != parser.lx.pos) lexer_skip_to(&parser.lx, pos);
     }
-}
\ No newline at end of file
+    if (parser.error) update_exit_status(2);
+
+    parser_free(&parser);
+}
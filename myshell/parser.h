@@ -1,9 +1,29 @@
+#pragma once
 #ifndef PARSER_H
 #define PARSER_H
 
 #include <stdio.h>
+#include "ast.h"
+#include "lexer.h"
+
+typedef struct {
+    Lexer lx;
+    Token tok;          // one token of lookahead
+    int error;
+    int depth;          // compound bodies being parsed
+} Parser;
+
+void parser_init(Parser* p, Source* src);
+// Start counting lines at line, for text taken from inside another script
+void parser_init_at(Parser* p, Source* src, int line);
+void parser_free(Parser* p);
 
-void interpret(FILE* fp);
+// Parse the next complete command (one line of the script, including any
+// compound command it opens). Returns NULL at end of input or on a syntax
+// error, which is reported on stderr and flagged in p->error.
+Node* parser_next(Parser* p);
+
+// Parse, compile and run a whole script, one command at a time
+void interpret(Source* src);
 
 #endif
-#pragma once
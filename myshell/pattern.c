@@ -0,0 +1,373 @@
+#include "pattern.h"
+#include "util.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+// One position of a pattern: a set of bytes, or a '*'
+typedef struct {
+    uint8_t set[32];
+    int star;
+    int literal;            // the byte for a plain character, -1 otherwise
+} PatToken;
+
+static void set_add(uint8_t* set, int c) {
+    set[c >> 3] |= (uint8_t)(1u << (c & 7));
+}
+
+static int set_has(const uint8_t* set, int c) {
+    return (set[c >> 3] >> (c & 7)) & 1;
+}
+
+static const struct {
+    const char* name;
+    int (*test)(int);
+} char_classes[] = {
+    { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+    { "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+    { "lower", islower }, { "print", isprint }, { "punct", ispunct },
+    { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+};
+
+// [:name:] inside a bracket expression; returns the length consumed or 0
+static size_t parse_char_class(const char* p, uint8_t* set) {
+    const char* end = strstr(p + 2, ":]");
+    if (!end) return 0;
+    size_t len = (size_t)(end - (p + 2));
+    for (size_t i = 0; i < sizeof(char_classes) / sizeof(char_classes[0]); i++) {
+        if (strlen(char_classes[i].name) == len && strncmp(char_classes[i].name, p + 2, len) == 0) {
+            for (int c = 1; c < 256; c++) {
+                if (char_classes[i].test(c)) set_add(set, c);
+            }
+            return (size_t)(end + 2 - p);
+        }
+    }
+    return 0;
+}
+
+// Bracket expression starting at p[0] == '['. Returns the length consumed,
+// or 0 when there is no closing ']' and the '[' is an ordinary character.
+static size_t parse_bracket(const char* p, uint8_t* set) {
+    size_t i = 1;
+    int negate = 0;
+    if (p[i] == '!' || p[i] == '^') {
+        negate = 1;
+        i++;
+    }
+
+    memset(set, 0, 32);
+    // A ']' right after the '[' (or '[!') is an ordinary member
+    for (size_t first = i; p[i] && (p[i] != ']' || i == first);) {
+        if (p[i] == '[' && p[i + 1] == ':') {
+            size_t len = parse_char_class(p + i, set);
+            if (len > 0) {
+                i += len;
+                continue;
+            }
+        }
+        if (p[i] == '\\' && p[i + 1]) i++;
+        int lo = (unsigned char)p[i++];
+        int hi = lo;
+        if (p[i] == '-' && p[i + 1] && p[i + 1] != ']') {
+            i++;
+            if (p[i] == '\\' && p[i + 1]) i++;
+            hi = (unsigned char)p[i++];
+        }
+        for (int c = lo; c <= hi; c++) set_add(set, c);
+    }
+    if (!p[i]) return 0;
+
+    if (negate) {
+        for (int k = 0; k < 32; k++) set[k] = (uint8_t)~set[k];
+    }
+    return i + 1;
+}
+
+// Read the token at *p and advance past it; returns 0 at the end of the pattern
+static int next_token(const char** p, PatToken* tok) {
+    const char* s = *p;
+    if (!*s) return 0;
+
+    tok->star = 0;
+    tok->literal = -1;
+    if (*s == '*') {
+        // Consecutive stars match the same as one
+        while (*s == '*') s++;
+        tok->star = 1;
+        *p = s;
+        return 1;
+    }
+    if (*s == '?') {
+        memset(tok->set, 0xff, 32);
+        *p = s + 1;
+        return 1;
+    }
+    if (*s == '[') {
+        size_t len = parse_bracket(s, tok->set);
+        if (len > 0) {
+            *p = s + len;
+            return 1;
+        }
+    }
+    if (*s == '\\' && s[1]) s++;
+    memset(tok->set, 0, 32);
+    tok->literal = (unsigned char)*s;
+    set_add(tok->set, tok->literal);
+    *p = s + 1;
+    return 1;
+}
+
+// Greedy matching that backs up to the most recent '*' on a mismatch
+int pattern_match(const char* pattern, const char* text) {
+    const char* p = pattern;
+    const char* s = text;
+    const char* star_p = NULL;
+    const char* star_s = NULL;
+    PatToken tok;
+
+    while (*s) {
+        const char* next = p;
+        if (next_token(&next, &tok)) {
+            if (tok.star) {
+                star_p = p = next;
+                star_s = s;
+                continue;
+            }
+            if (set_has(tok.set, (unsigned char)*s)) {
+                p = next;
+                s++;
+                continue;
+            }
+        }
+        if (!star_p) return 0;
+        p = star_p;
+        s = ++star_s;
+    }
+    while (next_token(&p, &tok)) {
+        if (!tok.star) return 0;
+    }
+    return 1;
+}
+
+typedef struct {
+    char* text;
+    uint32_t hash;
+    int arm;
+} LiteralArm;
+
+// NFA state i stands for "the first i tokens of its pattern have matched";
+// the state after a pattern's last token accepts.
+typedef struct {
+    PatToken tok;
+    int start;
+    int arm;                // arm of an accepting state, -1 otherwise
+} NfaState;
+
+struct CaseMatcher {
+    LiteralArm* literals;
+    int nliterals;
+    int literals_cap;
+    int* table;             // literal + 1, or 0 for an empty bucket
+    size_t table_size;
+
+    NfaState* states;
+    int nstates;
+    int states_cap;
+    int first_glob_arm;
+
+    // Built on first use: one bit per state, packed into words
+    int nwords;
+    uint64_t* masks;        // [256][nwords]: states whose token accepts the byte
+    uint64_t* stars;
+    uint64_t* starts;
+    uint64_t* accepts;
+    uint64_t* current;
+    uint64_t* next;
+};
+
+CaseMatcher* matcher_new(void) {
+    CaseMatcher* m = xcalloc(1, sizeof(CaseMatcher));
+    m->first_glob_arm = -1;
+    return m;
+}
+
+static void drop_nfa(CaseMatcher* m) {
+    free(m->masks);
+    m->masks = NULL;
+}
+
+void matcher_free(CaseMatcher* m) {
+    if (!m) return;
+    for (int i = 0; i < m->nliterals; i++) free(m->literals[i].text);
+    free(m->literals);
+    free(m->table);
+    free(m->states);
+    drop_nfa(m);
+    free(m);
+}
+
+static void literal_insert(CaseMatcher* m, int index) {
+    size_t mask = m->table_size - 1;
+    size_t i = m->literals[index].hash & mask;
+    while (m->table[i]) i = (i + 1) & mask;
+    m->table[i] = index + 1;
+}
+
+static int literal_find(const CaseMatcher* m, const char* text) {
+    if (!m->table) return -1;
+    uint32_t hash = hash_string(text);
+    size_t mask = m->table_size - 1;
+    for (size_t i = hash & mask; m->table[i]; i = (i + 1) & mask) {
+        const LiteralArm* lit = &m->literals[m->table[i] - 1];
+        if (lit->hash == hash && strcmp(lit->text, text) == 0) return lit->arm;
+    }
+    return -1;
+}
+
+static void add_literal(CaseMatcher* m, const char* text, int arm) {
+    // An earlier arm with the same pattern always wins
+    if (literal_find(m, text) >= 0) return;
+
+    if (m->nliterals == m->literals_cap) {
+        m->literals_cap = m->literals_cap ? m->literals_cap * 2 : 16;
+        m->literals = xrealloc(m->literals, m->literals_cap * sizeof(LiteralArm));
+    }
+    if ((size_t)(m->nliterals + 1) * 2 > m->table_size) {
+        free(m->table);
+        m->table_size = m->table_size ? m->table_size * 2 : 32;
+        m->table = xcalloc(m->table_size, sizeof(int));
+        for (int i = 0; i < m->nliterals; i++) literal_insert(m, i);
+    }
+    LiteralArm* lit = &m->literals[m->nliterals];
+    lit->text = xstrdup(text);
+    lit->hash = hash_string(text);
+    lit->arm = arm;
+    literal_insert(m, m->nliterals++);
+}
+
+static NfaState* add_state(CaseMatcher* m) {
+    if (m->nstates == m->states_cap) {
+        m->states_cap = m->states_cap ? m->states_cap * 2 : 32;
+        m->states = xrealloc(m->states, m->states_cap * sizeof(NfaState));
+    }
+    NfaState* state = &m->states[m->nstates++];
+    memset(state, 0, sizeof(*state));
+    state->arm = -1;
+    return state;
+}
+
+void matcher_add(CaseMatcher* m, const char* pattern, int arm) {
+    // Plain text, once its backslashes are removed, only needs the hash table
+    StrBuf text;
+    sb_init(&text);
+    int plain = 1;
+    PatToken tok;
+    for (const char* p = pattern; plain && next_token(&p, &tok);) {
+        if (tok.literal < 0) plain = 0;
+        else sb_appendc(&text, (char)tok.literal);
+    }
+    if (plain) {
+        add_literal(m, text.data, arm);
+        sb_free(&text);
+        return;
+    }
+    sb_free(&text);
+
+    if (m->first_glob_arm < 0) m->first_glob_arm = arm;
+    drop_nfa(m);
+    int start = 1;
+    for (const char* p = pattern; next_token(&p, &tok);) {
+        NfaState* state = add_state(m);
+        state->tok = tok;
+        state->start = start;
+        start = 0;
+    }
+    NfaState* accept = add_state(m);
+    accept->start = start;
+    accept->arm = arm;
+}
+
+static void build_nfa(CaseMatcher* m) {
+    int n = (m->nstates + 63) / 64;
+    m->nwords = n;
+    // One allocation: masks, then stars, starts, accepts, current and next
+    m->masks = xcalloc((size_t)(256 + 5) * n, sizeof(uint64_t));
+    m->stars = m->masks + (size_t)256 * n;
+    m->starts = m->stars + n;
+    m->accepts = m->starts + n;
+    m->current = m->accepts + n;
+    m->next = m->current + n;
+
+    for (int i = 0; i < m->nstates; i++) {
+        const NfaState* state = &m->states[i];
+        uint64_t bit = (uint64_t)1 << (i % 64);
+        int w = i / 64;
+        if (state->start) m->starts[w] |= bit;
+        if (state->arm >= 0) m->accepts[w] |= bit;
+        else if (state->tok.star) m->stars[w] |= bit;
+        else {
+            for (int c = 0; c < 256; c++) {
+                if (set_has(state->tok.set, c)) m->masks[(size_t)c * n + w] |= bit;
+            }
+        }
+    }
+}
+
+// A '*' may match nothing, so an active star also activates the next state.
+// Stars never follow each other, so one pass is enough.
+static void follow_stars(const CaseMatcher* m, uint64_t* d) {
+    uint64_t carry = 0;
+    for (int w = 0; w < m->nwords; w++) {
+        uint64_t skip = d[w] & m->stars[w];
+        d[w] |= (skip << 1) | carry;
+        carry = skip >> 63;
+    }
+}
+
+// Run all glob patterns at once; returns the first arm that accepts, or -1
+static int run_nfa(CaseMatcher* m, const char* text) {
+    int n = m->nwords;
+    uint64_t* d = m->current;
+    uint64_t* t = m->next;
+    memcpy(d, m->starts, n * sizeof(uint64_t));
+    follow_stars(m, d);
+
+    for (const unsigned char* s = (const unsigned char*)text; *s; s++) {
+        const uint64_t* mask = m->masks + (size_t)*s * n;
+        uint64_t carry = 0;
+        for (int w = 0; w < n; w++) {
+            uint64_t moved = d[w] & mask[w];
+            t[w] = (moved << 1) | carry | (d[w] & m->stars[w]);
+            carry = moved >> 63;
+        }
+        follow_stars(m, t);
+
+        uint64_t any = 0;
+        for (int w = 0; w < n; w++) any |= t[w];
+        if (!any) return -1;
+        uint64_t* swap = d;
+        d = t;
+        t = swap;
+    }
+
+    // States are numbered in arm order, so the lowest accepting bit wins
+    for (int w = 0; w < n; w++) {
+        uint64_t hit = d[w] & m->accepts[w];
+        if (!hit) continue;
+        int bit = 0;
+        while (!((hit >> bit) & 1)) bit++;
+        return m->states[w * 64 + bit].arm;
+    }
+    return -1;
+}
+
+int matcher_find(CaseMatcher* m, const char* text) {
+    int arm = literal_find(m, text);
+    if (m->first_glob_arm < 0 || (arm >= 0 && arm < m->first_glob_arm)) return arm;
+
+    if (!m->masks) build_nfa(m);
+    int glob = run_nfa(m, text);
+    if (glob >= 0 && (arm < 0 || glob < arm)) return glob;
+    return arm;
+}
@@ -0,0 +1,27 @@
+#ifndef PATTERN_H
+#define PATTERN_H
+
+// Shell pattern matching for case statements: '*', '?', bracket
+// expressions such as [abc], [!a-z] and [[:digit:]], and backslash to quote
+// the next character.
+
+// Match one pattern against text; for patterns only known at run time
+int pattern_match(const char* pattern, const char* text);
+
+// All patterns of one case statement, compiled once. Patterns without glob
+// characters go into a hash table; the others are combined into a single
+// bit-parallel NFA, so finding the first matching arm reads the subject
+// once however many arms there are.
+typedef struct CaseMatcher CaseMatcher;
+
+CaseMatcher* matcher_new(void);
+void matcher_free(CaseMatcher* m);
+
+// Add a pattern for an arm. Arms must be added in order; several patterns
+// (a|b) may share one arm.
+void matcher_add(CaseMatcher* m, const char* pattern, int arm);
+
+// The first arm with a pattern that matches text, or -1
+int matcher_find(CaseMatcher* m, const char* text);
+
+#endif
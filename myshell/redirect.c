@@ -0,0 +1,216 @@
+#define _POSIX_C_SOURCE 200809L
+#ifdef __linux__
+#define _GNU_SOURCE         // memfd_create
+#endif
+#include "redirect.h"
+#include "input.h"
+#include "util.h"
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+// Saved copies live above the descriptors scripts normally use
+#define SAVED_FD_BASE 10
+
+void redir_undo_init(RedirUndo* undo) {
+    undo->fds = NULL;
+    undo->count = 0;
+    undo->cap = REDIR_UNDO_INLINE;
+}
+
+// Commands with a few redirections never allocate
+static int* undo_fds(RedirUndo* undo) {
+    return undo->fds ? undo->fds : undo->inline_fds;
+}
+
+void redir_undo_free(RedirUndo* undo) {
+    free(undo->fds);
+    redir_undo_init(undo);
+}
+
+static void record(RedirUndo* undo, int fd, int saved) {
+    if (undo->count + 2 > undo->cap) {
+        int* fds = xmalloc(undo->cap * 2 * sizeof(int));
+        memcpy(fds, undo_fds(undo), undo->count * sizeof(int));
+        free(undo->fds);
+        undo->fds = fds;
+        undo->cap *= 2;
+    }
+    int* fds = undo_fds(undo);
+    fds[undo->count++] = fd;
+    fds[undo->count++] = saved;
+}
+
+// Called before fd changes, which is also when input read ahead from it
+// has to go back
+static void save_fd(RedirUndo* undo, int fd) {
+    input_sync(fd);
+    if (fd == 2) out_stderr_changed();
+    // The copy is close-on-exec so spawned programs never see it
+    if (undo) record(undo, fd, fcntl(fd, F_DUPFD_CLOEXEC, SAVED_FD_BASE));
+}
+
+int redirect_fd(int fd, int target_fd, RedirUndo* undo) {
+    if (fd == target_fd) return 1;
+    save_fd(undo, fd);
+    if (dup2(target_fd, fd) < 0) {
+        fprintf(stderr, "myshell: %d: %s\n", target_fd, strerror(errno));
+        return 0;
+    }
+    return 1;
+}
+
+static void close_fd(int fd, RedirUndo* undo) {
+    save_fd(undo, fd);
+    close(fd);
+}
+
+static int write_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return 0;
+        data += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+// A descriptor to read text from, for here-documents and here-strings
+// (which end with an added newline). Short text goes into a pipe with one
+// write, which cannot block. Longer text goes into an anonymous memory
+// file, so nothing touches the file system; only where there is no
+// memfd_create does it fall back to a temporary file.
+static int here_fd(const char* text, int add_newline) {
+    size_t len = strlen(text);
+    if (len + add_newline <= PIPE_BUF) {
+        int fds[2];
+        if (pipe(fds) < 0) return -1;
+        struct iovec parts[2];
+        parts[0].iov_base = (void*)text;
+        parts[0].iov_len = len;
+        parts[1].iov_base = "\n";
+        parts[1].iov_len = (size_t)add_newline;
+        if (writev(fds[1], parts, 2) < 0) {
+            close(fds[0]);
+            close(fds[1]);
+            return -1;
+        }
+        close(fds[1]);
+        return fds[0];
+    }
+
+    int fd = -1;
+#ifdef MFD_CLOEXEC
+    fd = memfd_create("myshell-here-document", MFD_CLOEXEC);
+#endif
+    if (fd < 0) {
+        FILE* file = tmpfile();
+        if (!file) return -1;
+        fd = dup(fileno(file));
+        fclose(file);
+        if (fd < 0) return -1;
+    }
+    if (!write_all(fd, text, len) || (add_newline && !write_all(fd, "\n", 1)) ||
+        lseek(fd, 0, SEEK_SET) < 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+static int is_number(const char* text) {
+    return text[0] && strspn(text, "0123456789") == strlen(text);
+}
+
+int redirect_apply(const RedirOp* redirs, char** targets, int count, RedirUndo* undo) {
+    // Builtin output buffered so far belongs to the old descriptors
+    out_flush();
+    fflush(stderr);
+
+    for (int i = 0; i < count; i++) {
+        const RedirOp* redir = &redirs[i];
+        const char* target = targets[i];
+        int fd = -1;
+
+        switch (redir->type) {
+        case REDIR_IN:
+            fd = open(target, O_RDONLY);
+            break;
+        case REDIR_OUT:
+            fd = open(target, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            break;
+        case REDIR_APPEND:
+            fd = open(target, O_WRONLY | O_CREAT | O_APPEND, 0666);
+            break;
+        case REDIR_HERESTRING:
+            fd = here_fd(target, 1);
+            break;
+        case REDIR_HEREDOC:
+            fd = here_fd(target, 0);
+            break;
+        case REDIR_DUP_IN:
+        case REDIR_DUP_OUT:
+            if (strcmp(target, "-") == 0) {
+                close_fd(redir->fd, undo);
+                continue;
+            }
+            if (!is_number(target)) {
+                fprintf(stderr, "myshell: %s: ambiguous redirect\n", target);
+                return 0;
+            }
+            if (fcntl(atoi(target), F_GETFD) < 0) {
+                fprintf(stderr, "myshell: %s: bad file descriptor\n", target);
+                return 0;
+            }
+            if (!redirect_fd(redir->fd, atoi(target), undo)) return 0;
+            continue;
+        }
+
+        if (fd < 0) {
+            int inline_text = redir->type == REDIR_HERESTRING || redir->type == REDIR_HEREDOC;
+            fprintf(stderr, "myshell: %s: %s\n", inline_text ? "here-document" : target, strerror(errno));
+            return 0;
+        }
+        if (fd == redir->fd) {
+            // open() picked the very descriptor asked for, so it was closed before
+            if (undo) record(undo, fd, -1);
+            continue;
+        }
+        int ok = redirect_fd(redir->fd, fd, undo);
+        close(fd);
+        if (!ok) return 0;
+    }
+    return 1;
+}
+
+void redirect_restore(RedirUndo* undo) {
+    if (undo->count == 0) return;
+    out_flush();
+    fflush(stderr);
+    int* fds = undo_fds(undo);
+    while (undo->count > 0) {
+        int saved = fds[--undo->count];
+        int fd = fds[--undo->count];
+        input_sync(fd);
+        if (fd == 2) out_stderr_changed();
+        if (saved >= 0) {
+            dup2(saved, fd);
+            close(saved);
+        }
+        else {
+            close(fd);
+        }
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef REDIRECT_H
+#define REDIRECT_H
+
+#include "bytecode.h"
+
+// Descriptors replaced by redirections, kept so they can be put back.
+// Redirections are applied in the shell itself: builtins see them directly
+// and spawned programs inherit them, so no helper shell is needed.
+#define REDIR_UNDO_INLINE 8
+
+typedef struct {
+    int* fds;               // pairs of (fd, saved copy or -1 if it was closed),
+                            // or NULL while inline_fds is big enough
+    int count;
+    int cap;
+    int inline_fds[REDIR_UNDO_INLINE];
+} RedirUndo;
+
+void redir_undo_init(RedirUndo* undo);
+void redir_undo_free(RedirUndo* undo);
+
+// Point fd at target_fd, saving the old fd in undo (undo may be NULL)
+int redirect_fd(int fd, int target_fd, RedirUndo* undo);
+
+// Apply redirections in order; on failure prints a message and returns 0,
+// leaving the ones already applied recorded in undo
+int redirect_apply(const RedirOp* redirs, char** targets, int count, RedirUndo* undo);
+
+// Put back everything recorded in undo, most recent first
+void redirect_restore(RedirUndo* undo);
+
+#endif
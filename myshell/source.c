@@ -0,0 +1,136 @@
+#define _POSIX_C_SOURCE 200809L
+#include "source.h"
+#include "util.h"
+#include "input.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#define read _read
+#define close _close
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#define READ_CHUNK (64 * 1024)
+
+int source_open(Source* src, const char* path) {
+    memset(src, 0, sizeof(Source));
+    src->stdin_base = -1;
+    if (strcmp(path, "-") == 0) {
+        // Never mapped or closed: the commands read the rest of it
+        src->fd = 0;
+#ifndef _WIN32
+        struct stat st;
+        off_t base;
+        if (fstat(0, &st) == 0 && S_ISREG(st.st_mode) && (base = lseek(0, 0, SEEK_CUR)) >= 0)
+            src->stdin_base = base;
+        else
+            src->stdin_pipe = 1;
+#endif
+        return 1;
+    }
+
+    src->fd = open(path, O_RDONLY);
+    if (src->fd < 0) {
+        fprintf(stderr, "myshell: %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+
+#ifndef _WIN32
+    struct stat st;
+    if (fstat(src->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, src->fd, 0);
+        if (data != MAP_FAILED) {
+            src->data = data;
+            src->len = (size_t)st.st_size;
+            src->mapped = 1;
+            close(src->fd);
+            src->fd = -1;
+            return 1;
+        }
+    }
+    // Commands we start must not inherit the script
+    if (src->fd > 2) fcntl(src->fd, F_SETFD, FD_CLOEXEC);
+#endif
+    return 1;
+}
+
+void source_string(Source* src, const char* text, size_t len) {
+    memset(src, 0, sizeof(Source));
+    src->data = (char*)text;
+    src->len = len;
+    src->fd = -1;
+    src->stdin_base = -1;
+}
+
+void source_close(Source* src) {
+#ifndef _WIN32
+    if (src->mapped) {
+        munmap(src->data, src->len);
+        src->data = NULL;
+    }
+#endif
+    free(src->data);
+    if (src->fd > 0) close(src->fd);
+    memset(src, 0, sizeof(Source));
+    src->fd = -1;
+    src->stdin_base = -1;
+}
+
+static ssize_t read_more(Source* src) {
+#ifndef _WIN32
+    // A shared file is read at the script's own offsets, which the
+    // commands may have moved the descriptor away from
+    if (src->stdin_base >= 0)
+        return pread(src->fd, src->data + src->len, src->cap - src->len,
+            (off_t)(src->stdin_base + (long long)src->len));
+#endif
+    // A shared pipe cannot be given back, so it is read a byte at a time
+    return read(src->fd, src->data + src->len, src->stdin_pipe ? 1 : src->cap - src->len);
+}
+
+int source_fill(Source* src, size_t offset) {
+    while (offset >= src->len) {
+        if (src->fd < 0) return 0;
+        if (src->cap - src->len < READ_CHUNK) {
+            src->cap = src->cap ? src->cap * 2 : READ_CHUNK * 2;
+            src->data = xrealloc(src->data, src->cap);
+        }
+        ssize_t n = read_more(src);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (src->fd > 0) close(src->fd);
+            src->fd = -1;
+            return 0;
+        }
+        src->len += (size_t)n;
+    }
+    return 1;
+}
+
+void source_lend(Source* src, size_t offset) {
+#ifndef _WIN32
+    if (src->stdin_base >= 0) lseek(0, (off_t)(src->stdin_base + (long long)offset), SEEK_SET);
+#else
+    (void)src;
+    (void)offset;
+#endif
+}
+
+size_t source_reclaim(Source* src, size_t offset) {
+#ifndef _WIN32
+    if (src->stdin_base < 0) return offset;
+    input_sync(0);
+    off_t pos = lseek(0, 0, SEEK_CUR);
+    if (pos >= src->stdin_base) return (size_t)(pos - src->stdin_base);
+#else
+    (void)src;
+#endif
+    return offset;
+}
@@ -0,0 +1,38 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stddef.h>
+
+// Script text as one contiguous buffer. Regular files are mapped and never
+// copied; pipes and terminals are read in large chunks as the lexer asks
+// for more, so execution starts before the whole stream has arrived.
+// A script on standard input shares it with the commands it runs, so it is
+// never read past the command about to run: a pipe or terminal a byte at a
+// time, a file at its own offsets with the descriptor's offset kept in step.
+typedef struct {
+    char* data;
+    size_t len;             // bytes available so far
+    size_t cap;
+    int fd;                 // still being read, or -1
+    int mapped;
+    int stdin_pipe;         // standard input that cannot seek
+    long long stdin_base;   // standard input that can: its offset of data[0], else -1
+} Source;
+
+// path "-" means standard input. Returns 0 and reports on failure.
+int source_open(Source* src, const char* path);
+// Read text the caller keeps alive, such as the inside of $( ); such a
+// source needs no source_close
+void source_string(Source* src, const char* text, size_t len);
+void source_close(Source* src);
+
+// Make sure byte offset is available; returns 0 at end of input
+int source_fill(Source* src, size_t offset);
+
+// Around each command: leave standard input just past the text parsed so
+// far, then return where the commands left it, which is offset unless they
+// read part of the script as their input
+void source_lend(Source* src, size_t offset);
+size_t source_reclaim(Source* src, size_t offset);
+
+#endif
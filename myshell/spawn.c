@@ -0,0 +1,277 @@
+#define _POSIX_C_SOURCE 200809L
+#include "spawn.h"
+#include "env.h"
+#include "util.h"
+#include "input.h"
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef _WIN32
+#include <process.h>
+#include <io.h>
+#define environ _environ
+#else
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+extern char** environ;
+#endif
+
+// $PATH split into directories; rebuilt after PATH is assigned
+static char* path_buffer = NULL;
+static char** path_dirs = NULL;
+static int path_count = 0;
+
+// Command name -> resolved path, like bash's hash table. Entries are never
+// removed; a stale one just loses its path until it is resolved again.
+typedef struct {
+    char* name;
+    char* path;             // NULL when the command is no longer found
+    uint32_t hash;
+    int hits;
+} PathEntry;
+
+static PathEntry* entries = NULL;
+static int entry_count = 0;
+static int entries_cap = 0;
+static int* entry_table = NULL; // entry + 1, or 0 for an empty bucket
+static size_t entry_table_size = 0;
+
+static void split_path(void) {
+    const char* value = get_var("PATH");
+    path_buffer = xstrdup(value);
+
+    path_count = 1;
+    for (const char* p = value; *p; p++) {
+        if (*p == ':') path_count++;
+    }
+    path_dirs = xmalloc(path_count * sizeof(char*));
+
+    int n = 0;
+    path_dirs[n++] = path_buffer;
+    for (char* p = path_buffer; *p; p++) {
+        if (*p == ':') {
+            *p = '\0';
+            path_dirs[n++] = p + 1;
+        }
+    }
+}
+
+static int is_executable(const char* path) {
+#ifdef _WIN32
+    return _access(path, 0) == 0;
+#else
+    return access(path, X_OK) == 0;
+#endif
+}
+
+// Walk $PATH; returns a malloc'd path or NULL
+static char* path_search(const char* name) {
+    if (!path_dirs) split_path();
+    StrBuf candidate;
+    sb_init(&candidate);
+    for (int i = 0; i < path_count; i++) {
+        sb_clear(&candidate);
+        // An empty entry means the current directory
+        sb_append(&candidate, path_dirs[i][0] ? path_dirs[i] : ".");
+        sb_appendc(&candidate, '/');
+        sb_append(&candidate, name);
+        if (is_executable(candidate.data)) return sb_release(&candidate);
+    }
+    sb_free(&candidate);
+    return NULL;
+}
+
+static void entry_insert(int index) {
+    size_t mask = entry_table_size - 1;
+    size_t i = entries[index].hash & mask;
+    while (entry_table[i]) i = (i + 1) & mask;
+    entry_table[i] = index + 1;
+}
+
+static PathEntry* find_entry(const char* name) {
+    uint32_t hash = hash_string(name);
+    if (entry_table) {
+        size_t mask = entry_table_size - 1;
+        for (size_t i = hash & mask; entry_table[i]; i = (i + 1) & mask) {
+            PathEntry* entry = &entries[entry_table[i] - 1];
+            if (entry->hash == hash && strcmp(entry->name, name) == 0) return entry;
+        }
+    }
+
+    if (entry_count == entries_cap) {
+        entries_cap = entries_cap ? entries_cap * 2 : 32;
+        entries = xrealloc(entries, entries_cap * sizeof(PathEntry));
+    }
+    if ((size_t)(entry_count + 1) * 2 > entry_table_size) {
+        free(entry_table);
+        entry_table_size = entry_table_size ? entry_table_size * 2 : 64;
+        entry_table = xcalloc(entry_table_size, sizeof(int));
+        for (int i = 0; i < entry_count; i++) entry_insert(i);
+    }
+    PathEntry* entry = &entries[entry_count];
+    entry->name = xstrdup(name);
+    entry->path = NULL;
+    entry->hash = hash;
+    entry->hits = 0;
+    entry_insert(entry_count++);
+    return entry;
+}
+
+static PathEntry* lookup_entry(const char* name) {
+    PathEntry* entry = find_entry(name);
+    if (!entry->path) {
+        entry->path = path_search(name);
+        entry->hits = 0;
+    }
+    return entry;
+}
+
+const char* path_lookup(const char* name) {
+    if (strchr(name, '/')) return name;
+    return lookup_entry(name)->path;
+}
+
+void path_cache_clear(void) {
+    for (int i = 0; i < entry_count; i++) {
+        free(entries[i].name);
+        free(entries[i].path);
+    }
+    entry_count = 0;
+    if (entry_table) memset(entry_table, 0, entry_table_size * sizeof(int));
+    free(path_buffer);
+    free(path_dirs);
+    path_buffer = NULL;
+    path_dirs = NULL;
+}
+
+void path_cache_print(void) {
+    int shown = 0;
+    for (int i = 0; i < entry_count; i++) {
+        if (!entries[i].path) continue;
+        if (shown++ == 0) out_str("hits\tcommand\n");
+        out_printf("%4d\t%s\n", entries[i].hits, entries[i].path);
+    }
+    if (shown == 0) out_str("hash: hash table empty\n");
+}
+
+// Copy environ, replacing or adding the per-command assignments
+static char** build_env(char** extra_env, int nextra) {
+    int count = 0;
+    while (environ[count]) count++;
+    char** envp = xmalloc((count + nextra + 1) * sizeof(char*));
+
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        size_t len = strcspn(environ[i], "=");
+        int overridden = 0;
+        for (int j = 0; j < nextra && !overridden; j++) {
+            overridden = strncmp(extra_env[j], environ[i], len) == 0 && extra_env[j][len] == '=';
+        }
+        if (!overridden) envp[n++] = environ[i];
+    }
+    for (int j = 0; j < nextra; j++) envp[n++] = extra_env[j];
+    envp[n] = NULL;
+    return envp;
+}
+
+static int start_program(const char* path, char** argv, char** envp, pid_t* pid) {
+#ifdef _WIN32
+    *pid = _spawnve(_P_NOWAIT, path, (const char* const*)argv, (const char* const*)envp);
+    return *pid < 0 ? errno : 0;
+#else
+    int error = posix_spawn(pid, path, NULL, NULL, argv, envp);
+    if (error == ENOEXEC) {
+        // A script without a #! line is run by /bin/sh, as execvp does
+        int argc = 0;
+        while (argv[argc]) argc++;
+        char** sh_argv = xmalloc((argc + 2) * sizeof(char*));
+        sh_argv[0] = "sh";
+        sh_argv[1] = (char*)path;
+        memcpy(sh_argv + 2, argv + 1, argc * sizeof(char*));
+        error = posix_spawn(pid, "/bin/sh", NULL, NULL, sh_argv, envp);
+        free(sh_argv);
+    }
+    return error;
+#endif
+}
+
+int spawn_start(char** argv, char** extra_env, int nextra, pid_t* pid) {
+    PathEntry* entry = strchr(argv[0], '/') ? NULL : lookup_entry(argv[0]);
+    const char* path = entry ? entry->path : argv[0];
+    if (!path) {
+        fprintf(stderr, "myshell: %s: command not found\n", argv[0]);
+        return 127;
+    }
+
+    // Anything our builtins wrote must reach the terminal before the child does,
+    // and input read ahead goes back to where the child will read it
+    out_flush();
+    input_sync_all();
+    char** envp = nextra > 0 ? build_env(extra_env, nextra) : environ;
+
+    int error = start_program(path, argv, envp, pid);
+    if (error == ENOENT && entry) {
+        // The program moved or was removed since it was cached
+        free(entry->path);
+        entry->path = path_search(argv[0]);
+        path = entry->path;
+        error = path ? start_program(path, argv, envp, pid) : ENOENT;
+    }
+    if (error == 0 && entry) entry->hits++;
+
+    int status = 0;
+    if (error != 0) {
+        if (path) fprintf(stderr, "myshell: %s: %s\n", path, strerror(error));
+        else fprintf(stderr, "myshell: %s: command not found\n", argv[0]);
+        status = error == ENOENT ? 127 : 126;
+    }
+    if (envp != environ) free(envp);
+    return status;
+}
+
+#ifndef _WIN32
+static int exit_status(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return 1;
+}
+#endif
+
+int wait_child(pid_t pid) {
+    int status;
+#ifdef _WIN32
+    if (_cwait(&status, pid, 0) < 0) return 1;
+    return status;
+#else
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return 1;
+    }
+    return exit_status(status);
+#endif
+}
+
+int poll_child(pid_t pid, int* status) {
+#ifdef _WIN32
+    *status = wait_child(pid);
+    return 1;
+#else
+    int raw;
+    pid_t done;
+    while ((done = waitpid(pid, &raw, WNOHANG)) < 0 && errno == EINTR) {
+        // Interrupted; ask again
+    }
+    if (done == 0) return 0;
+    // Someone else reaped it: nothing is left to report
+    *status = done < 0 ? 127 : exit_status(raw);
+    return 1;
+#endif
+}
+
+int spawn_wait(char** argv, char** extra_env, int nextra) {
+    pid_t pid;
+    int status = spawn_start(argv, extra_env, nextra, &pid);
+    return status != 0 ? status : wait_child(pid);
+}
@@ -0,0 +1,33 @@
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#ifdef _WIN32
+#include <stdint.h>
+typedef intptr_t pid_t;
+#else
+#include <sys/types.h>
+#endif
+
+// Resolve a command name against $PATH. Answers are cached until PATH is
+// assigned or a cached program disappears; the string belongs to the cache.
+// Returns NULL if the command was not found.
+const char* path_lookup(const char* name);
+void path_cache_clear(void);
+void path_cache_print(void);
+
+// Start a program directly. extra_env holds NAME=value strings that
+// override the environment for this child only. Returns 0 and sets *pid,
+// or returns 126/127 when the program cannot be run.
+int spawn_start(char** argv, char** extra_env, int nextra, pid_t* pid);
+
+// Wait for a child; returns its exit status or 128+signal
+int wait_child(pid_t pid);
+
+// Check a child without blocking. Returns 1 and sets *status once it has
+// exited, 0 while it is still running.
+int poll_child(pid_t pid, int* status);
+
+// spawn_start followed by wait_child
+int spawn_wait(char** argv, char** extra_env, int nextra);
+
+#endif
@@ -0,0 +1,20 @@
+#!/bin/bash
+name="World"
+cat <<EOF2
+Hello $name
+sum: $((2 + 3))
+EOF2
+cat <<'EOF2'
+Hello $name
+EOF2
+if true; then
+	cat <<-EOF2
+	tabs stripped
+	EOF2
+fi
+while read line; do
+    echo "read: $line"
+done <<EOF2
+first
+second
+EOF2
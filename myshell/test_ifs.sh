@@ -0,0 +1,14 @@
+#!/bin/bash
+line="a:b::c"
+IFS=:
+for field in $line; do
+    echo "field: [$field]"
+done
+IFS=" ,"
+set -- $(echo "x, y ,z")
+echo "count: $#"
+unset IFS
+words="  one   two  "
+for w in $words; do
+    echo "word: $w"
+done
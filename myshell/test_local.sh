@@ -0,0 +1,20 @@
+#!/bin/bash
+count=1
+inner() {
+    echo "inner sees: $count"
+    count=3
+}
+outer() {
+    local count=2
+    inner
+    echo "outer has: $count"
+}
+outer
+echo "global: $count"
+export SHARED=global
+show() {
+    local SHARED=local
+    sh -c 'echo "child: $SHARED"'
+}
+show
+echo "after: $SHARED"
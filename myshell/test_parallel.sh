@@ -0,0 +1,8 @@
+parallel -j 2 echo item ::: one two three
+printf 'a\nb\nc\n' | parallel echo "line {} end"
+say() {
+    echo "function: $1"
+}
+parallel say ::: x y
+parallel false ::: 1 2
+echo "failed: $?"
@@ -0,0 +1,12 @@
+#!/bin/bash
+sleep 0.2 &
+first=$!
+sh -c 'exit 3' &
+second=$!
+wait $second
+echo "second: $?"
+wait $first
+echo "first: $?"
+false &
+wait
+echo "all done"
@@ -0,0 +1,106 @@
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every allocation made through the helpers below, for the benchmarks
+static size_t allocations = 0;
+
+static void out_of_memory(void) {
+    fprintf(stderr, "myshell: out of memory\n");
+    exit(2);
+}
+
+void* xmalloc(size_t size) {
+    allocations++;
+    void* p = malloc(size ? size : 1);
+    if (!p) out_of_memory();
+    return p;
+}
+
+void* xcalloc(size_t count, size_t size) {
+    allocations++;
+    void* p = calloc(count ? count : 1, size ? size : 1);
+    if (!p) out_of_memory();
+    return p;
+}
+
+void* xrealloc(void* ptr, size_t size) {
+    allocations++;
+    void* p = realloc(ptr, size ? size : 1);
+    if (!p) out_of_memory();
+    return p;
+}
+
+size_t alloc_count(void) {
+    return allocations;
+}
+
+char* xstrdup(const char* s) {
+    return xstrndup(s, strlen(s));
+}
+
+char* xstrndup(const char* s, size_t len) {
+    char* p = xmalloc(len + 1);
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+void sb_init(StrBuf* sb) {
+    sb->cap = 64;
+    sb->len = 0;
+    sb->data = xmalloc(sb->cap);
+    sb->data[0] = '\0';
+}
+
+void sb_free(StrBuf* sb) {
+    free(sb->data);
+    sb->data = NULL;
+    sb->len = sb->cap = 0;
+}
+
+void sb_clear(StrBuf* sb) {
+    sb->len = 0;
+    sb->data[0] = '\0';
+}
+
+void sb_reserve(StrBuf* sb, size_t extra) {
+    if (sb->len + extra + 1 <= sb->cap) return;
+    while (sb->len + extra + 1 > sb->cap) sb->cap *= 2;
+    sb->data = xrealloc(sb->data, sb->cap);
+}
+
+void sb_append_len(StrBuf* sb, const char* s, size_t len) {
+    sb_reserve(sb, len);
+    memcpy(sb->data + sb->len, s, len);
+    sb->len += len;
+    sb->data[sb->len] = '\0';
+}
+
+void sb_append(StrBuf* sb, const char* s) {
+    sb_append_len(sb, s, strlen(s));
+}
+
+void sb_appendc(StrBuf* sb, char c) {
+    sb_reserve(sb, 1);
+    sb->data[sb->len++] = c;
+    sb->data[sb->len] = '\0';
+}
+
+// Hand the buffer to the caller; the StrBuf must be re-initialized before reuse
+char* sb_release(StrBuf* sb) {
+    char* data = sb->data;
+    sb->data = NULL;
+    sb->len = sb->cap = 0;
+    return data;
+}
+
+uint32_t hash_string(const char* s) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char* p = (const unsigned char*)s; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
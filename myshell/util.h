@@ -0,0 +1,34 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Allocation helpers that abort on out-of-memory
+void* xmalloc(size_t size);
+void* xcalloc(size_t count, size_t size);
+void* xrealloc(void* ptr, size_t size);
+char* xstrdup(const char* s);
+char* xstrndup(const char* s, size_t len);
+size_t alloc_count(void);       // calls to the helpers above so far
+
+// Growable string buffer, always NUL-terminated once initialized
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+} StrBuf;
+
+void sb_init(StrBuf* sb);
+void sb_free(StrBuf* sb);
+void sb_clear(StrBuf* sb);
+void sb_reserve(StrBuf* sb, size_t extra);
+void sb_append(StrBuf* sb, const char* s);
+void sb_append_len(StrBuf* sb, const char* s, size_t len);
+void sb_appendc(StrBuf* sb, char c);
+char* sb_release(StrBuf* sb);
+
+// FNV-1a hash of a NUL-terminated string
+uint32_t hash_string(const char* s);
+
+#endif
@@ -0,0 +1,930 @@
+#define _POSIX_C_SOURCE 200809L
+#include "vm.h"
+#include "env.h"
+#include "executor.h"
+#include "function.h"
+#include "job.h"
+#include "expand.h"
+#include "arith.h"
+#include "util.h"
+#include "input.h"
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+
+// Function calls recurse through vm_run; past this depth a call is an
+// error instead of a stack overflow
+#define MAX_CALL_DEPTH 1000
+
+// GCC and Clang dispatch through a table of label addresses; other
+// compilers fall back to a switch inside a loop.
+#if defined(__GNUC__) && !defined(MYSHELL_SWITCH_DISPATCH)
+#define VM_COMPUTED_GOTO
+#endif
+
+typedef struct {
+    int base;               // for: where its words start on the string stack
+    int count;
+    int next;
+    int status;             // status of the last completed body
+} LoopFrame;
+
+typedef struct {
+    ArgList strings;        // expanded words waiting to be consumed
+    int* marks;             // where each pending command's words start
+    int nmarks;
+    int marks_cap;
+    int64_t* ints;          // arithmetic operands
+    int nints;
+    int ints_cap;
+    LoopFrame* loops;
+    int nloops;
+    int loops_cap;
+    FieldBuilder fb;
+    Pipeline pipeline;      // stages started so far
+    RedirUndo* undos;       // redirections on enclosing compound commands
+    int nundos;
+    int undos_cap;
+    int forked;             // running a compound pipeline stage in a child
+    StrBuf* captures;       // output of the substitutions in the word being built
+    int ncaptures;
+    int captures_cap;
+} VM;
+
+// Expanded words live in one arena, which is reset after every top-level
+// command. Finished VMs keep their buffers for the next command or
+// function call too, so running a simple command or calling a function
+// allocates nothing once they have grown.
+#define MAX_SPARE_VMS 8
+
+static Arena scratch;
+static VM spare_vms[MAX_SPARE_VMS];
+static int nspare = 0;
+static int vm_depth = 0;
+
+static void vm_init(VM* vm) {
+    if (nspare > 0) {
+        *vm = spare_vms[--nspare];
+        return;
+    }
+    memset(vm, 0, sizeof(VM));
+    args_init(&vm->strings, &scratch);
+    fb_init(&vm->fb);
+    pipeline_init(&vm->pipeline);
+}
+
+static void vm_free(VM* vm) {
+    if (nspare < MAX_SPARE_VMS) {
+        // A command abandoned halfway may leave a word or pipeline behind
+        fb_reset(&vm->fb);
+        if (vm->pipeline.count > 0 || vm->pipeline.in_fd >= 0) {
+            pipeline_free(&vm->pipeline);
+            pipeline_init(&vm->pipeline);
+        }
+        vm->nmarks = 0;
+        vm->nints = 0;
+        vm->ncaptures = 0;
+        spare_vms[nspare++] = *vm;
+        return;
+    }
+    args_free(&vm->strings);
+    fb_free(&vm->fb);
+    pipeline_free(&vm->pipeline);
+    free(vm->undos);
+    free(vm->marks);
+    free(vm->ints);
+    free(vm->loops);
+    for (int i = 0; i < vm->captures_cap; i++) sb_free(&vm->captures[i]);
+    free(vm->captures);
+}
+
+static void push_int(VM* vm, int64_t value) {
+    if (vm->nints == vm->ints_cap) {
+        vm->ints_cap = vm->ints_cap ? vm->ints_cap * 2 : 16;
+        vm->ints = xrealloc(vm->ints, vm->ints_cap * sizeof(int64_t));
+    }
+    vm->ints[vm->nints++] = value;
+}
+
+static void push_mark(VM* vm) {
+    if (vm->nmarks == vm->marks_cap) {
+        vm->marks_cap = vm->marks_cap ? vm->marks_cap * 2 : 8;
+        vm->marks = xrealloc(vm->marks, vm->marks_cap * sizeof(int));
+    }
+    vm->marks[vm->nmarks++] = vm->strings.count;
+}
+
+// Optional watchdog for runaway loops. When MYSHELL_LOOP_TIMEOUT holds a
+// number of seconds, an alarm starts with the outermost loop; once it goes
+// off, every running loop stops at its next iteration with status 1.
+// Loops only test a flag set by the signal handler.
+static volatile sig_atomic_t watchdog_fired = 0;
+static long watchdog_seconds = 0;     // nonzero while the alarm is set
+static int running_loops = 0;
+static int timeout_slot = -1;
+
+static void watchdog_alarm(int sig) {
+    (void)sig;
+    watchdog_fired = 1;
+}
+
+static void watchdog_start(void) {
+    if (timeout_slot < 0) timeout_slot = var_slot("MYSHELL_LOOP_TIMEOUT");
+    if (!var_is_set(timeout_slot)) return;
+    long seconds = strtol(var_get(timeout_slot), NULL, 10);
+    if (seconds <= 0) return;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = watchdog_alarm;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGALRM, &action, NULL);
+    watchdog_fired = 0;
+    watchdog_seconds = seconds;
+    alarm((unsigned)seconds);
+}
+
+static void watchdog_stop(void) {
+    alarm(0);
+    signal(SIGALRM, SIG_DFL);
+    watchdog_fired = 0;
+    watchdog_seconds = 0;
+}
+
+static LoopFrame* push_loop(VM* vm) {
+    if (running_loops++ == 0) watchdog_start();
+    if (vm->nloops == vm->loops_cap) {
+        vm->loops_cap = vm->loops_cap ? vm->loops_cap * 2 : 4;
+        vm->loops = xrealloc(vm->loops, vm->loops_cap * sizeof(LoopFrame));
+    }
+    LoopFrame* frame = &vm->loops[vm->nloops++];
+    memset(frame, 0, sizeof(LoopFrame));
+    frame->base = -1;
+    return frame;
+}
+
+static void pop_loop(VM* vm) {
+    LoopFrame* frame = &vm->loops[--vm->nloops];
+    if (frame->base >= 0) args_truncate(&vm->strings, frame->base);
+    update_exit_status(frame->status);
+    if (--running_loops == 0 && watchdog_seconds) watchdog_stop();
+}
+
+// Describe the pending words of command descriptor ci as a Command
+static void build_command(VM* vm, const Chunk* chunk, int ci, Command* cmd) {
+    const CmdInfo* info = &chunk->cmds[ci];
+    int mark = vm->marks[--vm->nmarks];
+    char** base = vm->strings.items + mark;
+
+    cmd->line = info->line;
+    cmd->builtin = info->builtin;
+    cmd->nassigns = info->nassigns;
+    cmd->assign_slots = info->assign_slots;
+    cmd->assign_values = base;
+    cmd->nredirs = info->nredirs;
+    cmd->redirs = info->redirs;
+    cmd->redir_targets = base + info->nassigns;
+    cmd->argv = base + info->nassigns + info->nredirs;
+    cmd->argc = vm->strings.count - mark - info->nassigns - info->nredirs;
+}
+
+// The function a command calls, if any. Constant names were interned when
+// the command was compiled; other names are looked up now.
+static Chunk* command_function(const Chunk* chunk, int ci, const Command* cmd) {
+    int slot = chunk->cmds[ci].function;
+    if (slot < 0 && cmd->argc > 0) slot = function_find(cmd->argv[0]);
+    return slot >= 0 ? function_get(slot) : NULL;
+}
+
+static int call_depth = 0;
+
+// Run a function in this process. Its arguments are $1..$N for the call,
+// and prefix assignments act like exported locals of the call.
+static void call_function(Chunk* body, const Command* cmd) {
+    if (call_depth == MAX_CALL_DEPTH) {
+        fprintf(stderr, "myshell: %s: maximum function nesting level exceeded (%d)\n",
+            cmd->argv[0], MAX_CALL_DEPTH);
+        update_exit_status(1);
+        return;
+    }
+
+    RedirUndo undo;
+    redir_undo_init(&undo);
+    if (redirect_apply(cmd->redirs, cmd->redir_targets, cmd->nredirs, &undo)) {
+        Params caller = params_enter(cmd->argc - 1, cmd->argv + 1);
+        scope_push();
+        for (int i = 0; i < cmd->nassigns; i++) {
+            var_make_local(cmd->assign_slots[i]);
+            var_set(cmd->assign_slots[i], cmd->assign_values[i]);
+            var_export(cmd->assign_slots[i]);
+        }
+        // Redefining the function while it runs must not free its code
+        chunk_retain(body);
+        call_depth++;
+        vm_run(body);
+        call_depth--;
+        chunk_free(body);
+        scope_pop();
+        params_leave(caller);
+    }
+    else {
+        update_exit_status(1);
+    }
+    redirect_restore(&undo);
+    redir_undo_free(&undo);
+}
+
+static void run_command(VM* vm, const Chunk* chunk, int ci, int resolve) {
+    Command cmd;
+    int mark = vm->marks[vm->nmarks - 1];
+    build_command(vm, chunk, ci, &cmd);
+    Chunk* body = command_function(chunk, ci, &cmd);
+    if (body) {
+        call_function(body, &cmd);
+    }
+    else {
+        if (resolve) cmd.builtin = cmd.argc > 0 ? builtin_lookup(cmd.argv[0]) : -1;
+        exec_cmd(&cmd);
+    }
+    args_truncate(&vm->strings, mark);
+}
+
+void vm_run_command(int argc, char** argv) {
+    Command cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.argc = argc;
+    cmd.argv = argv;
+    cmd.builtin = builtin_lookup(argv[0]);
+    int slot = function_find(argv[0]);
+    Chunk* body = slot >= 0 ? function_get(slot) : NULL;
+    if (body) call_function(body, &cmd);
+    else exec_cmd(&cmd);
+}
+
+// A function in a pipeline runs in a forked copy of the shell
+static pid_t call_function_async(Chunk* body, const Command* cmd) {
+    out_flush();
+    fflush(stderr);
+    input_sync_all();
+    pid_t pid = fork();
+    if (pid == 0) {
+        call_function(body, cmd);
+        out_flush();
+        input_sync_all();
+        _exit(get_exit_status());
+    }
+    if (pid < 0) perror("fork");
+    return pid;
+}
+
+static void pipe_stage(VM* vm, const Chunk* chunk, int ci, int last) {
+    Command cmd;
+    int mark = vm->marks[vm->nmarks - 1];
+    build_command(vm, chunk, ci, &cmd);
+    cmd.builtin = cmd.argc > 0 ? builtin_lookup(cmd.argv[0]) : -1;
+    Chunk* body = command_function(chunk, ci, &cmd);
+
+    int status = 1;
+    pid_t pid = -1;
+    if (pipeline_begin_stage(&vm->pipeline, last)) {
+        pid = body ? call_function_async(body, &cmd) : exec_cmd_async(&cmd, &status);
+    }
+    pipeline_end_stage(&vm->pipeline, pid, status);
+    args_truncate(&vm->strings, mark);
+}
+
+// Fork a compound stage; returns 1 in the child
+static int pipe_fork(VM* vm, int last) {
+    pid_t pid = -1;
+    if (pipeline_begin_stage(&vm->pipeline, last)) {
+        out_flush();
+        input_sync_all();
+        pid = fork();
+        if (pid == 0) {
+            // The child only runs its own stage
+            pipeline_free(&vm->pipeline);
+            pipeline_init(&vm->pipeline);
+            vm->forked = 1;
+            return 1;
+        }
+        if (pid < 0) perror("fork");
+    }
+    pipeline_end_stage(&vm->pipeline, pid, 1);
+    return 0;
+}
+
+// Background jobs read from /dev/null unless redirected, as in other
+// non-interactive shells
+static void null_stdin(RedirUndo* undo) {
+    int fd = open("/dev/null", O_RDONLY);
+    if (fd < 0) return;
+    redirect_fd(0, fd, undo);
+    if (fd != 0) close(fd);
+}
+
+static void start_job(VM* vm, const Chunk* chunk, int ci) {
+    Command cmd;
+    int mark = vm->marks[vm->nmarks - 1];
+    build_command(vm, chunk, ci, &cmd);
+    cmd.builtin = cmd.argc > 0 ? builtin_lookup(cmd.argv[0]) : -1;
+    Chunk* body = command_function(chunk, ci, &cmd);
+
+    RedirUndo undo;
+    redir_undo_init(&undo);
+    null_stdin(&undo);
+    job_prepare();
+    int status = 0;
+    pid_t pid = body ? call_function_async(body, &cmd) : exec_cmd_async(&cmd, &status);
+    redirect_restore(&undo);
+    redir_undo_free(&undo);
+
+    if (pid > 0) job_add(pid);
+    update_exit_status(0);
+    args_truncate(&vm->strings, mark);
+}
+
+// Fork a compound background job; returns 1 in the child
+static int fork_job(VM* vm) {
+    out_flush();
+    fflush(stderr);
+    input_sync_all();
+    job_prepare();
+    pid_t pid = fork();
+    if (pid == 0) {
+        null_stdin(NULL);
+        vm->forked = 1;
+        return 1;
+    }
+    if (pid < 0) perror("fork");
+    else job_add(pid);
+    update_exit_status(0);
+    return 0;
+}
+
+static int redir_begin(VM* vm, const Chunk* chunk, int ci) {
+    const CmdInfo* info = &chunk->cmds[ci];
+    int mark = vm->marks[--vm->nmarks];
+    if (vm->nundos == vm->undos_cap) {
+        vm->undos_cap = vm->undos_cap ? vm->undos_cap * 2 : 4;
+        vm->undos = xrealloc(vm->undos, vm->undos_cap * sizeof(RedirUndo));
+    }
+    RedirUndo* undo = &vm->undos[vm->nundos++];
+    redir_undo_init(undo);
+    int ok = redirect_apply(info->redirs, vm->strings.items + mark, info->nredirs, undo);
+    args_truncate(&vm->strings, mark);
+    return ok;
+}
+
+// Command substitution. The body runs in this process when every command
+// in it is a builtin or function that only writes output, which is then
+// captured without a pipe. A body that is one other command starts it
+// with its output on a pipe: an external program is spawned directly and
+// a builtin or function costs one fork. Anything else runs in one forked
+// copy of the shell.
+#define MAX_PURE_DEPTH 8
+
+// Where OP_CAPTURE collects output, or NULL when it should run the
+// command normally because fd 1 or the output buffer already captures
+static StrBuf* capture_target = NULL;
+
+// Whether a body's commands all leave the shell as they found it,
+// following calls to functions a few levels deep
+static int runs_in_shell(const Chunk* chunk, int depth) {
+    if (!chunk->pure || depth == MAX_PURE_DEPTH) return 0;
+    for (int i = 0; i < chunk->ncmds; i++) {
+        const CmdInfo* info = &chunk->cmds[i];
+        if (info->nredirs > 0) return 0;
+        Chunk* body = info->function >= 0 ? function_get(info->function) : NULL;
+        if (body) {
+            // Prefix assignments become locals of the call
+            if (!runs_in_shell(body, depth + 1)) return 0;
+        }
+        else if (info->builtin < 0 || info->nassigns > 0 || !builtin_pure(info->builtin)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static StrBuf* next_capture(VM* vm) {
+    if (vm->ncaptures == vm->captures_cap) {
+        vm->captures_cap = vm->captures_cap ? vm->captures_cap * 2 : 2;
+        vm->captures = xrealloc(vm->captures, vm->captures_cap * sizeof(StrBuf));
+        for (int i = vm->ncaptures; i < vm->captures_cap; i++) sb_init(&vm->captures[i]);
+    }
+    StrBuf* out = &vm->captures[vm->ncaptures++];
+    sb_clear(out);
+    return out;
+}
+
+// Read a started child's output until it closes the pipe, then wait for it
+static void capture_finish(Pipeline* pipeline, pid_t pid, int status, StrBuf* out) {
+    pipeline_end_stage(pipeline, pid, status);
+    for (;;) {
+        sb_reserve(out, 4096);
+        ssize_t n = read(pipeline->in_fd, out->data + out->len, out->cap - out->len - 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        out->len += (size_t)n;
+    }
+    out->data[out->len] = '\0';
+    update_exit_status(pipeline_wait(pipeline));
+    pipeline_free(pipeline);
+}
+
+// OP_CAPTURE: the command's fd 1 is the write end of a pipe
+static void capture_command(VM* vm, const Chunk* chunk, int ci, StrBuf* out) {
+    Command cmd;
+    int mark = vm->marks[vm->nmarks - 1];
+    build_command(vm, chunk, ci, &cmd);
+    cmd.builtin = cmd.argc > 0 ? builtin_lookup(cmd.argv[0]) : -1;
+    Chunk* body = command_function(chunk, ci, &cmd);
+
+    Pipeline pipeline;
+    pipeline_init(&pipeline);
+    int status = 1;
+    pid_t pid = -1;
+    if (pipeline_begin_stage(&pipeline, 0)) {
+        pid = body ? call_function_async(body, &cmd) : exec_cmd_async(&cmd, &status);
+    }
+    capture_finish(&pipeline, pid, status, out);
+    args_truncate(&vm->strings, mark);
+}
+
+static void capture_forked(const Chunk* body, StrBuf* out) {
+    Pipeline pipeline;
+    pipeline_init(&pipeline);
+    pid_t pid = -1;
+    if (pipeline_begin_stage(&pipeline, 0)) {
+        fflush(stderr);
+        input_sync_all();
+        pid = fork();
+        if (pid == 0) {
+            pipeline_free(&pipeline);
+            capture_target = NULL;
+            vm_run(body);
+            out_flush();
+            input_sync_all();
+            _exit(get_exit_status());
+        }
+        if (pid < 0) perror("fork");
+    }
+    capture_finish(&pipeline, pid, 1, out);
+}
+
+static void substitute(const Chunk* body, StrBuf* out) {
+    StrBuf* saved_target = capture_target;
+    // Children must write to their fd 1, not to a copy of this buffer
+    StrBuf* saved_output = out_capture(NULL);
+    if (runs_in_shell(body, 0)) {
+        capture_target = NULL;
+        out_capture(out);
+        vm_run(body);
+        out_capture(NULL);
+    }
+    else if (body->capture && body->pure) {
+        capture_target = out;
+        vm_run(body);
+    }
+    else {
+        capture_forked(body, out);
+    }
+    out_capture(saved_output);
+    capture_target = saved_target;
+
+    while (out->len > 0 && out->data[out->len - 1] == '\n') out->len--;
+    out->data[out->len] = '\0';
+}
+
+static void redir_end(VM* vm) {
+    RedirUndo* undo = &vm->undos[--vm->nundos];
+    redirect_restore(undo);
+    redir_undo_free(undo);
+}
+
+static void pop_strings(VM* vm, int count) {
+    args_truncate(&vm->strings, vm->strings.count - count);
+}
+
+static void append_int(VM* vm, int64_t value) {
+    char buffer[32];
+    int len = sprintf(buffer, "%" PRId64, value);
+    fb_text(&vm->fb, buffer, (size_t)len, 1);
+}
+
+void vm_run(const Chunk* chunk) {
+    VM vm;
+    vm_init(&vm);
+    vm_depth++;
+
+    const int* code = chunk->code;
+    char* const* consts = chunk->consts;
+    int pc = 0;
+    int64_t a, b;
+
+#ifdef VM_COMPUTED_GOTO
+#define OPCODE_LABEL(op) &&do_##op,
+    static void* const dispatch[OP_COUNT] = { OPCODES(OPCODE_LABEL) };
+#undef OPCODE_LABEL
+#define CASE(op) do_##op:
+#define NEXT goto *dispatch[code[pc++]]
+    NEXT;
+#else
+#define CASE(op) case op:
+#define NEXT continue
+    for (;;) switch (code[pc++]) {
+#endif
+
+    CASE(OP_HALT)
+        goto done;
+
+    CASE(OP_LIT)
+        fb_literal(&vm.fb, consts[code[pc++]], 1);
+        NEXT;
+
+    CASE(OP_LIT_GLOB)
+        fb_literal(&vm.fb, consts[code[pc++]], 0);
+        NEXT;
+
+    CASE(OP_VAR)
+        fb_value(&vm.fb, var_get(code[pc++]), 1, &vm.strings);
+        NEXT;
+
+    CASE(OP_VAR_SPLIT)
+        fb_value(&vm.fb, var_get(code[pc++]), 0, &vm.strings);
+        NEXT;
+
+    CASE(OP_VAR_PATTERN)
+        fb_literal(&vm.fb, var_get(code[pc++]), 0);
+        NEXT;
+
+    CASE(OP_VAR_ARGS) {
+        Params params = params_current();
+        for (int i = 0; i < params.count; i++) {
+            if (i > 0) fb_end_fields(&vm.fb, &vm.strings);
+            fb_literal(&vm.fb, params.values[i], 1);
+        }
+        NEXT;
+    }
+
+    CASE(OP_ARITH_STR)
+        append_int(&vm, vm.ints[--vm.nints]);
+        NEXT;
+
+    CASE(OP_SUBST) {
+        // The body may reuse buffers the word points at, such as that of $*
+        if (vm.fb.nspans > 0) fb_detach(&vm.fb);
+        StrBuf* out = next_capture(&vm);
+        substitute(chunk->bodies[code[pc]], out);
+        if (code[pc + 1] == 1) fb_value(&vm.fb, out->data, 0, &vm.strings);
+        else fb_literal(&vm.fb, out->data, code[pc + 1] == 0);
+        pc += 2;
+        NEXT;
+    }
+
+    CASE(OP_FIELDS_END)
+        fb_end_fields(&vm.fb, &vm.strings);
+        vm.ncaptures = 0;
+        NEXT;
+
+    CASE(OP_STRING_END)
+        fb_end_string(&vm.fb, &vm.strings);
+        vm.ncaptures = 0;
+        NEXT;
+
+    CASE(OP_PATTERN_END)
+        fb_end_pattern(&vm.fb, &vm.strings);
+        vm.ncaptures = 0;
+        NEXT;
+
+    CASE(OP_SET_VAR)
+        var_set(code[pc++], vm.strings.items[vm.strings.count - 1]);
+        pop_strings(&vm, 1);
+        NEXT;
+
+    CASE(OP_ARGS_BEGIN)
+        push_mark(&vm);
+        NEXT;
+
+    CASE(OP_CALL_BUILTIN)
+    CASE(OP_SPAWN)
+        run_command(&vm, chunk, code[pc++], 0);
+        NEXT;
+
+    CASE(OP_RUN)
+        run_command(&vm, chunk, code[pc++], 1);
+        NEXT;
+
+    CASE(OP_CAPTURE)
+        if (capture_target) capture_command(&vm, chunk, code[pc++], capture_target);
+        else run_command(&vm, chunk, code[pc++], 1);
+        NEXT;
+
+    CASE(OP_PIPE_STAGE)
+        pipe_stage(&vm, chunk, code[pc], code[pc + 1]);
+        pc += 2;
+        NEXT;
+
+    CASE(OP_PIPE_FORK)
+        if (pipe_fork(&vm, code[pc])) pc += 2;
+        else pc = code[pc + 1];
+        NEXT;
+
+    CASE(OP_CHILD_EXIT)
+        out_flush();
+        input_sync_all();
+        _exit(get_exit_status());
+
+    CASE(OP_JOB)
+        start_job(&vm, chunk, code[pc++]);
+        NEXT;
+
+    CASE(OP_JOB_FORK)
+        if (fork_job(&vm)) pc++;
+        else pc = code[pc];
+        NEXT;
+
+    CASE(OP_PIPE_RUN)
+        update_exit_status(pipeline_wait(&vm.pipeline));
+        NEXT;
+
+    CASE(OP_REDIR_BEGIN)
+        if (redir_begin(&vm, chunk, code[pc])) {
+            pc += 2;
+        }
+        else {
+            update_exit_status(1);
+            pc = code[pc + 1];
+        }
+        NEXT;
+
+    CASE(OP_REDIR_END)
+        redir_end(&vm);
+        NEXT;
+
+    CASE(OP_PUSH_INT)
+        a = (int64_t)((uint64_t)(uint32_t)code[pc] | ((uint64_t)(uint32_t)code[pc + 1] << 32));
+        pc += 2;
+        push_int(&vm, a);
+        NEXT;
+
+    CASE(OP_LOAD_INT)
+        push_int(&vm, var_get_int(code[pc++]));
+        NEXT;
+
+    CASE(OP_STORE_INT)
+        // The word being built may still point at the old value
+        if (vm.fb.nspans > 0) fb_detach(&vm.fb);
+        var_set_int(code[pc++], vm.ints[--vm.nints]);
+        NEXT;
+
+    CASE(OP_DUP_INT)
+        push_int(&vm, vm.ints[vm.nints - 1]);
+        NEXT;
+
+    CASE(OP_POP_INT)
+        vm.nints--;
+        NEXT;
+
+// Binary operators wrap around through unsigned arithmetic, like the folder
+#define INT_BINARY(op, expr) \
+    CASE(op) \
+        b = vm.ints[--vm.nints]; \
+        a = vm.ints[vm.nints - 1]; \
+        vm.ints[vm.nints - 1] = (expr); \
+        NEXT;
+
+    INT_BINARY(OP_ADD, (int64_t)((uint64_t)a + (uint64_t)b))
+    INT_BINARY(OP_SUB, (int64_t)((uint64_t)a - (uint64_t)b))
+    INT_BINARY(OP_MUL, (int64_t)((uint64_t)a * (uint64_t)b))
+    INT_BINARY(OP_SHL, (int64_t)((uint64_t)a << (b & 63)))
+    INT_BINARY(OP_SHR, a >> (b & 63))
+    INT_BINARY(OP_LT, a < b)
+    INT_BINARY(OP_LE, a <= b)
+    INT_BINARY(OP_GT, a > b)
+    INT_BINARY(OP_GE, a >= b)
+    INT_BINARY(OP_EQ, a == b)
+    INT_BINARY(OP_NE, a != b)
+    INT_BINARY(OP_BAND, a & b)
+    INT_BINARY(OP_BXOR, a ^ b)
+    INT_BINARY(OP_BOR, a | b)
+#undef INT_BINARY
+
+    CASE(OP_DIV)
+    CASE(OP_MOD)
+    CASE(OP_POW) {
+        static const ArithOp ops[] = { AOP_DIV, AOP_MOD, AOP_POW };
+        int index = code[pc - 1] == OP_DIV ? 0 : code[pc - 1] == OP_MOD ? 1 : 2;
+        b = vm.ints[--vm.nints];
+        if (!arith_apply(ops[index], vm.ints[vm.nints - 1], b, &vm.ints[vm.nints - 1])) {
+            fprintf(stderr, "myshell: line %d: %s\n", code[pc],
+                index == 2 ? "exponent less than 0" : "division by 0");
+            update_exit_status(1);
+            goto done;
+        }
+        pc++;
+        NEXT;
+    }
+
+    CASE(OP_NEG)
+        vm.ints[vm.nints - 1] = (int64_t)(0 - (uint64_t)vm.ints[vm.nints - 1]);
+        NEXT;
+
+    CASE(OP_BNOT)
+        vm.ints[vm.nints - 1] = ~vm.ints[vm.nints - 1];
+        NEXT;
+
+    CASE(OP_LNOT)
+        vm.ints[vm.nints - 1] = !vm.ints[vm.nints - 1];
+        NEXT;
+
+    CASE(OP_JUMP_IF_ZERO)
+        if (vm.ints[--vm.nints] == 0) pc = code[pc];
+        else pc++;
+        NEXT;
+
+    CASE(OP_JUMP_IF_NONZERO)
+        if (vm.ints[--vm.nints] != 0) pc = code[pc];
+        else pc++;
+        NEXT;
+
+    CASE(OP_JUMP_IF_NOT_INT)
+        if (var_is_int(code[pc])) pc += 2;
+        else pc = code[pc + 1];
+        NEXT;
+
+#define INT_TEST(op, cmp) \
+    CASE(op) \
+        b = vm.ints[--vm.nints]; \
+        a = vm.ints[--vm.nints]; \
+        update_exit_status(a cmp b ? 0 : 1); \
+        NEXT;
+
+    INT_TEST(OP_TEST_EQ, ==)
+    INT_TEST(OP_TEST_NE, !=)
+    INT_TEST(OP_TEST_LT, <)
+    INT_TEST(OP_TEST_LE, <=)
+    INT_TEST(OP_TEST_GT, >)
+    INT_TEST(OP_TEST_GE, >=)
+#undef INT_TEST
+
+    CASE(OP_TEST_STREQ)
+        a = strcmp(vm.strings.items[vm.strings.count - 2], vm.strings.items[vm.strings.count - 1]);
+        pop_strings(&vm, 2);
+        update_exit_status(a == 0 ? 0 : 1);
+        NEXT;
+
+    CASE(OP_TEST_STRNE)
+        a = strcmp(vm.strings.items[vm.strings.count - 2], vm.strings.items[vm.strings.count - 1]);
+        pop_strings(&vm, 2);
+        update_exit_status(a != 0 ? 0 : 1);
+        NEXT;
+
+    CASE(OP_MATCH)
+        a = pattern_match(vm.strings.items[vm.strings.count - 1], vm.strings.items[vm.strings.count - 2]);
+        pop_strings(&vm, 1);
+        if (a) pc = code[pc];
+        else pc++;
+        NEXT;
+
+    CASE(OP_CASE)
+        a = matcher_find(chunk->matchers[code[pc]], vm.strings.items[vm.strings.count - 1]);
+        pop_strings(&vm, 1);
+        pc = code[pc + 2 + (a >= 0 ? a : code[pc + 1])];
+        NEXT;
+
+    CASE(OP_POP_STRING)
+        pop_strings(&vm, 1);
+        NEXT;
+
+    CASE(OP_JUMP)
+        pc = code[pc];
+        NEXT;
+
+    CASE(OP_JUMP_IF_OK)
+        if (get_exit_status() == 0) pc = code[pc];
+        else pc++;
+        NEXT;
+
+    CASE(OP_JUMP_IF_FAIL)
+        if (get_exit_status() != 0) pc = code[pc];
+        else pc++;
+        NEXT;
+
+    CASE(OP_NOT)
+        update_exit_status(get_exit_status() == 0 ? 1 : 0);
+        NEXT;
+
+    CASE(OP_SET_STATUS)
+        update_exit_status(code[pc++]);
+        NEXT;
+
+    CASE(OP_FOR_INIT) {
+        // The words stay on the string stack, below everything the body pushes
+        LoopFrame* frame = push_loop(&vm);
+        frame->base = vm.marks[--vm.nmarks];
+        frame->count = vm.strings.count - frame->base;
+        NEXT;
+    }
+
+    CASE(OP_FOR_NEXT) {
+        LoopFrame* frame = &vm.loops[vm.nloops - 1];
+        if (frame->next < frame->count) {
+            var_set(code[pc], vm.strings.items[frame->base + frame->next++]);
+            pc += 2;
+        }
+        else {
+            pc = code[pc + 1];
+        }
+        NEXT;
+    }
+
+    CASE(OP_WHILE_INIT)
+        push_loop(&vm);
+        NEXT;
+
+    CASE(OP_LOOP_CHECK)
+        if (watchdog_fired) {
+            if (watchdog_fired == 1) {
+                fprintf(stderr, "myshell: loop stopped after %ld seconds (MYSHELL_LOOP_TIMEOUT)\n",
+                    watchdog_seconds);
+                watchdog_fired = 2;
+            }
+            vm.loops[vm.nloops - 1].status = 1;
+            pc = code[pc];
+        }
+        else {
+            pc++;
+        }
+        NEXT;
+
+    CASE(OP_LOOP_SAVE)
+        vm.loops[vm.nloops - 1].status = get_exit_status();
+        NEXT;
+
+    CASE(OP_LOOP_END)
+        pop_loop(&vm);
+        NEXT;
+
+    CASE(OP_LOOP_EXIT)
+        for (a = code[pc]; a > 0; a--) pop_loop(&vm);
+        update_exit_status(0);
+        pc = code[pc + 1];
+        NEXT;
+
+    CASE(OP_DEFINE)
+        function_define(code[pc], chunk->bodies[code[pc + 1]]);
+        pc += 2;
+        update_exit_status(0);
+        NEXT;
+
+    CASE(OP_RETURN)
+        if (code[pc]) {
+            const char* text = vm.strings.items[vm.strings.count - 1];
+            char* end;
+            long value = strtol(text, &end, 10);
+            if (end == text || *end) {
+                fprintf(stderr, "myshell: return: %s: numeric argument required\n", text);
+                value = 2;
+            }
+            update_exit_status((int)(value & 255));
+        }
+        goto done;
+
+    CASE(OP_ERROR)
+        // Like an expansion error in other shells: the command is abandoned
+        fprintf(stderr, "%s\n", consts[code[pc++]]);
+        update_exit_status(1);
+        goto done;
+
+#ifndef VM_COMPUTED_GOTO
+    default:
+        goto done;
+    }
+#endif
+#undef CASE
+#undef NEXT
+
+done:
+    // A forked stage that stops early must not go on to run the parent's script
+    if (vm.forked) {
+        out_flush();
+        input_sync_all();
+        _exit(get_exit_status());
+    }
+    // Loops and redirections left early keep the status that ended them
+    a = get_exit_status();
+    while (vm.nloops > 0) pop_loop(&vm);
+    while (vm.nundos > 0) redir_end(&vm);
+    update_exit_status((int)a);
+    args_truncate(&vm.strings, 0);
+    vm_free(&vm);
+    if (--vm_depth == 0) arena_reset(&scratch);
+}
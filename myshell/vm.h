@@ -0,0 +1,13 @@
+#ifndef VM_H
+#define VM_H
+
+#include "bytecode.h"
+
+// Execute a compiled chunk; the final status is left in $?
+void vm_run(const Chunk* chunk);
+
+// Run a command from words that are already expanded, the way a line of
+// a script would: a function, a builtin or a program. argv ends with NULL.
+void vm_run_command(int argc, char** argv);
+
+#endif